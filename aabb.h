@@ -32,6 +32,8 @@ public:
         x = (a[0] <= b[0]) ? interval(a[0], b[0]) : interval(b[0], a[0]);
         y = (a[1] <= b[1]) ? interval(a[1], b[1]) : interval(b[1], a[1]);
         z = (a[2] <= b[2]) ? interval(a[2], b[2]) : interval(b[2], a[2]);
+
+        pad_to_minimums();
     }
 
     aabb(const aabb& box0, const aabb& box1)
@@ -69,7 +71,7 @@ public:
             else
             {
                 if (t1 > ray_t.min) ray_t.min = t1;
-                if (t0 > ray_t.max) ray_t.max = t0;
+                if (t0 < ray_t.max) ray_t.max = t0;
             }
 
             if (ray_t.max <= ray_t.min)
@@ -0,0 +1,235 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <print>
+#include <vector>
+
+#include "camera.h"
+#include "hittable.h"
+#include "motion_bvh.h"
+
+// Values keyed by frame number, linearly interpolated in between and held constant before the
+// first and after the last key
+template<typename T>
+class keyframe_track
+{
+public:
+    keyframe_track() = default;
+    keyframe_track(const T& value) { add(0, value); }
+
+    void add(double frame, const T& value)
+    {
+        const auto position = std::upper_bound(keys.begin(), keys.end(), frame, [](double f, const key& k)
+        {
+            return f < k.frame;
+        });
+        keys.insert(position, key{frame, value});
+    }
+
+    bool empty() const { return keys.empty(); }
+
+    T at(double frame) const
+    {
+        if (keys.empty())
+        {
+            return T{};
+        }
+        if (frame <= keys.front().frame)
+        {
+            return keys.front().value;
+        }
+        if (frame >= keys.back().frame)
+        {
+            return keys.back().value;
+        }
+
+        const auto next = std::upper_bound(keys.begin(), keys.end(), frame, [](double f, const key& k)
+        {
+            return f < k.frame;
+        });
+        const auto& a = *(next - 1);
+        const auto& b = *next;
+        const auto f = (frame - a.frame) / (b.frame - a.frame);
+        return (1 - f) * a.value + f * b.value;
+    }
+
+private:
+    struct key
+    {
+        double frame;
+        T value;
+    };
+
+    std::vector<key> keys;
+};
+
+// Rotates an object about the y axis and then translates it, both keyframed per frame. The
+// transform is fixed while a frame renders, set_frame moves it between frames.
+class animated_transform : public hittable
+{
+public:
+    animated_transform(std::shared_ptr<hittable> object, keyframe_track<vec3> offset, keyframe_track<double> angle = 0.0)
+        : object(object)
+        , offset_track(std::move(offset))
+        , angle_track(std::move(angle))
+    {
+        set_frame(0);
+    }
+
+    void set_frame(double frame)
+    {
+        const auto radians = degrees_to_radians(angle_track.at(frame));
+        sin_theta = std::sin(radians);
+        cos_theta = std::cos(radians);
+        offset = offset_track.at(frame);
+        bbox = rotate_y_bounds(object->bounding_box(), sin_theta, cos_theta) + offset;
+    }
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override
+    {
+        ray object_r(to_object(r.origin() - offset), to_object(r.direction()), r.time());
+        if (!object->hit(object_r, ray_t, rec))
+        {
+            return false;
+        }
+
+        rec.p = to_world(rec.p) + offset;
+        rec.normal = to_world(rec.normal);
+        return true;
+    }
+
+    aabb bounding_box() const override { return bbox; }
+
+    double pdf_value(const point3& origin, const vec3& direction) const override
+    {
+        return object->pdf_value(to_object(origin - offset), to_object(direction));
+    }
+
+    vec3 random(const point3& origin) const override
+    {
+        return to_world(object->random(to_object(origin - offset)));
+    }
+
+private:
+    vec3 to_object(const vec3& v) const
+    {
+        return vec3(cos_theta * v.x() - sin_theta * v.z(), v.y(), sin_theta * v.x() + cos_theta * v.z());
+    }
+
+    vec3 to_world(const vec3& v) const
+    {
+        return vec3(cos_theta * v.x() + sin_theta * v.z(), v.y(), -sin_theta * v.x() + cos_theta * v.z());
+    }
+
+    std::shared_ptr<hittable> object;
+    keyframe_track<vec3> offset_track;
+    keyframe_track<double> angle_track;
+    vec3 offset;
+    double sin_theta = 0;
+    double cos_theta = 1;
+    aabb bbox;
+};
+
+// Renders a range of frames of a scene with keyframed objects and camera. Between frames the
+// objects are moved and the motion_bvh over the scene is refit instead of rebuilt, since the
+// set of objects stays the same. Subtrees that the motion has degraded too far are rebuilt.
+class animation
+{
+public:
+    int first_frame = 0;
+    int last_frame = 0;
+    double rebuild_threshold = 1.5; // Passed to motion_bvh::refit
+    bool full_rebuild = false; // Rebuild the whole hierarchy every frame, for comparison
+
+    // Camera path, empty tracks keep the camera setting
+    keyframe_track<point3> lookfrom;
+    keyframe_track<point3> lookat;
+    keyframe_track<double> vfov;
+
+    void add(const std::shared_ptr<animated_transform>& object) { objects.push_back(object); }
+
+    void set_frame(double frame)
+    {
+        for (const auto& object : objects)
+        {
+            object->set_frame(frame);
+        }
+    }
+
+    // Render every frame to directory/frame_NNNN.ppm and report per frame timings
+    bool render(camera& cam, motion_bvh& world, const hittable& lights, const std::filesystem::path& directory)
+    {
+        std::error_code error;
+        std::filesystem::create_directories(directory, error);
+        if (error)
+        {
+            std::println(std::cerr, "ERROR: Could not create frame directory {}", directory.string());
+            return false;
+        }
+
+        double total_update_ms = 0;
+        double total_render_s = 0;
+        for (int frame = first_frame; frame <= last_frame; ++frame)
+        {
+            const auto update_start = std::chrono::steady_clock::now();
+            set_frame(frame);
+            motion_bvh::refit_stats stats;
+            if (full_rebuild)
+            {
+                world.rebuild();
+            }
+            else
+            {
+                stats = world.refit(rebuild_threshold);
+            }
+            const auto update_end = std::chrono::steady_clock::now();
+
+            if (!lookfrom.empty()) cam.lookfrom = lookfrom.at(frame);
+            if (!lookat.empty()) cam.lookat = lookat.at(frame);
+            if (!vfov.empty()) cam.vfov = vfov.at(frame);
+
+            const auto filename = directory / std::format("frame_{:04}.ppm", frame);
+            std::ofstream out(filename);
+            if (!out)
+            {
+                std::println(std::cerr, "ERROR: Could not write frame {}", filename.string());
+                return false;
+            }
+            if (!cam.render(world, lights, out))
+            {
+                std::println(std::cerr, "ERROR: Could not render frame {}", filename.string());
+                return false;
+            }
+            const auto render_end = std::chrono::steady_clock::now();
+
+            const auto update_ms = std::chrono::duration<double, std::milli>(update_end - update_start).count();
+            const auto render_s = std::chrono::duration<double>(render_end - update_end).count();
+            total_update_ms += update_ms;
+            total_render_s += render_s;
+
+            if (full_rebuild)
+            {
+                std::println(std::clog, "Frame {}: rebuild {:.3f} ms, render {:.2f} s", frame, update_ms, render_s);
+            }
+            else
+            {
+                std::println(std::clog, "Frame {}: refit {:.3f} ms ({} nodes, {} subtrees / {} objects rebuilt), render {:.2f} s",
+                    frame, update_ms, stats.refit_nodes, stats.rebuilt_subtrees, stats.rebuilt_objects, render_s);
+            }
+        }
+
+        const auto frames = last_frame - first_frame + 1;
+        std::println(std::clog, "{} frames: {:.3f} ms acceleration update, {:.2f} s render in total",
+            frames, total_update_ms, total_render_s);
+        return true;
+    }
+
+private:
+    std::vector<std::shared_ptr<animated_transform>> objects;
+};
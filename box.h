@@ -0,0 +1,282 @@
+#pragma once
+
+#include <array>
+#include <memory>
+
+#include "hittable.h"
+#include "scene_arena.h"
+
+// An axis-aligned box primitive that contains the two opposite vertices a & b. A single slab test
+// replaces the six quads and list walk of the old box, and the hit record gets the same face
+// normals and UV coordinates the six quads used to produce.
+class aligned_box final : public hittable
+{
+public:
+    aligned_box(const point3& a, const point3& b, const material* mat)
+        : min(std::fmin(a.x(), b.x()), std::fmin(a.y(), b.y()), std::fmin(a.z(), b.z()))
+        , max(std::fmax(a.x(), b.x()), std::fmax(a.y(), b.y()), std::fmax(a.z(), b.z()))
+        , mat(mat)
+    {
+        bbox = aabb(min, max);
+
+        const auto size = max - min;
+        face_area[0] = size.y() * size.z();
+        face_area[1] = size.x() * size.z();
+        face_area[2] = size.x() * size.y();
+        area = 2 * (face_area[0] + face_area[1] + face_area[2]);
+    }
+
+    aabb bounding_box() const override { return bbox; }
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override
+    {
+        double t_near;
+        double t_far;
+        int axis_near;
+        int axis_far;
+        if (!slabs(r, t_near, t_far, axis_near, axis_far))
+        {
+            return false;
+        }
+
+        // Take the entry face if it is in range, otherwise the exit face (ray starts inside)
+        double t;
+        int axis;
+        bool entering;
+        if (ray_t.surrounds(t_near))
+        {
+            t = t_near;
+            axis = axis_near;
+            entering = true;
+        }
+        else if (ray_t.surrounds(t_far))
+        {
+            t = t_far;
+            axis = axis_far;
+            entering = false;
+        }
+        else
+        {
+            return false;
+        }
+
+        rec.t = t;
+        rec.p = r.at(t);
+        rec.mat = mat;
+
+        // The entry face is the one facing against the ray, the exit face the one facing along it
+        const auto direction_sign = r.direction()[axis] < 0 ? -1.0 : 1.0;
+        vec3 outward_normal;
+        outward_normal[axis] = entering ? -direction_sign : direction_sign;
+        rec.set_face_normal(r, outward_normal);
+        set_face_uv(rec.p, axis, outward_normal[axis] > 0, rec.u, rec.v);
+
+        return true;
+    }
+
+    double pdf_value(const point3& origin, const vec3& direction) const override
+    {
+        // Points are sampled uniformly over the whole surface, so both the entry and the exit
+        // point along the direction contribute to the solid angle density.
+        double t_near;
+        double t_far;
+        int axis_near;
+        int axis_far;
+        if (!slabs(ray(origin, direction), t_near, t_far, axis_near, axis_far))
+        {
+            return 0;
+        }
+
+        const auto length_squared = direction.length_squared();
+        const auto length = std::sqrt(length_squared);
+        auto sum = 0.0;
+        static const interval forward(0.001, infinity);
+        if (forward.surrounds(t_near))
+        {
+            sum += t_near * t_near * length_squared * length / std::fabs(direction[axis_near]);
+        }
+        if (forward.surrounds(t_far))
+        {
+            sum += t_far * t_far * length_squared * length / std::fabs(direction[axis_far]);
+        }
+
+        return sum / area;
+    }
+
+    vec3 random(const point3& origin) const override
+    {
+        // Pick a face proportionally to its area, then a uniform point on it
+        auto pick = random_double() * area / 2;
+        int axis = 0;
+        while (axis < 2 && pick >= face_area[axis])
+        {
+            pick -= face_area[axis];
+            ++axis;
+        }
+
+        point3 p(random_double(min.x(), max.x()), random_double(min.y(), max.y()), random_double(min.z(), max.z()));
+        p[axis] = random_double() < 0.5 ? min[axis] : max[axis];
+        return p - origin;
+    }
+
+private:
+    // Slab test against the three axis intervals. Returns the entry and exit parameters with the
+    // axes of the faces that produced them.
+    bool slabs(const ray& r, double& t_near, double& t_far, int& axis_near, int& axis_far) const
+    {
+        t_near = -infinity;
+        t_far = infinity;
+        axis_near = 0;
+        axis_far = 0;
+
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            const double adinv = 1.0 / r.direction()[axis];
+            auto t0 = (min[axis] - r.origin()[axis]) * adinv;
+            auto t1 = (max[axis] - r.origin()[axis]) * adinv;
+            if (t0 > t1)
+            {
+                std::swap(t0, t1);
+            }
+
+            if (t0 > t_near)
+            {
+                t_near = t0;
+                axis_near = axis;
+            }
+            if (t1 < t_far)
+            {
+                t_far = t1;
+                axis_far = axis;
+            }
+
+            if (t_far < t_near)
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    // Texture coordinates matching the corners and edge vectors of the quads built by the old
+    // six-sided box: front, right, back, left, top and bottom.
+    void set_face_uv(const point3& p, int axis, bool positive, double& u, double& v) const
+    {
+        // A flat box has no extent along one axis, its faces there map to 0 instead of NaN
+        const auto size = max - min;
+        const auto fraction = [](double offset, double extent) { return extent > 0 ? offset / extent : 0.0; };
+        const auto x = fraction(p.x() - min.x(), size.x());
+        const auto y = fraction(p.y() - min.y(), size.y());
+        const auto z = fraction(p.z() - min.z(), size.z());
+
+        switch (axis)
+        {
+            case 0: u = positive ? 1 - z : z; v = y; break; // right / left
+            case 1: u = x; v = positive ? 1 - z : z; break; // top / bottom
+            default: u = positive ? x : 1 - x; v = y; break; // front / back
+        }
+    }
+
+private:
+    point3 min;
+    point3 max;
+    const material* mat;
+    aabb bbox;
+    std::array<double, 3> face_area; // Area of a single face perpendicular to each axis
+    double area; // Total surface area
+};
+
+// A box rotated around the Y axis by angle degrees and then moved by offset, equivalent to
+// translate(rotate_y(box(a, b), angle), offset) without the two wrappers. The ray is moved into
+// the box frame once and intersected with the aligned_box slab test.
+class oriented_box final : public hittable
+{
+public:
+    oriented_box(const point3& a, const point3& b, double angle, const vec3& offset, const material* mat)
+        : local(a, b, mat)
+        , offset(offset)
+    {
+        const auto radians = degrees_to_radians(angle);
+        sin_theta = std::sin(radians);
+        cos_theta = std::cos(radians);
+
+        const auto& local_bbox = local.bounding_box();
+        point3 min(infinity, infinity, infinity);
+        point3 max(-infinity, -infinity, -infinity);
+
+        for (int i = 0; i < 2; i++)
+        {
+            for (int j = 0; j < 2; j++)
+            {
+                for (int k = 0; k < 2; k++)
+                {
+                    auto x = i * local_bbox.x.max + (1 - i) * local_bbox.x.min;
+                    auto y = j * local_bbox.y.max + (1 - j) * local_bbox.y.min;
+                    auto z = k * local_bbox.z.max + (1 - k) * local_bbox.z.min;
+
+                    const auto corner = to_world(point3(x, y, z)) + offset;
+
+                    for (int c = 0; c < 3; c++)
+                    {
+                        min[c] = std::fmin(min[c], corner[c]);
+                        max[c] = std::fmax(max[c], corner[c]);
+                    }
+                }
+            }
+        }
+
+        bbox = aabb(min, max);
+    }
+
+    aabb bounding_box() const override { return bbox; }
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override
+    {
+        ray local_r(to_local(r.origin() - offset), to_local(r.direction()), r.time());
+
+        if (!local.hit(local_r, ray_t, rec))
+        {
+            return false;
+        }
+
+        rec.p = to_world(rec.p) + offset;
+        rec.normal = to_world(rec.normal);
+        return true;
+    }
+
+    double pdf_value(const point3& origin, const vec3& direction) const override
+    {
+        return local.pdf_value(to_local(origin - offset), to_local(direction));
+    }
+
+    vec3 random(const point3& origin) const override
+    {
+        return to_world(local.random(to_local(origin - offset)));
+    }
+
+private:
+    vec3 to_local(const vec3& v) const
+    {
+        return vec3(cos_theta * v.x() - sin_theta * v.z(), v.y(), sin_theta * v.x() + cos_theta * v.z());
+    }
+
+    vec3 to_world(const vec3& v) const
+    {
+        return vec3(cos_theta * v.x() + sin_theta * v.z(), v.y(), -sin_theta * v.x() + cos_theta * v.z());
+    }
+
+private:
+    aligned_box local;
+    vec3 offset;
+    double sin_theta;
+    double cos_theta;
+    aabb bbox;
+};
+
+// Returns the 3D box that contains the two opposite vertices a & b.
+// The box is allocated from the arena when one is given.
+std::shared_ptr<aligned_box> box(const point3& a, const point3& b, const material* mat, scene_arena* arena = nullptr)
+{
+    return make_scene_object<aligned_box>(arena, a, b, mat);
+}
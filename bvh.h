@@ -2,6 +2,7 @@
 
 #include "hittable.h"
 #include "hittable_list.h"
+#include "scene_arena.h"
 
 #include <algorithm>
 
@@ -9,13 +10,14 @@
 class bvh_node : public hittable
 {
 public:
-    bvh_node(hittable_list list)
-        : bvh_node(list.objects, 0, list.objects.size())
+    // Inner nodes are allocated from the arena when one is given
+    bvh_node(hittable_list list, scene_arena* arena = nullptr)
+        : bvh_node(list.objects, 0, list.objects.size(), arena)
     {
         // The input hittable list is copied on purpose
     }
 
-    bvh_node(std::vector<std::shared_ptr<hittable>>& objects, size_t start, size_t end)
+    bvh_node(std::vector<std::shared_ptr<hittable>>& objects, size_t start, size_t end, scene_arena* arena = nullptr)
     {
         // Build the bounding box of the span of source objects
         bbox = aabb::empty;
@@ -43,8 +45,8 @@ public:
         {
             std::sort(std::begin(objects) + start, std::begin(objects) + end, comparator);
             const auto mid = start + object_span / 2;
-            left = std::make_shared<bvh_node>(objects, start, mid); // Open-ended interval
-            right = std::make_shared<bvh_node>(objects, mid, end);
+            left = make_scene_object<bvh_node>(arena, objects, start, mid, arena); // Open-ended interval
+            right = make_scene_object<bvh_node>(arena, objects, mid, end, arena);
         }
 
         bbox = aabb(left->bounding_box(), right->bounding_box());
@@ -52,6 +54,7 @@ public:
 
     bool hit(const ray& r, interval ray_t, hit_record& rec) const override
     {
+        count_node_visit();
         if (!bbox.hit(r, ray_t))
         {
             return false;
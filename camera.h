@@ -1,10 +1,23 @@
 #pragma once
 
+#include <chrono>
+#include <ctime>
+#include <filesystem>
+#include <optional>
 #include <print>
+#include <string>
+#include <vector>
 
+#include "denoiser.h"
+#include "environment_light.h"
 #include "hittable.h"
+#include "image_writer.h"
 #include "material.h"
 #include "pdf.h"
+#include "progressive.h"
+#include "render_farm.h"
+#include "sampler.h"
+#include "wavefront.h"
 
 class camera
 {
@@ -13,7 +26,9 @@ public:
     int image_width = 100; // Rendered image width in pixel count
     int samples_per_pixel = 10; // Count of random samples for each pixel
     int max_depth = 10; // Maximum number of ray bounces into scene
+    mis_heuristic heuristic = mis_heuristic::power; // How light found by both scattered rays and light samples is shared
     color background; // Scene background color
+    const environment_light* environment = nullptr; // When set, what rays that miss the world see instead of background
 
     double vfov = 90; // Vertical view angle (field of view)
     point3 lookfrom = point3(0, 0, 0); // Point camera is looking from
@@ -23,41 +38,406 @@ public:
     double defocus_angle = 0; // Variation angle in degrees of rays through each pixel
     double focus_distance = 10; // Distance from camera lookfrom point to plane of perfect focus
 
-    void render(const hittable& world, const hittable& lights)
+    sampler_type sampling = sampler_type::sobol; // Sample pattern of every path dimension
+    uint32_t sampler_seed = 0; // Decorrelates the sample patterns of different renders
+
+    integrator_type integrator = integrator_type::recursive; // How paths are traced
+    int thread_count = 0; // Threads of the wavefront integrator, 0 for one per hardware thread
+    worker_pool* shared_pool = nullptr; // Threads shared with other renders, used instead of thread_count
+    size_t reorder_batch = 4096; // Secondary rays the wavefront integrator sorts together, 0 for none
+
+    bool denoise = false; // Filter the image guided by the first hit albedo, normal and depth
+    std::string aov_prefix; // When set, write the albedo, normal and depth buffers to prefix*.ppm
+
+    // When set, the render accumulates into this file in passes and continues from it if it
+    // exists, up to samples_per_pixel samples. Raise samples_per_pixel to extend a finished one.
+    std::string checkpoint;
+    double checkpoint_interval = 60; // Seconds between checkpoint saves
+
+    image_format output_format = image_format::plain_ppm;
+
+    // When above 0, this many worker processes render the image. They are forked with the scene
+    // already built and take jobs of bands and sample ranges over a Unix socket.
+    int worker_processes = 0;
+    int samples_per_job = 0; // Samples per pixel of a distributed job, 0 for all of them
+
+    bool render(const hittable& world, const hittable& lights)
+    {
+        return render(world, lights, std::cout);
+    }
+
+    // Render the image to out. Rows are written on a separate thread in bands while the next
+    // bands render, unless a checkpoint or the denoiser needs the whole image first. Return
+    // whether the whole image was written.
+    bool render(const hittable& world, const hittable& lights, std::ostream& out)
     {
         initialize();
 
-        std::print("P3\n{}\n{}\n255\n", image_width, image_height);
+        if (worker_processes > 0)
+        {
+            return render_distributed(world, lights, out);
+        }
+
+        std::optional<aov_buffers> aovs;
+        if (denoise || !aov_prefix.empty())
+        {
+            aovs.emplace(image_width, image_height);
+        }
+
+        const auto record = [&](std::vector<color>& pixels, size_t first_pixel)
+        {
+            return [&pixels, &aovs, first_pixel](uint32_t pixel, uint32_t, const color& radiance, const aov_sample& first_hit)
+            {
+                pixels[pixel - first_pixel] += radiance;
+                if (aovs)
+                {
+                    aovs->add_sample(pixel, radiance, first_hit);
+                }
+            };
+        };
+
+        if (checkpoint.empty() && !denoise)
+        {
+            auto engine = make_integrator(sampling);
+            band_writer writer(out, output_format, image_width, image_height);
+            for (int first_row = 0; first_row < image_height; first_row += band_rows)
+            {
+                const auto row_count = std::min(band_rows, image_height - first_row);
+                const auto first_pixel = size_t(first_row) * image_width;
+                std::vector<color> band(size_t(row_count) * image_width, color(0, 0, 0));
+                trace(engine, world, lights, sampling, first_row, row_count, 0, samples_per_pixel,
+                    record(band, first_pixel));
+                for (auto& pixel_color : band)
+                {
+                    pixel_color *= pixel_samples_scale;
+                }
+                writer.push(std::move(band));
+            }
+            std::println(std::clog, "\rDone.                 ");
+            if (engine)
+            {
+                engine->print_stats();
+            }
+
+            if (aovs)
+            {
+                aovs->write(aov_prefix);
+            }
+            return writer.finish();
+        }
+
+        std::vector<color> pixels(size_t(image_width) * image_height, color(0, 0, 0));
+        if (checkpoint.empty())
+        {
+            auto engine = make_integrator(sampling);
+            trace(engine, world, lights, sampling, 0, image_height, 0, samples_per_pixel, record(pixels, 0));
+            for (auto& pixel_color : pixels)
+            {
+                pixel_color *= pixel_samples_scale;
+            }
+            if (engine)
+            {
+                engine->print_stats();
+            }
+        }
+        else if (!render_progressive(world, lights, aovs ? &*aovs : nullptr, pixels))
+        {
+            return false;
+        }
+        std::println(std::clog, "\rDone.                 ");
 
-        for (int j = 0; j < image_height; ++j)
+        if (aovs && !aov_prefix.empty())
+        {
+            aovs->write(aov_prefix);
+        }
+        if (denoise)
+        {
+            std::optional<worker_pool> own_pool;
+            auto& pool = shared_pool ? *shared_pool : own_pool.emplace(thread_count);
+            denoiser filter;
+            pixels = filter.filter(pixels, *aovs, pool);
+        }
+
+        band_writer writer(out, output_format, image_width, image_height);
+        for (int first_row = 0; first_row < image_height; first_row += band_rows)
+        {
+            const auto first = pixels.begin() + ptrdiff_t(first_row) * image_width;
+            const auto rows = std::min(band_rows, image_height - first_row);
+            writer.push(std::vector<color>(first, first + ptrdiff_t(rows) * image_width));
+        }
+        return writer.finish();
+    }
+private:
+    static constexpr int progressive_pass = 4; // Samples per pixel traced between checkpoint checks
+    static constexpr int band_pixels = 1 << 16; // Pixels per band of streamed output
+
+    // The wavefront integrator for sample pattern, none when paths are traced one at a time. One
+    // is made per render so its threads and path buffers serve every band.
+    std::optional<wavefront_integrator> make_integrator(sampler_type pattern) const
+    {
+        std::optional<wavefront_integrator> engine;
+        if (integrator != integrator_type::wavefront)
+        {
+            return engine;
+        }
+        if (shared_pool)
+        {
+            engine.emplace(*shared_pool);
+        }
+        else
+        {
+            engine.emplace(thread_count);
+        }
+        engine->max_depth = max_depth;
+        engine->heuristic = heuristic;
+        engine->background = background;
+        engine->environment = environment;
+        engine->sampling = pattern;
+        engine->sampler_seed = sampler_seed;
+        engine->reorder_batch = reorder_batch;
+        return engine;
+    }
+
+    // Trace samples [first_sample, first_sample + sample_count) of every pixel in the rows
+    // [first_row, first_row + row_count) with engine, or one path at a time without one, and
+    // hand each path to retire(pixel, sample, radiance, first_hit)
+    template<typename Retire>
+    void trace(std::optional<wavefront_integrator>& engine, const hittable& world, const hittable& lights,
+        sampler_type pattern, int first_row, int row_count, int first_sample, int sample_count,
+        const Retire& retire) const
+    {
+        if (engine)
+        {
+            engine->render(world, lights, image_width, first_row, row_count, first_sample, sample_count,
+                [this](int i, int j) { return get_ray(i, j); }, retire);
+            return;
+        }
+
+        // One path at a time
+        auto samples = make_sampler(pattern, sampler_seed);
+        for (int j = first_row; j < first_row + row_count; ++j)
         {
             std::print(std::clog, "\rScanlines remaining {} ", image_height - j);
             std::clog.flush();
             for (int i = 0; i < image_width; ++i)
             {
-                color pixel_color(0, 0, 0);
-                for (int s_j = 0; s_j < sqrt_spp; ++s_j)
+                const auto pixel = uint32_t(j * image_width + i);
+                for (int sample = first_sample; sample < first_sample + sample_count; ++sample)
+                {
+                    // Every random draw along the path reads the next dimension of this sample
+                    if (samples)
+                    {
+                        samples->start_sample(i, j, uint32_t(sample));
+                        active_sample_stream = samples.get();
+                    }
+                    ray r = get_ray(i, j);
+                    aov_sample first_hit;
+                    const auto radiance = ray_color(r, max_depth, world, lights, &first_hit);
+                    active_sample_stream = nullptr;
+                    retire(pixel, uint32_t(sample), radiance, first_hit);
+                }
+            }
+        }
+    }
+
+    // Accumulate passes of samples into the checkpoint until every pixel has samples_per_pixel,
+    // saving every checkpoint_interval seconds and at the end, and return the pixel means.
+    // Within a pass the samples are added in sample order, so the sums do not depend on where
+    // a render was interrupted. The AOVs only cover the samples traced by this run.
+    bool render_progressive(const hittable& world, const hittable& lights, aov_buffers* aovs, std::vector<color>& pixels) const
+    {
+        // A resumed pass must draw the same values, which the shared generator cannot replay
+        const auto pattern = sampling == sampler_type::independent ? sampler_type::random : sampling;
+
+        accumulation_buffer accumulation(image_width, image_height, pattern, sampler_seed);
+        if (std::filesystem::exists(checkpoint))
+        {
+            if (!accumulation.load(checkpoint))
+            {
+                return false;
+            }
+            std::println(std::clog, "Resuming {} at {} samples per pixel", checkpoint, accumulation.min_samples());
+        }
+
+        auto engine = make_integrator(pattern);
+        auto last_save = std::chrono::steady_clock::now();
+        std::vector<color> pass;
+        while (true)
+        {
+            const auto first_sample = int(accumulation.min_samples());
+            const auto sample_count = std::min(progressive_pass, samples_per_pixel - first_sample);
+            if (sample_count <= 0)
+            {
+                break;
+            }
+
+            pass.assign(accumulation.size() * sample_count, color(0, 0, 0));
+            trace(engine, world, lights, pattern, 0, image_height, first_sample, sample_count,
+                [&](uint32_t pixel, uint32_t sample, const color& radiance, const aov_sample& first_hit)
+                {
+                    pass[size_t(pixel) * sample_count + (sample - first_sample)] = radiance;
+                    if (aovs)
+                    {
+                        aovs->add_sample(pixel, radiance, first_hit);
+                    }
+                });
+            for (size_t pixel = 0; pixel < accumulation.size(); ++pixel)
+            {
+                for (int sample = first_sample; sample < first_sample + sample_count; ++sample)
                 {
-                    for (int s_i = 0; s_i < sqrt_spp; ++s_i)
+                    // Pixels already ahead of the pass keep their own samples
+                    if (accumulation.samples(pixel) == uint32_t(sample))
                     {
-                        ray r = get_ray(i, j, s_i, s_j);
-                        pixel_color += ray_color(r, max_depth, world, lights);
+                        accumulation.add(pixel, pass[pixel * sample_count + (sample - first_sample)]);
                     }
                 }
-                write_color(std::cout, pixel_samples_scale * pixel_color);
             }
+
+            const auto now = std::chrono::steady_clock::now();
+            const bool finished = first_sample + sample_count >= samples_per_pixel;
+            if (finished || std::chrono::duration<double>(now - last_save).count() >= checkpoint_interval)
+            {
+                if (!accumulation.save(checkpoint))
+                {
+                    return false;
+                }
+                last_save = now;
+                std::println(std::clog, "\rCheckpoint {} at {} samples per pixel", checkpoint, first_sample + sample_count);
+            }
+        }
+
+        if (engine)
+        {
+            engine->print_stats();
+        }
+        for (size_t pixel = 0; pixel < accumulation.size(); ++pixel)
+        {
+            pixels[pixel] = accumulation.mean(pixel);
+        }
+        return true;
+    }
+
+    // Render on worker_processes forked workers. Every band is split into jobs of samples_per_job
+    // samples, and once all jobs of a band are back their sums are added in sample order, so the
+    // image does not depend on which worker rendered what or how often a job was retried.
+    bool render_distributed(const hittable& world, const hittable& lights, std::ostream& out)
+    {
+        if (denoise || !aov_prefix.empty() || !checkpoint.empty())
+        {
+            std::println(std::cerr, "ERROR: Distributed renders do not support checkpoints, AOVs or denoising");
+            return false;
         }
 
+        // A job must draw the same values on whichever worker runs it
+        const auto pattern = sampling == sampler_type::independent ? sampler_type::random : sampling;
+
+        const int chunk = samples_per_job > 0 ? std::min(samples_per_job, samples_per_pixel) : samples_per_pixel;
+        const int chunks = (samples_per_pixel + chunk - 1) / chunk;
+        // Eight bands per worker or more keep the workers evenly loaded
+        const int job_rows = std::clamp(image_height / (8 * worker_processes), 1, band_rows);
+        const int bands = (image_height + job_rows - 1) / job_rows;
+        std::vector<render_job> jobs;
+        for (int band = 0; band < bands; ++band)
+        {
+            for (int c = 0; c < chunks; ++c)
+            {
+                jobs.push_back({uint32_t(jobs.size()), band * job_rows, std::min(job_rows, image_height - band * job_rows),
+                    c * chunk, std::min(chunk, samples_per_pixel - c * chunk)});
+            }
+        }
+
+        // The workers share the hardware threads
+        const int hardware_threads = int(std::max(1u, std::thread::hardware_concurrency()));
+        const int worker_threads = thread_count > 0 ? thread_count : std::max(1, hardware_threads / worker_processes);
+
+        // Nothing buffered may be written twice by the workers
+        out.flush();
+        render_farm farm;
+        const bool started = farm.start(worker_processes, [&](int fd)
+        {
+            thread_count = worker_threads;
+            return serve_jobs(fd, world, lights, pattern);
+        });
+        if (!started)
+        {
+            return false;
+        }
+
+        std::vector<std::vector<color>> job_sums(jobs.size());
+        std::vector<int> band_jobs_done(bands, 0);
+        int next_band = 0;
+        band_writer writer(out, output_format, image_width, image_height);
+        const bool rendered = farm.run(jobs, image_width, [&](const render_job& job, std::vector<color>&& sums)
+        {
+            job_sums[job.id] = std::move(sums);
+            ++band_jobs_done[job.id / chunks];
+
+            // Write the finished bands in order
+            while (next_band < bands && band_jobs_done[next_band] == chunks)
+            {
+                auto band = std::move(job_sums[size_t(next_band) * chunks]);
+                for (int c = 1; c < chunks; ++c)
+                {
+                    auto& part = job_sums[size_t(next_band) * chunks + c];
+                    for (size_t p = 0; p < band.size(); ++p)
+                    {
+                        band[p] += part[p];
+                    }
+                    part = {};
+                }
+                for (auto& pixel_color : band)
+                {
+                    pixel_color *= pixel_samples_scale;
+                }
+                writer.push(std::move(band));
+                ++next_band;
+            }
+        });
+        farm.stop();
+        if (!rendered)
+        {
+            return false;
+        }
         std::println(std::clog, "\rDone.                 ");
+
+        farm.print_stats(integrator == integrator_type::wavefront ? worker_threads : 1);
+        return writer.finish();
     }
-private:
+
+    // Worker side of a distributed render: trace the jobs arriving on fd until told to quit
+    bool serve_jobs(int fd, const hittable& world, const hittable& lights, sampler_type pattern) const
+    {
+        auto engine = make_integrator(pattern);
+        render_job job;
+        std::vector<color> sums;
+        while (distributed::receive_all(fd, &job, sizeof(job)) && job.id != render_job::quit)
+        {
+            const auto start = std::clock();
+            const auto first_pixel = size_t(job.first_row) * image_width;
+            sums.assign(size_t(job.row_count) * image_width, color(0, 0, 0));
+            trace(engine, world, lights, pattern, job.first_row, job.row_count, job.first_sample, job.sample_count,
+                [&](uint32_t pixel, uint32_t, const color& radiance, const aov_sample&)
+                {
+                    sums[pixel - first_pixel] += radiance;
+                });
+
+            const job_result result{job.id, double(std::clock() - start) / CLOCKS_PER_SEC};
+            if (!distributed::send_all(fd, &result, sizeof(result))
+                || !distributed::send_all(fd, sums.data(), sums.size() * sizeof(color)))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
     void initialize()
     {
         image_height = std::max(1, static_cast<int>(image_width / aspect_ratio));
 
-        sqrt_spp = static_cast<int>(std::sqrt(samples_per_pixel));
-        pixel_samples_scale = 1.0 / (sqrt_spp * sqrt_spp);
-        recip_sqrt_spp = 1.0 / sqrt_spp;
+        samples_per_pixel = std::max(1, samples_per_pixel);
+        pixel_samples_scale = 1.0 / samples_per_pixel;
+        band_rows = std::clamp(band_pixels / image_width, 1, image_height);
 
         // Camera center
         center = lookfrom;
@@ -91,7 +471,17 @@ private:
         defocus_disk_v = v * defocus_radius;
     }
 
-    color ray_color(const ray& r, int depth, const hittable& world, const hittable& lights) const
+    // Radiance along r. The first hit is recorded in first_hit when given.
+    //
+    // Diffuse and glossy hits take a light sample aimed straight at the lights besides the
+    // scattered ray that continues the path. The light sample only gathers the light it reaches.
+    // Light that both can reach is shared between them with the heuristic, so each counts most
+    // where its density is the better one: a sharp glossy lobe keeps nearly all of the light it
+    // reflects, a diffuse surface leaves most of a small light to the light sample. scatter_pdf
+    // is the density r was scattered with, 0 for camera rays and specular bounces, whose light no
+    // light sample could have found.
+    color ray_color(const ray& r, int depth, const hittable& world, const hittable& lights,
+        aov_sample* first_hit = nullptr, double scatter_pdf = 0) const
     {
         // If we've exceeded the ray bounce limit, no more light is gathered.
         if (depth <= 0)
@@ -100,16 +490,38 @@ private:
         }
 
         hit_record rec;
-        // If the ray hits nothing, return the background color
+        // If the ray hits nothing, return the background color or the environment's radiance
         if (!world.hit(r, interval(0.001, infinity), rec))
         {
-            return background;
+            const auto sky = environment ? environment->radiance(r.direction()) : background;
+            if (first_hit)
+            {
+                first_hit->albedo = emission_albedo(sky);
+            }
+            return sky * scattered_light_weight(heuristic, r, lights, scatter_pdf);
         }
 
         scatter_record srec;
-        color color_from_emission = rec.mat->emitted(r, rec, rec.u, rec.v, rec.p);
+        color color_from_emission;
+        bool scattered_ray = visit_material(*rec.mat, [&](const auto& mat)
+        {
+            color_from_emission = mat.emitted(r, rec, rec.u, rec.v, rec.p);
+            return mat.scatter(r, rec, srec);
+        });
+
+        if (first_hit)
+        {
+            first_hit->albedo = scattered_ray ? srec.attenuation : emission_albedo(color_from_emission);
+            first_hit->normal = rec.normal;
+            first_hit->depth = rec.t * r.direction().length();
+        }
 
-        if (!rec.mat->scatter(r, rec, srec))
+        if (!color_from_emission.near_zero())
+        {
+            color_from_emission = color_from_emission * scattered_light_weight(heuristic, r, lights, scatter_pdf);
+        }
+
+        if (!scattered_ray)
         {
             return color_from_emission;
         }
@@ -119,25 +531,59 @@ private:
             return srec.attenuation * ray_color(srec.skip_pdf_ray, depth - 1, world, lights);
         }
 
-        auto light_ptr = std::make_shared<hittable_pdf>(lights, rec.p);
-        mixture_pdf mixed_pdf(light_ptr, srec.pdf_ptr);
+        const auto scattering_pdf = [&](const ray& out)
+        {
+            return visit_material(*rec.mat, [&](const auto& mat) { return mat.scattering_pdf(r, rec, out); });
+        };
+
+        // The light sample reaches emitters a bounce away, so like the scattered ray it needs a
+        // bounce left. It is traced after the scattered ray is drawn, in the order the wavefront
+        // integrator draws the sample dimensions.
+        ray light_ray;
+        color light_weight;
+        bool light_sampled = false;
+        if (depth > 1)
+        {
+            const hittable_pdf toward_lights(lights, rec.p);
+            light_ray = ray(rec.p, toward_lights.generate(), r.time());
+            const auto light_pdf = toward_lights.value(light_ray.direction());
+            const auto light_scattering_pdf = scattering_pdf(light_ray);
+            if (light_pdf > 0 && light_scattering_pdf > 0)
+            {
+                const auto weight = mis_weight(heuristic, light_pdf, srec.pdf_ptr->value(light_ray.direction()));
+                light_weight = srec.attenuation * light_scattering_pdf * weight / light_pdf;
+                light_sampled = true;
+            }
+        }
+
+        auto scattered = ray(rec.p, srec.pdf_ptr->generate(), r.time());
+        auto pdf_value = srec.pdf_ptr->value(scattered.direction());
 
-        auto scattered = ray(rec.p, mixed_pdf.generate(), r.time());
-        auto pdf_value = mixed_pdf.value(scattered.direction());
+        const auto color_from_lights = light_sampled ? light_weight * emitted_along(light_ray, world) : color(0, 0, 0);
 
-        double scattering_pdf = rec.mat->scattering_pdf(r, rec, scattered);
+        color sample_color = ray_color(scattered, depth - 1, world, lights, nullptr, pdf_value);
+        color color_from_scatter = (srec.attenuation * scattering_pdf(scattered) * sample_color) / pdf_value;
 
-        color sample_color = ray_color(scattered, depth - 1, world, lights);
-        color color_from_scatter = (srec.attenuation * scattering_pdf * sample_color) / pdf_value;
+        return color_from_emission + color_from_lights + color_from_scatter;
+    }
 
-        return color_from_emission + color_from_scatter;
+    // Light emitted toward the origin of r by the first thing it hits, or by the sky
+    color emitted_along(const ray& r, const hittable& world) const
+    {
+        hit_record rec;
+        if (!world.hit(r, interval(0.001, infinity), rec))
+        {
+            return environment ? environment->radiance(r.direction()) : background;
+        }
+        return visit_material(*rec.mat, [&](const auto& mat) { return mat.emitted(r, rec, rec.u, rec.v, rec.p); });
     }
 
-    // Construct a camera ray originating from the defocus disk and directed at randomly sampled
-    // point around the pixel location i, j for stratified sample square s_i, s_j
-    ray get_ray(int i, int j, int s_i, int s_j)
+    // Construct a camera ray originating from the defocus disk and directed at a sampled point
+    // around the pixel location i, j. The sample dimensions are the pixel offset first, then
+    // the lens position and the time.
+    ray get_ray(int i, int j) const
     {
-        const auto offset = sample_square_stratified(s_i, s_j);
+        const auto offset = sample_square();
         const auto pixel_sample = pixel00_loc + ((i + offset.x()) * pixel_delta_u) + ((j + offset.y()) * pixel_delta_v);
         const auto ray_origin = (defocus_angle <= 0) ? center : defocus_disk_sample();
         const auto ray_direction = pixel_sample - ray_origin;
@@ -152,32 +598,33 @@ private:
     }
 
     // Return a random point in the camera defocus disk
-    point3 defocus_disk_sample()
+    point3 defocus_disk_sample() const
     {
-        const auto p = random_in_unit_disk();
+        const auto p = sample_disk();
         return center + (p[0] * defocus_disk_u) + (p[1] * defocus_disk_v);
     }
 
-    // TODO: Check Github for this function implementation
+    // Map two sample dimensions onto the unit disk with the concentric mapping, which keeps
+    // the stratification of the samples unlike rejection sampling
     vec3 sample_disk() const
     {
-        return vec3();
-    }
+        const auto a = 2 * random_double() - 1;
+        const auto b = 2 * random_double() - 1;
+        if (a == 0 && b == 0)
+        {
+            return vec3(0, 0, 0);
+        }
 
-    // Return the vector to a random point in the square sub-pixel specified by grid
-    // indices s_i and s_j, for an idealized unit square pixel [-.5, -.5] to [+.5, +.5]
-    vec3 sample_square_stratified(int s_i, int s_j) const
-    {
-        auto px = ((s_i + random_double()) * recip_sqrt_spp) - 0.5;
-        auto py = ((s_j + random_double()) * recip_sqrt_spp) - 0.5;
-        return vec3(px, py, 0);
+        const bool wide = std::fabs(a) > std::fabs(b);
+        const auto r = wide ? a : b;
+        const auto theta = wide ? (pi / 4) * (b / a) : (pi / 2) - (pi / 4) * (a / b);
+        return vec3(r * std::cos(theta), r * std::sin(theta), 0);
     }
 
 private:
     int image_height = 100; // Rendered image height
+    int band_rows = 1; // Rows rendered and written together, about band_pixels pixels
     double pixel_samples_scale; // Color nomalization factor for a sum of pixel samples
-    int sqrt_spp; // Square root of number of samples per pixel
-    double recip_sqrt_spp; // 1 / srt_spp
     point3 center; // Camera center
     point3 pixel00_loc; // Location of pixel 0, 0
     vec3 pixel_delta_u; // Offset to pixel to the right
@@ -1,7 +1,9 @@
 #pragma once
 
-#include <iostream>
+#include <array>
 #include <cmath>
+#include <cstdint>
+#include <iostream>
 
 #include "vec3.h"
 #include "interval.h"
@@ -18,7 +20,15 @@ constexpr double linear_to_gamma(double linear_component)
     return 0;
 }
 
-void write_color(std::ostream& out, const color& pixel_color) {
+// Relative luminance of a linear color with Rec. 709 primaries
+inline double luminance(const color& c)
+{
+    return 0.2126 * c.x() + 0.7152 * c.y() + 0.0722 * c.z();
+}
+
+// Gamma corrected 8 bit components of a linear color
+inline std::array<uint8_t, 3> color_bytes(const color& pixel_color)
+{
     auto r = pixel_color.x();
     auto g = pixel_color.y();
     auto b = pixel_color.z();
@@ -35,9 +45,14 @@ void write_color(std::ostream& out, const color& pixel_color) {
 
     // Translate the [0,1] component values to the byte range [0,255].
     static const interval intensity(0.0, 0.999);
-    auto rbyte = static_cast<int>(256 * intensity.clamp(r));
-    auto gbyte = static_cast<int>(256 * intensity.clamp(g));
-    auto bbyte = static_cast<int>(256 * intensity.clamp(b));
+    return {
+        static_cast<uint8_t>(256 * intensity.clamp(r)),
+        static_cast<uint8_t>(256 * intensity.clamp(g)),
+        static_cast<uint8_t>(256 * intensity.clamp(b))
+    };
+}
 
-    out << rbyte << ' ' << gbyte << ' ' << bbyte << '\n';
+void write_color(std::ostream& out, const color& pixel_color) {
+    const auto bytes = color_bytes(pixel_color);
+    out << int(bytes[0]) << ' ' << int(bytes[1]) << ' ' << int(bytes[2]) << '\n';
 }
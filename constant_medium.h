@@ -4,19 +4,19 @@
 #include "material.h"
 #include "texture.h"
 
-class constant_medium : public hittable
+class constant_medium final : public hittable
 {
 public:
-    constant_medium(std::shared_ptr<hittable> boundary, double density, std::shared_ptr<texture> tex)
+    constant_medium(std::shared_ptr<hittable> boundary, double density, const texture* tex)
         : boundary(boundary)
         , neg_inv_density(-1.0 / density)
-        , phase_function(std::make_shared<isotropic>(tex))
+        , phase_function(tex)
     {}
 
     constant_medium(std::shared_ptr<hittable> boundary, double density, const color& albedo)
         : boundary(boundary)
         , neg_inv_density(-1.0 / density)
-        , phase_function(std::make_shared<isotropic>(albedo))
+        , phase_function(albedo)
     {}
 
     bool hit(const ray& r, interval ray_t, hit_record& rec) const override
@@ -61,7 +61,7 @@ public:
 
         rec.normal = vec3(1, 0, 0); // arbitrary
         rec.front_face = true; // also arbitrary
-        rec.mat = phase_function;
+        rec.mat = &phase_function;
 
         return true;
     }
@@ -71,5 +71,5 @@ public:
 private:
     std::shared_ptr<hittable> boundary;
     double neg_inv_density;
-    std::shared_ptr<material> phase_function;
+    isotropic phase_function; // Owned by the medium, handed out as a raw handle
 };
\ No newline at end of file
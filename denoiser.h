@@ -0,0 +1,296 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <print>
+#include <vector>
+
+#include "rtweekend.h"
+#include "worker_pool.h"
+
+// What a camera ray saw at its first hit, for the auxiliary output buffers
+struct aov_sample
+{
+    color albedo; // Reflectance of the material, or the clamped emission of a light
+    vec3 normal; // Shading normal, zero for a miss
+    double depth = infinity; // Distance along the camera ray, infinity for a miss
+};
+
+// Albedo stand-in of a first hit that does not scatter, such as a light or the background
+inline color emission_albedo(const color& emission)
+{
+    return color(std::min(emission.x(), 1.0), std::min(emission.y(), 1.0), std::min(emission.z(), 1.0));
+}
+
+// Albedo, normal and depth of the first hits, averaged over the samples of every pixel, plus
+// the second moment of the pixel luminance, which gives the denoiser the noise level per pixel.
+class aov_buffers
+{
+public:
+    aov_buffers(int width, int height)
+        : image_width(width)
+        , image_height(height)
+        , albedo_sum(size_t(width) * height, color(0, 0, 0))
+        , normal_sum(size_t(width) * height, vec3(0, 0, 0))
+        , depth_sum(size_t(width) * height, 0.0)
+        , depth_hits(size_t(width) * height, 0)
+        , moment_sum(size_t(width) * height, 0.0)
+        , samples(size_t(width) * height, 0)
+    {
+    }
+
+    int width() const { return image_width; }
+    int height() const { return image_height; }
+
+    void add_sample(size_t pixel, const color& radiance, const aov_sample& first_hit)
+    {
+        albedo_sum[pixel] += first_hit.albedo;
+        normal_sum[pixel] += first_hit.normal;
+        if (std::isfinite(first_hit.depth))
+        {
+            depth_sum[pixel] += first_hit.depth;
+            ++depth_hits[pixel];
+        }
+        const auto l = luminance(radiance);
+        if (std::isfinite(l))
+        {
+            moment_sum[pixel] += l * l;
+        }
+        ++samples[pixel];
+    }
+
+    color albedo(size_t pixel) const { return albedo_sum[pixel] / std::max(samples[pixel], 1); }
+
+    vec3 normal(size_t pixel) const
+    {
+        const auto& n = normal_sum[pixel];
+        return n.near_zero() ? n : unit_vector(n);
+    }
+
+    // Mean depth of the samples that hit something, infinity if none did
+    double depth(size_t pixel) const
+    {
+        return depth_hits[pixel] > 0 ? depth_sum[pixel] / depth_hits[pixel] : infinity;
+    }
+
+    // Variance of the pixel mean given the mean color of the pixel
+    double variance(size_t pixel, const color& mean) const
+    {
+        const auto n = std::max(samples[pixel], 1);
+        const auto l = luminance(mean);
+        return std::max(0.0, moment_sum[pixel] / n - l * l) / n;
+    }
+
+    // Write prefix + albedo.ppm, normal.ppm and depth.ppm. Normals map [-1, 1] to [0, 255], depth
+    // is near white to far black over the finite depths in the image.
+    bool write(const std::string& prefix) const
+    {
+        double max_depth = 0;
+        for (size_t p = 0; p < samples.size(); ++p)
+        {
+            if (std::isfinite(depth(p))) max_depth = std::max(max_depth, depth(p));
+        }
+
+        return write_ppm(prefix + "albedo.ppm", [&](size_t p) { return albedo(p); })
+            && write_ppm(prefix + "normal.ppm", [&](size_t p) { return 0.5 * (normal(p) + vec3(1, 1, 1)); })
+            && write_ppm(prefix + "depth.ppm", [&](size_t p)
+            {
+                const auto d = depth(p);
+                const auto v = std::isfinite(d) && max_depth > 0 ? 1 - d / max_depth : 0.0;
+                return color(v, v, v);
+            });
+    }
+
+private:
+    template<typename Value>
+    bool write_ppm(const std::string& filename, const Value& value) const
+    {
+        std::ofstream out(filename);
+        if (!out)
+        {
+            std::println(std::cerr, "ERROR: Could not write {}", filename);
+            return false;
+        }
+
+        static const interval intensity(0.0, 0.999);
+        std::print(out, "P3\n{}\n{}\n255\n", image_width, image_height);
+        for (size_t p = 0; p < samples.size(); ++p)
+        {
+            const auto c = value(p);
+            std::println(out, "{} {} {}", int(256 * intensity.clamp(c.x())), int(256 * intensity.clamp(c.y())),
+                int(256 * intensity.clamp(c.z())));
+        }
+        return true;
+    }
+
+    int image_width;
+    int image_height;
+    std::vector<color> albedo_sum;
+    std::vector<vec3> normal_sum;
+    std::vector<double> depth_sum;
+    std::vector<int> depth_hits;
+    std::vector<double> moment_sum;
+    std::vector<int> samples;
+};
+
+// Edge-avoiding a-trous wavelet filter (Dammertz et al. 2010) with the variance guided color
+// weight of SVGF. The lighting is divided by the albedo first, so texture detail is not blurred,
+// and filtered in passes of a 5x5 B3 spline kernel whose taps spread 1, 2, 4, ... pixels apart.
+// Each tap is weighted down where the normal, the depth or the luminance differ from the center
+// pixel, the latter relative to the estimated noise. Tiles of each pass run in parallel.
+class denoiser
+{
+public:
+    int iterations = 5; // Filter passes, the last one reaches 2^iterations pixels
+    double sigma_luminance = 4; // Luminance tolerance in standard deviations of the noise
+    double sigma_normal = 128; // Exponent of the normal similarity
+    double sigma_depth = 0.05; // Relative depth tolerance per pixel of tap distance
+
+    // Return the denoised image of the per pixel mean colors in beauty
+    std::vector<color> filter(const std::vector<color>& beauty, const aov_buffers& aovs, worker_pool& pool)
+    {
+        width = aovs.width();
+        height = aovs.height();
+        const auto n = beauty.size();
+
+        // Demodulate the albedo, keeping pixels without albedo as they are
+        std::vector<color> irradiance(n);
+        std::vector<double> variance(n);
+        for (size_t p = 0; p < n; ++p)
+        {
+            const auto a = aovs.albedo(p);
+            const auto demodulate = [](double c, double a) { return a > albedo_floor ? c / a : c; };
+            irradiance[p] = color(demodulate(beauty[p].x(), a.x()), demodulate(beauty[p].y(), a.y()),
+                demodulate(beauty[p].z(), a.z()));
+            const auto l = luminance(a);
+            variance[p] = aovs.variance(p, beauty[p]) / (l > albedo_floor ? l * l : 1.0);
+        }
+
+        std::vector<color> next_irradiance(n);
+        std::vector<double> next_variance(n);
+        for (int iteration = 0; iteration < iterations; ++iteration)
+        {
+            const int step = 1 << iteration;
+            for_each_tile(pool, [&](int x0, int y0, int x1, int y1)
+            {
+                for (int y = y0; y < y1; ++y)
+                {
+                    for (int x = x0; x < x1; ++x)
+                    {
+                        filter_pixel(x, y, step, irradiance, variance, aovs, next_irradiance, next_variance);
+                    }
+                }
+            });
+            irradiance.swap(next_irradiance);
+            variance.swap(next_variance);
+        }
+
+        std::vector<color> result(n);
+        for (size_t p = 0; p < n; ++p)
+        {
+            const auto a = aovs.albedo(p);
+            const auto remodulate = [](double c, double a) { return a > albedo_floor ? c * a : c; };
+            result[p] = color(remodulate(irradiance[p].x(), a.x()), remodulate(irradiance[p].y(), a.y()),
+                remodulate(irradiance[p].z(), a.z()));
+        }
+        return result;
+    }
+
+private:
+    static constexpr int tile_size = 32;
+    static constexpr double albedo_floor = 1e-3;
+
+    template<typename F>
+    void for_each_tile(worker_pool& pool, const F& f) const
+    {
+        const auto tiles_x = (width + tile_size - 1) / tile_size;
+        const auto tiles_y = (height + tile_size - 1) / tile_size;
+        pool.parallel_for(size_t(tiles_x) * tiles_y, 1, [&](size_t begin, size_t end, int)
+        {
+            for (auto tile = begin; tile < end; ++tile)
+            {
+                const int x0 = int(tile % tiles_x) * tile_size;
+                const int y0 = int(tile / tiles_x) * tile_size;
+                f(x0, y0, std::min(x0 + tile_size, width), std::min(y0 + tile_size, height));
+            }
+        });
+    }
+
+    // Variance of pixel x, y blurred with a 3x3 Gaussian, which steadies the luminance weight
+    double blurred_variance(int x, int y, const std::vector<double>& variance) const
+    {
+        static constexpr double kernel[2] = {0.25, 0.125};
+        double sum = 0;
+        double weights = 0;
+        for (int dy = -1; dy <= 1; ++dy)
+        {
+            for (int dx = -1; dx <= 1; ++dx)
+            {
+                const int qx = x + dx;
+                const int qy = y + dy;
+                if (qx < 0 || qy < 0 || qx >= width || qy >= height) continue;
+                const auto w = kernel[std::abs(dx)] * kernel[std::abs(dy)];
+                sum += w * variance[size_t(qy) * width + qx];
+                weights += w;
+            }
+        }
+        return sum / weights;
+    }
+
+    void filter_pixel(int x, int y, int step, const std::vector<color>& irradiance, const std::vector<double>& variance,
+        const aov_buffers& aovs, std::vector<color>& out_irradiance, std::vector<double>& out_variance) const
+    {
+        static constexpr double kernel[3] = {3.0 / 8.0, 1.0 / 4.0, 1.0 / 16.0};
+
+        const auto p = size_t(y) * width + x;
+        const auto center = irradiance[p];
+        const auto l_p = luminance(center);
+        const auto n_p = aovs.normal(p);
+        const auto z_p = aovs.depth(p);
+        const auto luminance_scale = sigma_luminance * std::sqrt(blurred_variance(x, y, variance)) + 1e-6;
+
+        color sum(0, 0, 0);
+        double weights = 0;
+        double variance_sum = 0;
+        for (int dy = -2; dy <= 2; ++dy)
+        {
+            for (int dx = -2; dx <= 2; ++dx)
+            {
+                const int qx = x + dx * step;
+                const int qy = y + dy * step;
+                if (qx < 0 || qy < 0 || qx >= width || qy >= height) continue;
+
+                const auto q = size_t(qy) * width + qx;
+                double w = kernel[std::abs(dx)] * kernel[std::abs(dy)];
+                if (q != p)
+                {
+                    // Never mix hits with background
+                    const auto z_q = aovs.depth(q);
+                    if (std::isfinite(z_p) != std::isfinite(z_q))
+                    {
+                        continue;
+                    }
+                    if (std::isfinite(z_p))
+                    {
+                        const auto distance = step * std::max(std::abs(dx), std::abs(dy));
+                        w *= std::pow(std::max(0.0, dot(n_p, aovs.normal(q))), sigma_normal);
+                        w *= std::exp(-std::abs(z_p - z_q) / (sigma_depth * z_p * distance));
+                    }
+                    w *= std::exp(-std::abs(l_p - luminance(irradiance[q])) / luminance_scale);
+                }
+
+                sum += w * irradiance[q];
+                variance_sum += w * w * variance[q];
+                weights += w;
+            }
+        }
+
+        out_irradiance[p] = sum / weights;
+        out_variance[p] = variance_sum / (weights * weights);
+    }
+
+    int width = 0;
+    int height = 0;
+};
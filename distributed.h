@@ -0,0 +1,265 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <optional>
+#include <print>
+#include <string>
+#include <vector>
+
+#include <cerrno>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Work order of a distributed render: samples [first_sample, first_sample + sample_count) of
+// every pixel in the rows [first_row, first_row + row_count). A worker answers with a
+// job_result followed by the radiance sums of the rows, one color per pixel.
+struct render_job
+{
+    static constexpr uint32_t quit = UINT32_MAX; // Id that tells a worker to exit
+
+    uint32_t id = quit;
+    int32_t first_row = 0;
+    int32_t row_count = 0;
+    int32_t first_sample = 0;
+    int32_t sample_count = 0;
+};
+
+struct job_result
+{
+    uint32_t id = 0;
+    double cpu_seconds = 0; // Processor time the worker spent on the job
+};
+
+// Blocking stream socket helpers for the coordinator and its workers. The workers of a local
+// render are processes on the same machine, so a Unix socket carries the jobs.
+namespace distributed
+{
+    inline bool send_all(int fd, const void* data, size_t size)
+    {
+        auto bytes = static_cast<const char*>(data);
+        while (size > 0)
+        {
+            const auto sent = ::send(fd, bytes, size, MSG_NOSIGNAL);
+            if (sent < 0 && errno == EINTR) continue;
+            if (sent <= 0) return false;
+            bytes += sent;
+            size -= size_t(sent);
+        }
+        return true;
+    }
+
+    // False on an error or when the peer closed the connection
+    inline bool receive_all(int fd, void* data, size_t size)
+    {
+        auto bytes = static_cast<char*>(data);
+        while (size > 0)
+        {
+            const auto received = ::recv(fd, bytes, size, 0);
+            if (received < 0 && errno == EINTR) continue;
+            if (received <= 0) return false;
+            bytes += received;
+            size -= size_t(received);
+        }
+        return true;
+    }
+
+    // Read up to a newline, which is dropped. False on an error, on end of stream before the
+    // newline and for lines longer than max_size.
+    inline bool receive_line(int fd, std::string& line, size_t max_size = 4096)
+    {
+        line.clear();
+        char c;
+        while (receive_all(fd, &c, 1))
+        {
+            if (c == '\n')
+            {
+                return true;
+            }
+            if (line.size() == max_size)
+            {
+                return false;
+            }
+            line += c;
+        }
+        return false;
+    }
+
+    inline bool send_text(int fd, const std::string& text)
+    {
+        return send_all(fd, text.data(), text.size());
+    }
+
+    inline bool socket_address(const std::string& path, sockaddr_un& address)
+    {
+        address = {};
+        address.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(address.sun_path))
+        {
+            std::println(std::cerr, "ERROR: Socket path {} is too long", path);
+            return false;
+        }
+        std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+        return true;
+    }
+
+    // Listening socket at path, -1 on failure
+    inline int listen_socket(const std::string& path, int backlog)
+    {
+        sockaddr_un address;
+        if (!socket_address(path, address))
+        {
+            return -1;
+        }
+        ::unlink(path.c_str());
+        const int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0 || ::bind(fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) < 0
+            || ::listen(fd, backlog) < 0)
+        {
+            std::println(std::cerr, "ERROR: Could not listen on {}: {}", path, std::strerror(errno));
+            if (fd >= 0) ::close(fd);
+            return -1;
+        }
+        return fd;
+    }
+
+    // Connection to the socket at path, -1 on failure
+    inline int connect_socket(const std::string& path)
+    {
+        sockaddr_un address;
+        if (!socket_address(path, address))
+        {
+            return -1;
+        }
+        const int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0 || ::connect(fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) < 0)
+        {
+            std::println(std::cerr, "ERROR: Could not connect to {}: {}", path, std::strerror(errno));
+            if (fd >= 0) ::close(fd);
+            return -1;
+        }
+        return fd;
+    }
+
+    // Accept a connection, waiting at most timeout_ms, -1 on failure or timeout
+    inline int accept_connection(int listener, int timeout_ms)
+    {
+        pollfd waiting{listener, POLLIN, 0};
+        if (::poll(&waiting, 1, timeout_ms) <= 0)
+        {
+            return -1;
+        }
+        return ::accept(listener, nullptr, nullptr);
+    }
+}
+
+// Hands out the jobs of a distributed render. Idle workers get the pending jobs in order.
+// Once none are left, an idle worker gets a backup copy of the longest running job if that has
+// taken more than straggler_factor times the mean job time, so one slow or stalled worker
+// cannot hold up the end of the render, and whichever copy finishes first counts. A job whose
+// workers all died goes back to the front of the queue.
+class job_scheduler
+{
+public:
+    double straggler_factor = 2;
+
+    explicit job_scheduler(size_t job_count) : jobs(job_count)
+    {
+        for (size_t job = 0; job < job_count; ++job)
+        {
+            pending.push_back(job);
+        }
+    }
+
+    bool finished() const { return completed == jobs.size(); }
+
+    size_t remaining() const { return jobs.size() - completed; }
+
+    // Job for an idle worker, none when no job is pending or late enough for a backup
+    std::optional<size_t> next()
+    {
+        const auto now = std::chrono::steady_clock::now();
+        if (!pending.empty())
+        {
+            const auto job = pending.front();
+            pending.pop_front();
+            start(job, now);
+            return job;
+        }
+
+        if (completed == 0)
+        {
+            return std::nullopt;
+        }
+        std::optional<size_t> oldest;
+        for (size_t job = 0; job < jobs.size(); ++job)
+        {
+            const auto& state = jobs[job];
+            if (!state.done && state.running == 1 && (!oldest || state.started < jobs[*oldest].started))
+            {
+                oldest = job;
+            }
+        }
+        const auto mean_seconds = total_seconds / completed;
+        if (!oldest || std::chrono::duration<double>(now - jobs[*oldest].started).count() <= straggler_factor * mean_seconds)
+        {
+            return std::nullopt;
+        }
+        ++jobs[*oldest].running;
+        ++backups;
+        return oldest;
+    }
+
+    // A copy of the job finished, return whether it is the first
+    bool complete(size_t job)
+    {
+        auto& state = jobs[job];
+        --state.running;
+        if (state.done)
+        {
+            return false;
+        }
+        state.done = true;
+        ++completed;
+        total_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - state.started).count();
+        return true;
+    }
+
+    // The worker running a copy of the job died
+    void abandon(size_t job)
+    {
+        auto& state = jobs[job];
+        if (--state.running == 0 && !state.done)
+        {
+            pending.push_front(job);
+        }
+    }
+
+    size_t backup_count() const { return backups; }
+
+private:
+    struct job_state
+    {
+        std::chrono::steady_clock::time_point started;
+        int running = 0; // Copies in flight
+        bool done = false;
+    };
+
+    void start(size_t job, std::chrono::steady_clock::time_point now)
+    {
+        jobs[job].started = now;
+        ++jobs[job].running;
+    }
+
+    std::vector<job_state> jobs;
+    std::deque<size_t> pending;
+    size_t completed = 0;
+    size_t backups = 0;
+    double total_seconds = 0; // Time from start to first completion of the completed jobs
+};
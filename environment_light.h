@@ -0,0 +1,148 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <string_view>
+#include <vector>
+
+#include "color.h"
+#include "hittable.h"
+#include "rtw_image.h"
+
+// Light arriving from every direction at infinity, read from an equirectangular HDR image with
+// the same mapping as sphere::get_sphere_uv: u around the Y axis from X=-1, v from Y=-1 up.
+//
+// The camera reads it for every ray that misses the world. Added to the lights as well, it is
+// also sampled directly: directions are drawn in proportion to the brightness of their pixels,
+// so a small bright sun gets found by shadow rays instead of by the odd lucky bounce. Pixels
+// are picked with a piecewise constant distribution, a row from the marginal over rows first,
+// then a pixel from that row's conditional. The weights include the sine of the row's polar
+// angle, since rows near the poles cover less solid angle.
+//
+// It is never hit; as a light it only answers the sampling queries.
+class environment_light : public hittable
+{
+public:
+    environment_light(std::string_view filename, double scale = 1)
+        : image(filename)
+        , scale(scale)
+    {
+        build_distribution();
+    }
+
+    // False when the image could not be loaded
+    bool valid() const { return image.height() > 0; }
+
+    // Radiance arriving along direction
+    color radiance(const vec3& direction) const
+    {
+        const auto [i, j] = pixel(unit_vector(direction));
+        const auto p = image.linear_pixel_data(i, j);
+        return scale * color(p[0], p[1], p[2]);
+    }
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override
+    {
+        return false;
+    }
+
+    aabb bounding_box() const override { return aabb::universe; }
+
+    // Solid angle density of random for direction
+    double pdf_value(const point3& origin, const vec3& direction) const override
+    {
+        if (total <= 0)
+        {
+            return 1 / (4 * pi);
+        }
+
+        const auto unit = unit_vector(direction);
+        const auto sin_theta = std::sqrt(std::max(0.0, 1 - unit.y() * unit.y()));
+        if (sin_theta <= 0)
+        {
+            return 0;
+        }
+        const auto [i, j] = pixel(unit);
+        const auto width = image.width();
+        const auto height = image.height();
+        const auto weight = column_cdf[size_t(j) * width + i] - (i > 0 ? column_cdf[size_t(j) * width + i - 1] : 0);
+
+        // Uniform over the pixel in u, v, and dω = sin θ dθ dφ = 2π² sin θ du dv
+        const auto square_pdf = weight / total * width * height;
+        return square_pdf / (2 * pi * pi * sin_theta);
+    }
+
+    vec3 random(const point3& origin) const override
+    {
+        if (total <= 0)
+        {
+            return random_unit_vector();
+        }
+
+        const auto width = image.width();
+        const auto height = image.height();
+
+        // A row from the marginal, then a pixel from the row, each sample reused for the
+        // position inside its pixel
+        auto x = random_double() * total;
+        const auto j = std::min(int(std::upper_bound(row_cdf.begin(), row_cdf.end(), x) - row_cdf.begin()), height - 1);
+        const auto row_start = j > 0 ? row_cdf[j - 1] : 0.0;
+        const auto row_weight = row_cdf[j] - row_start;
+        const auto dy = row_weight > 0 ? std::clamp((x - row_start) / row_weight, 0.0, 1.0) : 0.5;
+
+        const auto row = column_cdf.begin() + ptrdiff_t(j) * width;
+        auto y = random_double() * row_weight;
+        const auto i = std::min(int(std::upper_bound(row, row + width, y) - row), width - 1);
+        const auto column_start = i > 0 ? row[i - 1] : 0.0;
+        const auto column_weight = row[i] - column_start;
+        const auto dx = column_weight > 0 ? std::clamp((y - column_start) / column_weight, 0.0, 1.0) : 0.5;
+
+        // Image rows run from v = 1 at the top
+        const auto u = (i + dx) / width;
+        const auto v = 1 - (j + dy) / height;
+        const auto theta = v * pi;
+        const auto phi = u * 2 * pi;
+        return vec3(-std::sin(theta) * std::cos(phi), -std::cos(theta), std::sin(theta) * std::sin(phi));
+    }
+
+private:
+    // Pixel that a unit direction maps to
+    std::pair<int, int> pixel(const vec3& direction) const
+    {
+        const auto theta = std::acos(std::clamp(-direction.y(), -1.0, 1.0));
+        const auto phi = std::atan2(-direction.z(), direction.x()) + pi;
+        const auto u = phi / (2 * pi);
+        const auto y = 1 - theta / pi; // Image rows run from v = 1 at the top
+        return {std::clamp(int(u * image.width()), 0, image.width() - 1),
+            std::clamp(int(y * image.height()), 0, image.height() - 1)};
+    }
+
+    // Running sums of the pixel weights along every row, and of the row sums down the image
+    void build_distribution()
+    {
+        const auto width = image.width();
+        const auto height = image.height();
+        column_cdf.resize(size_t(width) * height);
+        row_cdf.resize(height);
+        total = 0;
+        for (int j = 0; j < height; ++j)
+        {
+            const auto sin_theta = std::sin(pi * (j + 0.5) / height);
+            double sum = 0;
+            for (int i = 0; i < width; ++i)
+            {
+                const auto p = image.linear_pixel_data(i, j);
+                sum += luminance(color(p[0], p[1], p[2])) * sin_theta;
+                column_cdf[size_t(j) * width + i] = sum;
+            }
+            total += sum;
+            row_cdf[j] = total;
+        }
+    }
+
+    rwt_image image;
+    double scale;
+    std::vector<double> column_cdf; // Per row, the weights of its pixels up to and including each
+    std::vector<double> row_cdf;    // The row sums up to and including each row
+    double total = 0;
+};
@@ -4,11 +4,30 @@
 
 class material;
 
+// Hierarchy nodes visited by the calling thread, counted by the bounding volume hierarchies for
+// traversal statistics in builds with RAY_TRACER_TRAVERSAL_STATS. Other builds leave it at 0
+// and keep the traversal loops free of the extra store.
+#ifdef RAY_TRACER_TRAVERSAL_STATS
+inline constexpr bool traversal_stats = true;
+#else
+inline constexpr bool traversal_stats = false;
+#endif
+
+inline thread_local uint64_t traversal_node_visits = 0;
+
+inline void count_node_visit()
+{
+    if constexpr (traversal_stats)
+    {
+        ++traversal_node_visits;
+    }
+}
+
 struct hit_record
 {
     point3 p;
     vec3 normal;
-    std::shared_ptr<material> mat;
+    const material* mat = nullptr; // Handle into the scene material table
     // Texture coordinates
     double t;
     double u;
@@ -33,6 +52,14 @@ public:
     virtual bool hit(const ray& r, interval ray_t, hit_record& rec) const = 0;
     virtual aabb bounding_box() const = 0;
 
+    // Number of linear motion segments over the shutter interval [0, 1], 0 for static objects.
+    // The bounds at the segment boundaries i / segments, interpolated linearly, enclose the
+    // object at any time in between.
+    virtual int motion_segments() const { return 0; }
+
+    // Bounds of the object at a single time in [0, 1]
+    virtual aabb bounding_box_at(double time) const { return bounding_box(); }
+
     virtual double pdf_value(const point3& origin, const vec3& direction) const
     {
         return 0.0;
@@ -70,51 +97,58 @@ public:
 
     aabb bounding_box() const override { return bbox; }
 
+    int motion_segments() const override { return object->motion_segments(); }
+    aabb bounding_box_at(double time) const override { return object->bounding_box_at(time) + offset; }
+
 private:
     std::shared_ptr<hittable> object;
     vec3 offset;
     aabb bbox;
 };
 
-class rotate_y : public hittable
+// Bounds of the corners of a box rotated about the y axis
+inline aabb rotate_y_bounds(const aabb& box, double sin_theta, double cos_theta)
 {
-public:
-    rotate_y(std::shared_ptr<hittable> object, double angle)
-        : object(object)
-    {
-        auto radians = degrees_to_radians(angle);
-        sin_theta = std::sin(radians);
-        cos_theta = std::cos(radians);
-        bbox = object->bounding_box();
-
-        point3 min(infinity, infinity, infinity);
-        point3 max(-infinity, -infinity, -infinity);
+    point3 min(infinity, infinity, infinity);
+    point3 max(-infinity, -infinity, -infinity);
 
-        for (int i = 0; i < 2; i++)
+    for (int i = 0; i < 2; i++)
+    {
+        for (int j = 0; j < 2; j++)
         {
-            for (int j = 0; j < 2; j++)
+            for (int k = 0; k < 2; k++)
             {
-                for (int k = 0; k < 2; k++)
-                {
-                    auto x = i * bbox.x.max + (1 - i) * bbox.x.min;
-                    auto y = j * bbox.y.max + (1 - j) * bbox.y.min;
-                    auto z = k * bbox.z.max + (1 - k) * bbox.z.min;
+                auto x = i * box.x.max + (1 - i) * box.x.min;
+                auto y = j * box.y.max + (1 - j) * box.y.min;
+                auto z = k * box.z.max + (1 - k) * box.z.min;
 
-                    auto newx = cos_theta * x + sin_theta * z;
-                    auto newz = -sin_theta * x + cos_theta * z;
+                auto newx = cos_theta * x + sin_theta * z;
+                auto newz = -sin_theta * x + cos_theta * z;
 
-                    vec3 tester(newx, y, newz);
+                vec3 tester(newx, y, newz);
 
-                    for (int c = 0; c < 3; c++)
-                    {
-                        min[c] = std::fmin(min[c], tester[c]);
-                        max[c] = std::fmax(max[c], tester[c]);
-                    }
+                for (int c = 0; c < 3; c++)
+                {
+                    min[c] = std::fmin(min[c], tester[c]);
+                    max[c] = std::fmax(max[c], tester[c]);
                 }
             }
         }
+    }
 
-        bbox = aabb(min, max);
+    return aabb(min, max);
+}
+
+class rotate_y : public hittable
+{
+public:
+    rotate_y(std::shared_ptr<hittable> object, double angle)
+        : object(object)
+    {
+        auto radians = degrees_to_radians(angle);
+        sin_theta = std::sin(radians);
+        cos_theta = std::cos(radians);
+        bbox = rotate_y_bounds(object->bounding_box(), sin_theta, cos_theta);
     }
 
     bool hit(const ray& r, interval ray_t, hit_record& rec) const override
@@ -157,6 +191,11 @@ public:
 
     aabb bounding_box() const override { return bbox; }
 
+    // The corners of linearly moving bounds still move linearly after the rotation, so the
+    // rotated bounds at the segment boundaries stay conservative
+    int motion_segments() const override { return object->motion_segments(); }
+    aabb bounding_box_at(double time) const override { return rotate_y_bounds(object->bounding_box_at(time), sin_theta, cos_theta); }
+
 private:
     std::shared_ptr<hittable> object;
     double sin_theta;
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <algorithm>
+#include <charconv>
+#include <condition_variable>
+#include <deque>
+#include <format>
+#include <iostream>
+#include <mutex>
+#include <print>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "color.h"
+
+enum class image_format
+{
+    plain_ppm, // P3, one text line per pixel
+    binary_ppm // P6, three bytes per pixel
+};
+
+// Encodes and writes an image on its own thread, in bands of whole rows pushed top to bottom,
+// while the caller renders the next bands. At most queue_limit bands wait to be written and
+// push blocks beyond that, so memory stays flat however large the image is. Both formats are
+// scanline ordered, so nothing but the queued bands is ever held in memory.
+class band_writer
+{
+public:
+    band_writer(std::ostream& out, image_format format, int width, int height, size_t queue_limit = 4)
+        : out(out)
+        , format(format)
+        , queue_limit(std::max<size_t>(queue_limit, 1))
+    {
+        std::print(out, "{}\n{}\n{}\n255\n", format == image_format::binary_ppm ? "P6" : "P3", width, height);
+        writer = std::thread([this] { run(); });
+    }
+
+    band_writer(const band_writer&) = delete;
+    band_writer& operator=(const band_writer&) = delete;
+
+    ~band_writer() { finish(); }
+
+    // Queue the next rows of linear pixel colors
+    void push(std::vector<color> band)
+    {
+        std::unique_lock lock(mutex);
+        space.wait(lock, [this] { return queue.size() < queue_limit; });
+        queue.push_back(std::move(band));
+        lock.unlock();
+        ready.notify_one();
+    }
+
+    // Write the queued bands and stop the thread, return whether everything was written
+    bool finish()
+    {
+        if (writer.joinable())
+        {
+            {
+                std::lock_guard lock(mutex);
+                closed = true;
+            }
+            ready.notify_one();
+            writer.join();
+            out.flush();
+        }
+        return bool(out);
+    }
+
+private:
+    void run()
+    {
+        std::string encoded;
+        while (true)
+        {
+            std::vector<color> band;
+            {
+                std::unique_lock lock(mutex);
+                ready.wait(lock, [this] { return closed || !queue.empty(); });
+                if (queue.empty())
+                {
+                    return;
+                }
+                band = std::move(queue.front());
+                queue.pop_front();
+            }
+            space.notify_one();
+
+            encoded.clear();
+            encode(band, encoded);
+            out.write(encoded.data(), std::streamsize(encoded.size()));
+        }
+    }
+
+    void encode(const std::vector<color>& band, std::string& encoded) const
+    {
+        if (format == image_format::binary_ppm)
+        {
+            encoded.reserve(band.size() * 3);
+            for (const auto& pixel_color : band)
+            {
+                const auto bytes = color_bytes(pixel_color);
+                encoded.append(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+            }
+            return;
+        }
+
+        // Same text as write_color
+        encoded.reserve(band.size() * 12);
+        char line[12];
+        for (const auto& pixel_color : band)
+        {
+            const auto bytes = color_bytes(pixel_color);
+            char* end = line;
+            for (int c = 0; c < 3; ++c)
+            {
+                end = std::to_chars(end, line + sizeof(line), int(bytes[c])).ptr;
+                *end++ = c < 2 ? ' ' : '\n';
+            }
+            encoded.append(line, end);
+        }
+    }
+
+    std::ostream& out;
+    image_format format;
+    size_t queue_limit;
+    std::thread writer;
+    std::mutex mutex;
+    std::condition_variable ready;
+    std::condition_variable space;
+    std::deque<std::vector<color>> queue;
+    bool closed = false;
+};
@@ -0,0 +1,273 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <vector>
+
+#include "hittable.h"
+#include "hittable_list.h"
+
+// A bounding volume hierarchy that builds itself as rays need it, for previews and interactive
+// camera moves where most subtrees are never entered. Construction sorts the objects once along
+// a Morton curve of their box centers and builds the top eager_depth levels; every other node is
+// expanded into its two children the first time a ray reaches it.
+//
+// Because the objects are sorted up front, a node is just a range of them and expanding it moves
+// nothing: its split is where the Morton codes of the range first differ, found by a binary
+// search, and its children's boxes come from one pass over the range. Any thread can expand a
+// node and publishes the children with one compare and swap. A thread that loses the race drops
+// its own copy and takes the winner's, so readers never lock or wait for each other.
+//
+// Bounds are taken once at build time, so like bvh_node it is meant for static objects.
+class lazy_bvh : public hittable
+{
+public:
+    static constexpr uint32_t max_leaf_size = 4;
+    static constexpr int default_eager_depth = 6; // Enough subtrees to keep render threads apart
+
+    explicit lazy_bvh(const hittable_list& list, int eager_depth = default_eager_depth)
+    {
+        const auto count = list.objects.size();
+        std::vector<aabb> boxes(count);
+        aabb centers = aabb::empty;
+        for (size_t i = 0; i < count; ++i)
+        {
+            boxes[i] = list.objects[i]->bounding_box();
+            centers = aabb(centers, aabb(center(boxes[i]), center(boxes[i])));
+        }
+
+        // 21 bits per axis, x in the highest bit of every three
+        std::vector<std::pair<uint64_t, uint32_t>> keys(count);
+        for (size_t i = 0; i < count; ++i)
+        {
+            const auto c = center(boxes[i]);
+            uint64_t code = 0;
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                const auto& range = centers.axis_interval(axis);
+                const auto fraction = range.size() > 0 ? (c[axis] - range.min) / range.size() : 0.0;
+                code |= spread(uint32_t(std::clamp(fraction, 0.0, 1.0) * double(cell_count - 1))) << (2 - axis);
+            }
+            keys[i] = {code, uint32_t(i)};
+        }
+        std::sort(keys.begin(), keys.end());
+
+        objects.reserve(count);
+        codes.reserve(count);
+        aabb bounds = aabb::empty;
+        for (const auto& [code, index] : keys)
+        {
+            objects.push_back(list.objects[index]);
+            codes.push_back(code);
+            bounds = aabb(bounds, boxes[index]);
+        }
+
+        root = std::make_unique<node>(bounds, 0, uint32_t(count));
+        built_nodes = 1;
+        expand_to(*root, eager_depth);
+    }
+
+    lazy_bvh(const lazy_bvh&) = delete;
+    lazy_bvh& operator=(const lazy_bvh&) = delete;
+
+    ~lazy_bvh()
+    {
+        // Iteratively, a degenerate tree could be deeper than the call stack allows
+        std::vector<children*> pending;
+        if (root && root->expanded.load())
+        {
+            pending.push_back(root->expanded.load());
+        }
+        while (!pending.empty())
+        {
+            auto c = pending.back();
+            pending.pop_back();
+            for (auto n : {&c->left, &c->right})
+            {
+                if (auto grandchildren = n->expanded.load())
+                {
+                    pending.push_back(grandchildren);
+                }
+            }
+            delete c;
+        }
+    }
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override
+    {
+        if (objects.empty())
+        {
+            return false;
+        }
+
+        const node* stack[64];
+        int stack_size = 0;
+        stack[stack_size++] = root.get();
+        bool hit_anything = false;
+
+        while (stack_size > 0)
+        {
+            const auto& n = *stack[--stack_size];
+            count_node_visit();
+            if (!n.bbox.hit(r, ray_t))
+            {
+                continue;
+            }
+
+            if (n.end - n.start <= max_leaf_size || stack_size + 2 > 64)
+            {
+                for (auto i = n.start; i < n.end; ++i)
+                {
+                    if (objects[i]->hit(r, ray_t, rec))
+                    {
+                        hit_anything = true;
+                        ray_t.max = rec.t;
+                    }
+                }
+                continue;
+            }
+
+            auto c = n.expanded.load(std::memory_order_acquire);
+            if (!c)
+            {
+                c = expand(n);
+            }
+            // The child below the split on top when the ray runs up its axis
+            if (r.direction()[c->axis] < 0)
+            {
+                stack[stack_size++] = &c->left;
+                stack[stack_size++] = &c->right;
+            }
+            else
+            {
+                stack[stack_size++] = &c->right;
+                stack[stack_size++] = &c->left;
+            }
+        }
+
+        return hit_anything;
+    }
+
+    aabb bounding_box() const override { return root ? root->bbox : aabb::empty; }
+
+    // Expand every node not built yet, for when the whole scene will be rendered after all
+    void expand_all() { expand_to(*root, std::numeric_limits<int>::max()); }
+
+    // Nodes built so far, the root included
+    size_t built_node_count() const { return built_nodes.load(std::memory_order_relaxed); }
+
+    // Expansions done twice because two threads reached the same node at once
+    size_t discarded_expansion_count() const { return discarded_expansions.load(std::memory_order_relaxed); }
+
+private:
+    static constexpr uint32_t cell_count = 1u << 21;
+
+    struct children;
+
+    struct node
+    {
+        aabb bbox;
+        uint32_t start;
+        uint32_t end;
+        mutable std::atomic<children*> expanded{nullptr};
+
+        node(const aabb& bbox, uint32_t start, uint32_t end)
+            : bbox(bbox)
+            , start(start)
+            , end(end)
+        {}
+    };
+
+    struct children
+    {
+        node left;
+        node right;
+        int axis; // Of the split, the left child is below it
+    };
+
+    static point3 center(const aabb& box)
+    {
+        return point3(0.5 * (box.x.min + box.x.max), 0.5 * (box.y.min + box.y.max), 0.5 * (box.z.min + box.z.max));
+    }
+
+    // The 21 low bits of v, two zero bits between each
+    static uint64_t spread(uint32_t v)
+    {
+        uint64_t x = v & 0x1fffff;
+        x = (x | x << 32) & 0x1f00000000ffffull;
+        x = (x | x << 16) & 0x1f0000ff0000ffull;
+        x = (x | x << 8) & 0x100f00f00f00f00full;
+        x = (x | x << 4) & 0x10c30c30c30c30c3ull;
+        x = (x | x << 2) & 0x1249249249249249ull;
+        return x;
+    }
+
+    // Split the node's range where its codes first differ, or in half if they are all equal,
+    // and publish the children unless another thread got there first
+    children* expand(const node& n) const
+    {
+        const auto first = codes.begin() + n.start;
+        const auto last = codes.begin() + n.end;
+        auto mid = n.start + (n.end - n.start) / 2;
+        int axis = 0;
+        if (const auto differing = *first ^ *(last - 1))
+        {
+            const auto bit = 63 - std::countl_zero(differing);
+            mid = uint32_t(std::partition_point(first, last, [bit](uint64_t code) { return !(code >> bit & 1); })
+                - codes.begin());
+            axis = 2 - bit % 3;
+        }
+
+        const auto range_box = [this](uint32_t start, uint32_t end)
+        {
+            aabb box = aabb::empty;
+            for (auto i = start; i < end; ++i)
+            {
+                box = aabb(box, objects[i]->bounding_box());
+            }
+            return box;
+        };
+        auto fresh = new children{{range_box(n.start, mid), n.start, mid}, {range_box(mid, n.end), mid, n.end}, axis};
+
+        children* current = nullptr;
+        if (n.expanded.compare_exchange_strong(current, fresh, std::memory_order_acq_rel, std::memory_order_acquire))
+        {
+            built_nodes.fetch_add(2, std::memory_order_relaxed);
+            return fresh;
+        }
+        delete fresh;
+        discarded_expansions.fetch_add(1, std::memory_order_relaxed);
+        return current;
+    }
+
+    void expand_to(const node& top, int depth)
+    {
+        std::vector<std::pair<const node*, int>> pending{{&top, 0}};
+        while (!pending.empty())
+        {
+            const auto [n, level] = pending.back();
+            pending.pop_back();
+            if (level >= depth || n->end - n->start <= max_leaf_size)
+            {
+                continue;
+            }
+            auto c = n->expanded.load(std::memory_order_acquire);
+            if (!c)
+            {
+                c = expand(*n);
+            }
+            pending.push_back({&c->left, level + 1});
+            pending.push_back({&c->right, level + 1});
+        }
+    }
+
+    std::vector<std::shared_ptr<hittable>> objects; // In Morton order
+    std::vector<uint64_t> codes;
+    std::unique_ptr<node> root;
+    mutable std::atomic<size_t> built_nodes{0};
+    mutable std::atomic<size_t> discarded_expansions{0};
+};
@@ -0,0 +1,179 @@
+#pragma once
+
+#include <cstdint>
+
+#include "hittable.h"
+#include "sphere.h"
+#include "triangle.h"
+
+// Structure-of-arrays copy of one BVH leaf, so all of its primitives are tested at once by a
+// single kernel. The kernels run the same fixed-width loop over every lane with no early exits,
+// which lets the compiler map each lane loop onto SIMD registers. Unused lanes are masked out.
+//
+// A specialization provides: enabled, width, assign(prims, count) to pack a leaf and
+// hit(r, ray_t, rec, prims) to test it. Types without one use the scalar per-primitive loop.
+template<typename T>
+struct leaf_batch
+{
+    static constexpr bool enabled = false;
+    static constexpr uint32_t width = 1;
+};
+
+// Index of the smallest lane parameter, or -1 when every lane is masked out with infinity
+template<size_t width>
+int closest_lane(const double (&t)[width], double& t_hit)
+{
+    int lane = -1;
+    t_hit = infinity;
+    for (size_t i = 0; i < width; ++i)
+    {
+        if (t[i] < t_hit)
+        {
+            t_hit = t[i];
+            lane = int(i);
+        }
+    }
+    return lane;
+}
+
+template<>
+struct leaf_batch<sphere>
+{
+    static constexpr bool enabled = true;
+    static constexpr uint32_t width = 4;
+
+    void assign(const sphere* prims, uint32_t n)
+    {
+        count = n;
+        for (uint32_t i = 0; i < width; ++i)
+        {
+            const auto& s = prims[i < n ? i : 0];
+            cx[i] = s.center.origin().x();
+            cy[i] = s.center.origin().y();
+            cz[i] = s.center.origin().z();
+            vx[i] = s.center.direction().x();
+            vy[i] = s.center.direction().y();
+            vz[i] = s.center.direction().z();
+            radius_squared[i] = s.radius * s.radius;
+        }
+    }
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec, const sphere* prims) const
+    {
+        const auto& o = r.origin();
+        const auto& d = r.direction();
+        const auto time = r.time();
+        const auto a = d.length_squared();
+
+        double t[width];
+        for (uint32_t i = 0; i < width; ++i)
+        {
+            // Same quadratic as sphere::hit, evaluated for every lane
+            const auto ocx = cx[i] + time * vx[i] - o.x();
+            const auto ocy = cy[i] + time * vy[i] - o.y();
+            const auto ocz = cz[i] + time * vz[i] - o.z();
+            const auto h = d.x() * ocx + d.y() * ocy + d.z() * ocz;
+            const auto c = ocx * ocx + ocy * ocy + ocz * ocz - radius_squared[i];
+            const auto discriminant = h * h - a * c;
+            const auto sqrtd = std::sqrt(discriminant < 0 ? 0.0 : discriminant);
+            const auto near_root = (h - sqrtd) / a;
+            const auto far_root = (h + sqrtd) / a;
+            const auto root = ray_t.surrounds(near_root) ? near_root : far_root;
+            const bool valid = i < count && discriminant >= 0 && ray_t.surrounds(root);
+            t[i] = valid ? root : infinity;
+        }
+
+        double t_hit;
+        const auto lane = closest_lane(t, t_hit);
+        if (lane < 0)
+        {
+            return false;
+        }
+
+        const auto& s = prims[lane];
+        s.set_hit_record(r, t_hit, s.center.at(r.time()), rec);
+        return true;
+    }
+
+    double cx[width], cy[width], cz[width];
+    double vx[width], vy[width], vz[width]; // Motion of moving spheres over the unit time interval
+    double radius_squared[width];
+    uint32_t count = 0;
+};
+
+template<>
+struct leaf_batch<triangle>
+{
+    static constexpr bool enabled = true;
+    static constexpr uint32_t width = 4;
+
+    void assign(const triangle* prims, uint32_t n)
+    {
+        count = n;
+        for (uint32_t i = 0; i < width; ++i)
+        {
+            const auto& tri = prims[i < n ? i : 0];
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                q[axis][i] = tri.Q[axis];
+                u[axis][i] = tri.u[axis];
+                v[axis][i] = tri.v[axis];
+                w[axis][i] = tri.w[axis];
+                normal[axis][i] = tri.normal[axis];
+            }
+            D[i] = tri.D;
+        }
+    }
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec, const triangle* prims) const
+    {
+        const auto& o = r.origin();
+        const auto& d = r.direction();
+
+        double t[width];
+        double alpha[width];
+        double beta[width];
+        for (uint32_t i = 0; i < width; ++i)
+        {
+            // Same plane and barycentric test as triangle::hit, evaluated for every lane
+            const auto denom = normal[0][i] * d.x() + normal[1][i] * d.y() + normal[2][i] * d.z();
+            const auto t_plane = (D[i] - (normal[0][i] * o.x() + normal[1][i] * o.y() + normal[2][i] * o.z())) / denom;
+
+            const auto px = o.x() + t_plane * d.x() - q[0][i];
+            const auto py = o.y() + t_plane * d.y() - q[1][i];
+            const auto pz = o.z() + t_plane * d.z() - q[2][i];
+
+            // alpha = w . (p x v), beta = w . (u x p)
+            alpha[i] = w[0][i] * (py * v[2][i] - pz * v[1][i])
+                     + w[1][i] * (pz * v[0][i] - px * v[2][i])
+                     + w[2][i] * (px * v[1][i] - py * v[0][i]);
+            beta[i] = w[0][i] * (u[1][i] * pz - u[2][i] * py)
+                    + w[1][i] * (u[2][i] * px - u[0][i] * pz)
+                    + w[2][i] * (u[0][i] * py - u[1][i] * px);
+
+            const bool valid = i < count && std::fabs(denom) >= 1E-8 && ray_t.contains(t_plane)
+                && alpha[i] > 0 && beta[i] > 0 && alpha[i] + beta[i] < 1;
+            t[i] = valid ? t_plane : infinity;
+        }
+
+        double t_hit;
+        const auto lane = closest_lane(t, t_hit);
+        if (lane < 0)
+        {
+            return false;
+        }
+
+        const auto& tri = prims[lane];
+        tri.is_interior(alpha[lane], beta[lane], rec);
+        tri.set_hit_record(r, t_hit, r.at(t_hit), rec);
+        return true;
+    }
+
+    double q[3][width];
+    double u[3][width];
+    double v[3][width];
+    double w[3][width];
+    double normal[3][width]; // Unit plane normal
+    double D[width];
+    uint32_t count = 0;
+};
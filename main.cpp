@@ -1,6 +1,7 @@
 #include "rtweekend.h"
 
 #include "bvh.h"
+#include "motion_bvh.h"
 #include "camera.h"
 #include "hittable.h"
 #include "hittable_list.h"
@@ -8,15 +9,37 @@
 #include "sphere.h"
 #include "texture.h"
 #include "quad.h"
+#include "box.h"
 #include "triangle.h"
 #include "constant_medium.h"
+#include "volume.h"
+#include "sparse_volume.h"
+#include "material_table.h"
+#include "primitive_groups.h"
+#include "quantized_bvh.h"
+#include "lazy_bvh.h"
+#include "split_bvh.h"
+#include "uniform_grid.h"
+#include "scene_arena.h"
+#include "animation.h"
+#include "render_service.h"
+#include "scene.h"
+#include "scene_file.h"
+
+void print_arena_stats(const scene_arena& arena)
+{
+    std::println(std::clog, "Scene arena: {} objects, {} bytes used, {} bytes reserved",
+        arena.objects(), arena.bytes_used(), arena.bytes_reserved());
+}
 
 void bouncing_spheres()
 {
+    scene_arena arena;
+    material_table materials(&arena);
     hittable_list world;
 
-    auto checker = std::make_shared<checker_texture>(0.32, color(0.2, 0.3, 0.1), color(0.9, 0.9, 0.9));
-    world.add(std::make_shared<sphere>(point3(0, -1000, 0), 1000, std::make_shared<lambertian>(checker)));
+    auto checker = materials.make_texture<checker_texture>(0.32, color(0.2, 0.3, 0.1), color(0.9, 0.9, 0.9));
+    world.add(arena.make<sphere>(point3(0, -1000, 0), 1000, materials.make_material<lambertian>(checker)));
 
     for (int a = -11; a < 11; ++a)
     {
@@ -31,38 +54,41 @@ void bouncing_spheres()
                 {
                     // diffuse
                     auto albedo = color::random() * color::random();
-                    auto sphere_material = std::make_shared<lambertian>(albedo);
+                    auto sphere_material = materials.make_material<lambertian>(albedo);
                     auto center2 = center + vec3(0, random_double(0, 0.5), 0);
-                    world.add(std::make_shared<sphere>(center, center2, .2, sphere_material));
+                    world.add(arena.make<sphere>(center, center2, .2, sphere_material));
                 }
                 else if (choose_mat < 0.95)
                 {
                     // metal
                     auto albedo = color::random(0.5, 1);
                     auto fuzz = random_double(0, 0.5);
-                    auto sphere_material = std::make_shared<metal>(albedo, fuzz);
-                    world.add(std::make_shared<sphere>(center, 0.2, sphere_material));
+                    auto sphere_material = materials.make_material<metal>(albedo, fuzz);
+                    world.add(arena.make<sphere>(center, 0.2, sphere_material));
                 }
                 else
                 {
                     // glass
-                    auto sphere_material = std::make_shared<dielectric>(1.5);
-                    world.add(std::make_shared<sphere>(center, 0.2, sphere_material));
+                    auto sphere_material = materials.make_material<dielectric>(1.5);
+                    world.add(arena.make<sphere>(center, 0.2, sphere_material));
                 }
             }
         }
     }
 
-    auto material1 = std::make_shared<dielectric>(1.5);
-    world.add(std::make_shared<sphere>(point3(0, 1, 0), 1.0, material1));
+    auto material1 = materials.make_material<dielectric>(1.5);
+    world.add(arena.make<sphere>(point3(0, 1, 0), 1.0, material1));
 
-    auto material2 = std::make_shared<lambertian>(color(0.4, 0.2, 0.1));
-    world.add(std::make_shared<sphere>(point3(-4, 1, 0), 1.0, material2));
+    auto material2 = materials.make_material<lambertian>(color(0.4, 0.2, 0.1));
+    world.add(arena.make<sphere>(point3(-4, 1, 0), 1.0, material2));
 
-    auto material3 = std::make_shared<metal>(color(0.7, 0.6, 0.5), 0.0);
-    world.add(std::make_shared<sphere>(point3(4, 1, 0), 1.0, material3));
+    auto material3 = materials.make_material<metal>(color(0.7, 0.6, 0.5), 0.0);
+    world.add(arena.make<sphere>(point3(4, 1, 0), 1.0, material3));
 
-    world = hittable_list(std::make_shared<bvh_node>(world));
+    // Most small spheres are moving, so the hierarchy keeps their bounds at several times
+    world = hittable_list(arena.make<motion_bvh>(world));
+
+    print_arena_stats(arena);
 
     camera cam;
     cam.aspect_ratio = 16.0 / 9.0;;
@@ -84,11 +110,15 @@ void bouncing_spheres()
 
 void checkered_spheres()
 {
+    scene_arena arena;
+    material_table materials(&arena);
     hittable_list world;
-    const auto checker = std::make_shared<checker_texture>(0.32, color(0.2, 0.3, 0.1), color(0.9, 0.9, 0.9));
+    const auto checker = materials.make_texture<checker_texture>(0.32, color(0.2, 0.3, 0.1), color(0.9, 0.9, 0.9));
+
+    world.add(arena.make<sphere>(point3(0, -10, 0), 10, materials.make_material<lambertian>(checker)));
+    world.add(arena.make<sphere>(point3(0, 10, 0), 10, materials.make_material<lambertian>(checker)));
 
-    world.add(std::make_shared<sphere>(point3(0, -10, 0), 10, std::make_shared<lambertian>(checker)));
-    world.add(std::make_shared<sphere>(point3(0, 10, 0), 10, std::make_shared<lambertian>(checker)));
+    print_arena_stats(arena);
 
     camera cam;
     cam.aspect_ratio = 16.0 / 9.0;
@@ -108,9 +138,13 @@ void checkered_spheres()
 
 void earth()
 {
-    auto earth_texture = std::make_shared<image_texture>("earthmap.jpg");
-    auto earth_surface = std::make_shared<lambertian>(earth_texture);
-    auto globe = std::make_shared<sphere>(point3(0, 0, 0), 2, earth_surface);
+    scene_arena arena;
+    material_table materials(&arena);
+    auto earth_texture = materials.make_texture<image_texture>("earthmap.jpg");
+    auto earth_surface = materials.make_material<lambertian>(earth_texture);
+    auto globe = arena.make<sphere>(point3(0, 0, 0), 2, earth_surface);
+
+    print_arena_stats(arena);
 
     camera cam;
     cam.aspect_ratio = 16.0 / 9.0;
@@ -131,11 +165,15 @@ void earth()
 
 void perlin_spheres()
 {
+    scene_arena arena;
+    material_table materials(&arena);
     hittable_list world;
 
-    auto pertext = std::make_shared<noise_texture>(4);
-    world.add(std::make_shared<sphere>(point3(0, -1000, 0), 1000, std::make_shared<lambertian>(pertext)));
-    world.add(std::make_shared<sphere>(point3(0, 2, 0), 2, std::make_shared<lambertian>(pertext)));
+    auto pertext = materials.make_texture<noise_texture>(4);
+    world.add(arena.make<sphere>(point3(0, -1000, 0), 1000, materials.make_material<lambertian>(pertext)));
+    world.add(arena.make<sphere>(point3(0, 2, 0), 2, materials.make_material<lambertian>(pertext)));
+
+    print_arena_stats(arena);
 
     camera cam;
     cam.aspect_ratio = 16.0 / 9.0;
@@ -156,21 +194,25 @@ void perlin_spheres()
 
 void quads()
 {
+    scene_arena arena;
+    material_table materials(&arena);
     hittable_list world;
 
     // Materials
-    auto left_red = std::make_shared<lambertian>(color(1.0, 0.2, 0.2));
-    auto back_green = std::make_shared<lambertian>(color(0.2, 1.0, 0.2));
-    auto right_blue = std::make_shared<lambertian>(color(0.2, 0.2, 1.0));
-    auto upper_orange = std::make_shared<lambertian>(color(1.0, 0.5, 0.0));
-    auto lower_teal = std::make_shared<lambertian>(color(0.2, 0.8, 0.8));
+    auto left_red = materials.make_material<lambertian>(color(1.0, 0.2, 0.2));
+    auto back_green = materials.make_material<lambertian>(color(0.2, 1.0, 0.2));
+    auto right_blue = materials.make_material<lambertian>(color(0.2, 0.2, 1.0));
+    auto upper_orange = materials.make_material<lambertian>(color(1.0, 0.5, 0.0));
+    auto lower_teal = materials.make_material<lambertian>(color(0.2, 0.8, 0.8));
 
     // Quads
-    world.add(std::make_shared<quad>(point3(-3, -2, 5), vec3(0, 0, -4), vec3(0, 4, 0), left_red));
-    world.add(std::make_shared<triangle>(point3(-2, -2, 0), vec3(4, 0, 0), vec3(0, 4, 0), back_green));
-    world.add(make_shared<quad>(point3( 3,-2, 1), vec3(0, 0, 4), vec3(0, 4, 0), right_blue));
-    world.add(make_shared<quad>(point3(-2, 3, 1), vec3(4, 0, 0), vec3(0, 0, 4), upper_orange));
-    world.add(make_shared<quad>(point3(-2,-3, 5), vec3(4, 0, 0), vec3(0, 0,-4), lower_teal));
+    world.add(arena.make<quad>(point3(-3, -2, 5), vec3(0, 0, -4), vec3(0, 4, 0), left_red));
+    world.add(arena.make<triangle>(point3(-2, -2, 0), vec3(4, 0, 0), vec3(0, 4, 0), back_green));
+    world.add(arena.make<quad>(point3( 3,-2, 1), vec3(0, 0, 4), vec3(0, 4, 0), right_blue));
+    world.add(arena.make<quad>(point3(-2, 3, 1), vec3(4, 0, 0), vec3(0, 0, 4), upper_orange));
+    world.add(arena.make<quad>(point3(-2,-3, 5), vec3(4, 0, 0), vec3(0, 0,-4), lower_teal));
+
+    print_arena_stats(arena);
 
     camera cam;
 
@@ -192,15 +234,19 @@ void quads()
 
 void simple_light()
 {
+    scene_arena arena;
+    material_table materials(&arena);
     hittable_list world;
 
-    auto pertext = std::make_shared<noise_texture>(4);
-    world.add(std::make_shared<sphere>(point3(0, -1000, 0), 1000, std::make_shared<lambertian>(pertext)));
-    world.add(std::make_shared<sphere>(point3(0, 2, 0), 2, std::make_shared<lambertian>(pertext)));
+    auto pertext = materials.make_texture<noise_texture>(4);
+    world.add(arena.make<sphere>(point3(0, -1000, 0), 1000, materials.make_material<lambertian>(pertext)));
+    world.add(arena.make<sphere>(point3(0, 2, 0), 2, materials.make_material<lambertian>(pertext)));
+
+    auto difflight = materials.make_material<diffuse_light>(color(4, 4, 4));
+    world.add(arena.make<sphere>(point3(0, 7, 0), 2, difflight));
+    world.add(arena.make<quad>(point3(3, 1, -2), vec3(2, 0, 0), vec3(0, 2, 0), difflight));
 
-    auto difflight = std::make_shared<diffuse_light>(color(4, 4, 4));
-    world.add(std::make_shared<sphere>(point3(0, 7, 0), 2, difflight));
-    world.add(std::make_shared<quad>(point3(3, 1, -2), vec3(2, 0, 0), vec3(0, 2, 0), difflight));
+    print_arena_stats(arena);
 
     camera cam;
     cam.aspect_ratio = 16.0 / 9.0;
@@ -219,41 +265,42 @@ void simple_light()
     // cam.render(world);
 }
 
-void cornell_box()
+void cornell_box(scene& s)
 {
-    hittable_list world;
+    auto& arena = s.arena;
+    auto& materials = s.materials;
+    auto& world = s.world;
 
-    auto red = std::make_shared<lambertian>(color(0.65, 0.05, 0.05));
-    auto white = std::make_shared<lambertian>(color(0.73, 0.73, 0.73));
-    auto green = std::make_shared<lambertian>(color(.12, .45, .15));
-    auto light = std::make_shared<diffuse_light>(color(15, 15, 15));
+    auto red = materials.make_material<lambertian>(color(0.65, 0.05, 0.05));
+    auto white = materials.make_material<lambertian>(color(0.73, 0.73, 0.73));
+    auto green = materials.make_material<lambertian>(color(.12, .45, .15));
+    auto light = materials.make_material<diffuse_light>(color(15, 15, 15));
 
-    world.add(std::make_shared<quad>(point3(555,0,0), vec3(0,555,0), vec3(0,0,555), green));
-    world.add(std::make_shared<quad>(point3(0,0,0), vec3(0,555,0), vec3(0,0,555), red));
-    world.add(std::make_shared<quad>(point3(0,0,0), vec3(555,0,0), vec3(0,0,555), white));
-    world.add(std::make_shared<quad>(point3(555,555,555), vec3(-555,0,0), vec3(0,0,-555), white));
-    world.add(std::make_shared<quad>(point3(0,0,555), vec3(555,0,0), vec3(0,555,0), white));
-    world.add(std::make_shared<quad>(point3(343, 554, 332), vec3(-130, 0, 0), vec3(0, 0, -105), light));
+    world.add(arena.make<quad>(point3(555,0,0), vec3(0,555,0), vec3(0,0,555), green));
+    world.add(arena.make<quad>(point3(0,0,0), vec3(0,555,0), vec3(0,0,555), red));
+    world.add(arena.make<quad>(point3(0,0,0), vec3(555,0,0), vec3(0,0,555), white));
+    world.add(arena.make<quad>(point3(555,555,555), vec3(-555,0,0), vec3(0,0,-555), white));
+    world.add(arena.make<quad>(point3(0,0,555), vec3(555,0,0), vec3(0,555,0), white));
+    world.add(arena.make<quad>(point3(343, 554, 332), vec3(-130, 0, 0), vec3(0, 0, -105), light));
 
 
     // Box
-    std::shared_ptr<hittable> box1 = box(point3(0, 0, 0), point3(165, 330, 165), white);
-    box1 = std::make_shared<rotate_y>(box1, 15);
-    box1 = std::make_shared<translate>(box1, vec3(265, 0, 295));
+    auto box1 = arena.make<oriented_box>(point3(0, 0, 0), point3(165, 330, 165), 15, vec3(265, 0, 295), white);
     world.add(box1);
 
 
     // Glass Sphere
-    auto glass = std::make_shared<dielectric>(1.5);
-    world.add(std::make_shared<sphere>(point3(190, 90, 190), 90, glass));
+    auto glass = materials.make_material<dielectric>(1.5);
+    world.add(arena.make<sphere>(point3(190, 90, 190), 90, glass));
 
     // Light Sources
-    auto empty_material = std::shared_ptr<material>();
-    hittable_list lights;
-    lights.add(std::make_shared<quad>(point3(343, 554, 332), vec3(-130, 0, 0), vec3(0, 0, -105), empty_material));
-    lights.add(std::make_shared<sphere>(point3(190, 90, 190), 90, empty_material));
+    const material* empty_material = nullptr;
+    auto& lights = s.lights;
+    lights.add(arena.make<quad>(point3(343, 554, 332), vec3(-130, 0, 0), vec3(0, 0, -105), empty_material));
 
-    camera cam;
+    print_arena_stats(arena);
+
+    auto& cam = s.cam;
     cam.aspect_ratio = 1.0;
     cam.image_width = 600;
     cam.samples_per_pixel = 100;
@@ -266,43 +313,46 @@ void cornell_box()
     cam.vup = vec3(0, 1, 0);
 
     cam.defocus_angle = 0;
-
-    cam.render(world, lights);
 }
 
-void cornell_box_glossy()
+void cornell_box_glossy(scene& s)
 {
-    hittable_list world;
+    auto& arena = s.arena;
+    auto& materials = s.materials;
+    auto groups = arena.make<primitive_groups>(&arena);
+    auto& world = *groups;
 
-    auto red = std::make_shared<lambertian>(color(0.65, 0.05, 0.05));
-    auto white = std::make_shared<lambertian>(color(0.73, 0.73, 0.73));
-    auto green = std::make_shared<lambertian>(color(.12, .45, .15));
-    auto light = std::make_shared<diffuse_light>(color(15, 15, 15));
+    auto red = materials.make_material<lambertian>(color(0.65, 0.05, 0.05));
+    auto white = materials.make_material<lambertian>(color(0.73, 0.73, 0.73));
+    auto green = materials.make_material<lambertian>(color(.12, .45, .15));
+    auto light = materials.make_material<diffuse_light>(color(15, 15, 15));
 
-    world.add(std::make_shared<quad>(point3(555,0,0), vec3(0,555,0), vec3(0,0,555), green));
-    world.add(std::make_shared<quad>(point3(0,0,0), vec3(0,555,0), vec3(0,0,555), red));
-    world.add(std::make_shared<quad>(point3(0,0,0), vec3(555,0,0), vec3(0,0,555), white));
-    world.add(std::make_shared<quad>(point3(555,555,555), vec3(-555,0,0), vec3(0,0,-555), white));
-    world.add(std::make_shared<quad>(point3(0,0,555), vec3(555,0,0), vec3(0,555,0), white));
-    world.add(std::make_shared<quad>(point3(343, 554, 332), vec3(-130, 0, 0), vec3(0, 0, -105), light));
+    world.add(quad(point3(555,0,0), vec3(0,555,0), vec3(0,0,555), green));
+    world.add(quad(point3(0,0,0), vec3(0,555,0), vec3(0,0,555), red));
+    world.add(quad(point3(0,0,0), vec3(555,0,0), vec3(0,0,555), white));
+    world.add(quad(point3(555,555,555), vec3(-555,0,0), vec3(0,0,-555), white));
+    world.add(quad(point3(0,0,555), vec3(555,0,0), vec3(0,555,0), white));
+    world.add(quad(point3(343, 554, 332), vec3(-130, 0, 0), vec3(0, 0, -105), light));
 
 
     // Box
-    std::shared_ptr<hittable> box1 = box(point3(0, 0, 0), point3(165, 330, 165), white);
-    box1 = std::make_shared<rotate_y>(box1, 15);
-    box1 = std::make_shared<translate>(box1, vec3(265, 0, 295));
-    world.add(box1);
+    world.add(oriented_box(point3(0, 0, 0), point3(165, 330, 165), 15, vec3(265, 0, 295), white));
 
     // Sphere
-    auto sphere_material = std::make_shared<glossy>(color(.12, .45, .15), 30);
-    world.add(std::make_shared<sphere>(point3(190, 90, 190), 90, sphere_material));
+    auto sphere_material = materials.make_material<glossy>(color(.12, .45, .15), 30);
+    world.add(sphere(point3(190, 90, 190), 90, sphere_material));
+
+    world.build();
+    s.world.add(groups);
 
     // Light Sources
-    auto empty_material = std::shared_ptr<material>();
-    hittable_list lights;
-    lights.add(std::make_shared<quad>(point3(343, 554, 332), vec3(-130, 0, 0), vec3(0, 0, -105), empty_material));
+    const material* empty_material = nullptr;
+    auto& lights = s.lights;
+    lights.add(arena.make<quad>(point3(343, 554, 332), vec3(-130, 0, 0), vec3(0, 0, -105), empty_material));
 
-    camera cam;
+    print_arena_stats(arena);
+
+    auto& cam = s.cam;
     cam.aspect_ratio = 1.0;
     cam.image_width = 600;
     cam.samples_per_pixel = 100;
@@ -315,36 +365,34 @@ void cornell_box_glossy()
     cam.vup = vec3(0, 1, 0);
 
     cam.defocus_angle = 0;
-
-    cam.render(world, lights);
 }
 
 void cornell_smoke()
 {
+    scene_arena arena;
+    material_table materials(&arena);
     hittable_list world;
 
-    auto red = std::make_shared<lambertian>(color(0.65, 0.05, 0.05));
-    auto white = std::make_shared<lambertian>(color(0.73, 0.73, 0.73));
-    auto green = std::make_shared<lambertian>(color(.12, .45, .15));
-    auto light = std::make_shared<diffuse_light>(color(7, 7, 7));
+    auto red = materials.make_material<lambertian>(color(0.65, 0.05, 0.05));
+    auto white = materials.make_material<lambertian>(color(0.73, 0.73, 0.73));
+    auto green = materials.make_material<lambertian>(color(.12, .45, .15));
+    auto light = materials.make_material<diffuse_light>(color(7, 7, 7));
+
+    world.add(arena.make<quad>(point3(555,0,0), vec3(0,555,0), vec3(0,0,555), green));
+    world.add(arena.make<quad>(point3(0,0,0), vec3(0,555,0), vec3(0,0,555), red));
+    world.add(arena.make<quad>(point3(0,0,0), vec3(555,0,0), vec3(0,0,555), white));
+    world.add(arena.make<quad>(point3(0,555,0), vec3(555,0,0), vec3(0,0,555), white));
+    world.add(arena.make<quad>(point3(0,0,555), vec3(555,0,0), vec3(0,555,0), white));
+    world.add(arena.make<quad>(point3(113, 554, 127), vec3(330, 0, 0), vec3(0, 0, 305), light));
 
-    world.add(std::make_shared<quad>(point3(555,0,0), vec3(0,555,0), vec3(0,0,555), green));
-    world.add(std::make_shared<quad>(point3(0,0,0), vec3(0,555,0), vec3(0,0,555), red));
-    world.add(std::make_shared<quad>(point3(0,0,0), vec3(555,0,0), vec3(0,0,555), white));
-    world.add(std::make_shared<quad>(point3(0,555,0), vec3(555,0,0), vec3(0,0,555), white));
-    world.add(std::make_shared<quad>(point3(0,0,555), vec3(555,0,0), vec3(0,555,0), white));
-    world.add(std::make_shared<quad>(point3(113, 554, 127), vec3(330, 0, 0), vec3(0, 0, 305), light));
+    auto box1 = arena.make<oriented_box>(point3(0, 0, 0), point3(165, 330, 165), 15, vec3(265, 0, 295), white);
 
-    std::shared_ptr<hittable> box1 = box(point3(0, 0, 0), point3(165, 330, 165), white);
-    box1 = std::make_shared<rotate_y>(box1, 15);
-    box1 = std::make_shared<translate>(box1, vec3(265, 0, 295));
+    auto box2 = arena.make<oriented_box>(point3(0,0,0), point3(165,165,165), -18, vec3(130,0,65), white);
 
-    std::shared_ptr<hittable> box2 = box(point3(0,0,0), point3(165,165,165), white);
-    box2 = std::make_shared<rotate_y>(box2, -18);
-    box2 = std::make_shared<translate>(box2, vec3(130,0,65));
+    world.add(arena.make<constant_medium>(box1, 0.01, color(0, 0, 0)));
+    world.add(arena.make<constant_medium>(box2, 0.01, color(1, 1, 1)));
 
-    world.add(std::make_shared<constant_medium>(box1, 0.01, color(0, 0, 0)));
-    world.add(std::make_shared<constant_medium>(box2, 0.01, color(1, 1, 1)));
+    print_arena_stats(arena);
 
     camera cam;
     cam.aspect_ratio = 1.0;
@@ -363,10 +411,124 @@ void cornell_smoke()
     // cam.render(world);
 }
 
+void cornell_cloud(scene& s)
+{
+    auto& arena = s.arena;
+    auto& materials = s.materials;
+    auto& world = s.world;
+
+    auto red = materials.make_material<lambertian>(color(0.65, 0.05, 0.05));
+    auto white = materials.make_material<lambertian>(color(0.73, 0.73, 0.73));
+    auto green = materials.make_material<lambertian>(color(.12, .45, .15));
+    auto light = materials.make_material<diffuse_light>(color(15, 15, 15));
+
+    world.add(arena.make<quad>(point3(555,0,0), vec3(0,555,0), vec3(0,0,555), green));
+    world.add(arena.make<quad>(point3(0,0,0), vec3(0,555,0), vec3(0,0,555), red));
+    world.add(arena.make<quad>(point3(0,0,0), vec3(555,0,0), vec3(0,0,555), white));
+    world.add(arena.make<quad>(point3(555,555,555), vec3(-555,0,0), vec3(0,0,-555), white));
+    world.add(arena.make<quad>(point3(0,0,555), vec3(555,0,0), vec3(0,555,0), white));
+    world.add(arena.make<quad>(point3(343, 554, 332), vec3(-130, 0, 0), vec3(0, 0, -105), light));
+
+    // Turbulent cloud, empty outside a sphere so the majorant grid can skip the corners
+    perlin noise;
+    const auto cloud_center = point3(278, 250, 278);
+    const auto cloud_bounds = aabb(point3(78, 50, 78), point3(478, 450, 478));
+    auto cloud = density_grid::sample(cloud_bounds, 96, 96, 96, [&](const point3& p)
+    {
+        const auto falloff = 1 - (p - cloud_center).length() / 200;
+        return falloff <= 0 ? 0.0 : 0.05 * std::fmax(0, 0.5 * falloff + noise.turb(0.02 * p, 5) - 0.4);
+    }, &arena);
+    world.add(arena.make<heterogeneous_medium>(cloud, color(0.9, 0.9, 0.9)));
+
+    const material* empty_material = nullptr;
+    auto& lights = s.lights;
+    lights.add(arena.make<quad>(point3(343, 554, 332), vec3(-130, 0, 0), vec3(0, 0, -105), empty_material));
+
+    print_arena_stats(arena);
+
+    auto& cam = s.cam;
+    cam.aspect_ratio = 1.0;
+    cam.image_width = 600;
+    cam.samples_per_pixel = 100;
+    cam.max_depth = 50;
+    cam.background = color(0, 0, 0);
+
+    cam.vfov = 40;
+    cam.lookfrom = point3(278, 278, -800);
+    cam.lookat = point3(278, 278, 0);
+    cam.vup = vec3(0, 1, 0);
+
+    cam.defocus_angle = 0;
+}
+
+void cornell_voxels(scene& s)
+{
+    auto& arena = s.arena;
+    auto& materials = s.materials;
+    auto& world = s.world;
+
+    auto red = materials.make_material<lambertian>(color(0.65, 0.05, 0.05));
+    auto white = materials.make_material<lambertian>(color(0.73, 0.73, 0.73));
+    auto green = materials.make_material<lambertian>(color(.12, .45, .15));
+    auto light = materials.make_material<diffuse_light>(color(15, 15, 15));
+
+    world.add(arena.make<quad>(point3(555,0,0), vec3(0,555,0), vec3(0,0,555), green));
+    world.add(arena.make<quad>(point3(0,0,0), vec3(0,555,0), vec3(0,0,555), red));
+    world.add(arena.make<quad>(point3(0,0,0), vec3(555,0,0), vec3(0,0,555), white));
+    world.add(arena.make<quad>(point3(555,555,555), vec3(-555,0,0), vec3(0,0,-555), white));
+    world.add(arena.make<quad>(point3(0,0,555), vec3(555,0,0), vec3(0,555,0), white));
+    world.add(arena.make<quad>(point3(343, 554, 332), vec3(-130, 0, 0), vec3(0, 0, -105), light));
+
+    // Voxel data from smoke.rtvx when present, otherwise a procedural torus of smoke
+    auto voxels = std::make_shared<sparse_voxel_grid>(point3(78, 50, 78), 4.0);
+    const std::filesystem::path voxel_file = "smoke.rtvx";
+    if (!std::filesystem::exists(voxel_file) || !voxels->load(voxel_file))
+    {
+        for (int k = 0; k < 100; ++k)
+        {
+            for (int j = 0; j < 100; ++j)
+            {
+                for (int i = 0; i < 100; ++i)
+                {
+                    const auto ring = std::hypot(i - 49.5, k - 49.5) - 30;
+                    if (std::hypot(ring, j - 49.5) < 10)
+                    {
+                        voxels->set(i, j, k, 0.02f);
+                    }
+                }
+            }
+        }
+    }
+    std::println(std::clog, "Voxel grid: {} bricks, {} bytes", voxels->brick_count(), voxels->memory_bytes());
+    world.add(arena.make<sparse_medium>(voxels, color(0.8, 0.8, 0.8)));
+
+    const material* empty_material = nullptr;
+    auto& lights = s.lights;
+    lights.add(arena.make<quad>(point3(343, 554, 332), vec3(-130, 0, 0), vec3(0, 0, -105), empty_material));
+
+    print_arena_stats(arena);
+
+    auto& cam = s.cam;
+    cam.aspect_ratio = 1.0;
+    cam.image_width = 600;
+    cam.samples_per_pixel = 100;
+    cam.max_depth = 50;
+    cam.background = color(0, 0, 0);
+
+    cam.vfov = 40;
+    cam.lookfrom = point3(278, 278, -800);
+    cam.lookat = point3(278, 278, 0);
+    cam.vup = vec3(0, 1, 0);
+
+    cam.defocus_angle = 0;
+}
+
 void final_scene(int image_width, int samples_per_pixel, int max_depth)
 {
+    scene_arena arena;
+    material_table materials(&arena);
     hittable_list boxes1;
-    auto ground = std::make_shared<lambertian>(color(0.48, 0.83, 0.53));
+    auto ground = materials.make_material<lambertian>(color(0.48, 0.83, 0.53));
 
     int boxes_per_side = 20;
     for (int i = 0; i < boxes_per_side; ++i)
@@ -381,46 +543,52 @@ void final_scene(int image_width, int samples_per_pixel, int max_depth)
             auto y1 = random_double(1, 101);
             auto z1 = z0 + w;
 
-            boxes1.add(box(point3(x0, y0, z0), point3(x1, y1, z1), ground));
+            boxes1.add(box(point3(x0, y0, z0), point3(x1, y1, z1), ground, &arena));
         }
     }
 
     hittable_list world;
 
-    world.add(std::make_shared<bvh_node>(boxes1));
+    world.add(arena.make<bvh_node>(boxes1, &arena));
 
-    auto light = std::make_shared<diffuse_light>(color(7, 7, 7));
-    world.add(std::make_shared<quad>(point3(123, 554, 147), vec3(300, 0, 0), vec3(0, 0, 265), light));
+    auto light = materials.make_material<diffuse_light>(color(7, 7, 7));
+    world.add(arena.make<quad>(point3(123, 554, 147), vec3(300, 0, 0), vec3(0, 0, 265), light));
 
     auto center1 = point3(400, 400, 200);
     auto center2 = center1 + vec3(30, 0, 0);
-    auto sphere_material = std::make_shared<lambertian>(color(0.7, 0.3, 0.1));
-    world.add(std::make_shared<sphere>(center1, center2, 50, sphere_material));
+    auto sphere_material = materials.make_material<lambertian>(color(0.7, 0.3, 0.1));
+    world.add(arena.make<sphere>(center1, center2, 50, sphere_material));
 
-    world.add(std::make_shared<sphere>(point3(260, 150, 45), 50, std::make_shared<dielectric>(1.5)));
-    world.add(std::make_shared<sphere>(point3(0, 150, 145), 50, std::make_shared<metal>(color(0.8, 0.8, 0.8), 1.0)));
+    world.add(arena.make<sphere>(point3(260, 150, 45), 50, materials.make_material<dielectric>(1.5)));
+    world.add(arena.make<sphere>(point3(0, 150, 145), 50, materials.make_material<metal>(color(0.8, 0.8, 0.8), 1.0)));
 
-    auto boundary = std::make_shared<sphere>(point3(360, 150, 145), 70, std::make_shared<dielectric>(1.5));
+    auto boundary = arena.make<sphere>(point3(360, 150, 145), 70, materials.make_material<dielectric>(1.5));
     world.add(boundary);
-    world.add(std::make_shared<constant_medium>(boundary, 0.2, color(0.2, 0.4, 0.9)));
-    boundary = std::make_shared<sphere>(point3(0, 0, 0), 5000, std::make_shared<dielectric>(1.5));
-    world.add(std::make_shared<constant_medium>(boundary, 0.0001, color(1, 1, 1)));
-
-    auto emat = std::make_shared<lambertian>(std::make_shared<image_texture>("earthmap.jpg"));
-    world.add(std::make_shared<sphere>(point3(400, 200, 400), 100, emat));
-    auto pertext = std::make_shared<noise_texture>(0.2);
-    world.add(std::make_shared<sphere>(point3(220, 280, 300), 80, std::make_shared<lambertian>(pertext)));
-
+    world.add(arena.make<constant_medium>(boundary, 0.2, color(0.2, 0.4, 0.9)));
+    // Scene-wide fog filling the 5000 radius sphere. The grid is empty outside it, so the fog
+    // keeps its spherical extent and the majorant grid skips the corners of the box.
+    auto fog = density_grid::sample(aabb(point3(-5000, -5000, -5000), point3(5000, 5000, 5000)), 64, 64, 64,
+        [](const point3& p) { return p.length() < 5000 ? 0.0001 : 0.0; }, &arena);
+    world.add(arena.make<heterogeneous_medium>(fog, color(1, 1, 1)));
+
+    auto emat = materials.make_material<lambertian>(materials.make_texture<image_texture>("earthmap.jpg"));
+    world.add(arena.make<sphere>(point3(400, 200, 400), 100, emat));
+    auto pertext = materials.make_texture<noise_texture>(0.2);
+    world.add(arena.make<sphere>(point3(220, 280, 300), 80, materials.make_material<lambertian>(pertext)));
+
+    // The sphere cluster is equal spheres filling a cube, which a grid walks in a few cells
     hittable_list boxes2;
-    auto white = std::make_shared<lambertian>(color(0.73, 0.73, 0.73));
+    auto white = materials.make_material<lambertian>(color(0.73, 0.73, 0.73));
     int ns = 1000;
     for (int j = 0; j < ns; ++j)
     {
-        boxes2.add(std::make_shared<sphere>(point3::random(0, 165), 10, white));
+        boxes2.add(arena.make<sphere>(point3::random(0, 165), 10, white));
     }
 
-    world.add(std::make_shared<translate>(std::make_shared<rotate_y>(std::make_shared<bvh_node>(boxes2), 15),
-        vec3(-100, 270, 395)));
+    auto cluster = arena.make<uniform_grid>(boxes2, uniform_grid::default_density, &arena);
+    world.add(arena.make<translate>(arena.make<rotate_y>(cluster, 15), vec3(-100, 270, 395)));
+
+    print_arena_stats(arena);
 
     camera cam;
 
@@ -440,8 +608,533 @@ void final_scene(int image_width, int samples_per_pixel, int max_depth)
     // cam.render(world);
 }
 
-int main()
+void cornell_animation()
+{
+    scene_arena arena;
+    material_table materials(&arena);
+    hittable_list world;
+    animation anim;
+
+    auto red = materials.make_material<lambertian>(color(0.65, 0.05, 0.05));
+    auto white = materials.make_material<lambertian>(color(0.73, 0.73, 0.73));
+    auto green = materials.make_material<lambertian>(color(.12, .45, .15));
+    auto light = materials.make_material<diffuse_light>(color(15, 15, 15));
+
+    world.add(arena.make<quad>(point3(555,0,0), vec3(0,555,0), vec3(0,0,555), green));
+    world.add(arena.make<quad>(point3(0,0,0), vec3(0,555,0), vec3(0,0,555), red));
+    world.add(arena.make<quad>(point3(0,0,0), vec3(555,0,0), vec3(0,0,555), white));
+    world.add(arena.make<quad>(point3(555,555,555), vec3(-555,0,0), vec3(0,0,-555), white));
+    world.add(arena.make<quad>(point3(0,0,555), vec3(555,0,0), vec3(0,555,0), white));
+    world.add(arena.make<quad>(point3(343, 554, 332), vec3(-130, 0, 0), vec3(0, 0, -105), light));
+
+    // Box turning and sliding towards the back
+    keyframe_track<vec3> box_offset;
+    box_offset.add(0, vec3(265, 0, 295));
+    box_offset.add(23, vec3(300, 0, 340));
+    keyframe_track<double> box_angle;
+    box_angle.add(0, 15);
+    box_angle.add(23, 105);
+    auto box1 = arena.make<animated_transform>(
+        box(point3(0, 0, 0), point3(165, 330, 165), white, &arena), box_offset, box_angle);
+    anim.add(box1);
+    world.add(box1);
+
+    // Glass sphere bouncing once
+    keyframe_track<vec3> sphere_offset;
+    sphere_offset.add(0, vec3(190, 90, 190));
+    sphere_offset.add(12, vec3(190, 250, 190));
+    sphere_offset.add(23, vec3(190, 90, 190));
+    auto glass = materials.make_material<dielectric>(1.5);
+    auto sphere1 = arena.make<animated_transform>(arena.make<sphere>(point3(0, 0, 0), 90, glass), sphere_offset);
+    anim.add(sphere1);
+    world.add(sphere1);
+
+    // Light Sources
+    const material* empty_material = nullptr;
+    hittable_list lights;
+    lights.add(arena.make<quad>(point3(343, 554, 332), vec3(-130, 0, 0), vec3(0, 0, -105), empty_material));
+
+    motion_bvh bvh(world);
+
+    print_arena_stats(arena);
+
+    camera cam;
+    cam.aspect_ratio = 1.0;
+    cam.image_width = 300;
+    cam.samples_per_pixel = 64;
+    cam.max_depth = 50;
+    cam.background = color(0, 0, 0);
+
+    cam.vfov = 40;
+    cam.vup = vec3(0, 1, 0);
+    cam.defocus_angle = 0;
+
+    // Slow dolly to the right
+    anim.first_frame = 0;
+    anim.last_frame = 23;
+    anim.lookfrom.add(0, point3(278, 278, -800));
+    anim.lookfrom.add(23, point3(420, 300, -760));
+    anim.lookat.add(0, point3(278, 278, 0));
+
+    anim.render(cam, bvh, lights, "frames");
+}
+
+// One hierarchy in a traversal benchmark
+struct hierarchy_timing
+{
+    const char* name;
+    size_t bytes;
+    std::function<bool(const ray&, interval, hit_record&)> hit;
+    double seconds = infinity;
+    uint64_t visits = 0;
+    size_t hits = 0;
+    double distance = 0;
+};
+
+// Trace the rays through every hierarchy in three interleaved rounds, each keeping its fastest
+void time_hierarchies(const std::vector<ray>& rays, std::span<hierarchy_timing> timings)
+{
+    if (!traversal_stats)
+    {
+        std::println(std::clog, "Node visits are only counted in builds with RAY_TRACER_TRAVERSAL_STATS");
+    }
+    for (int round = 0; round < 3; ++round)
+    {
+        for (auto& timing : timings)
+        {
+            hit_record rec;
+            timing.hits = 0;
+            timing.distance = 0;
+            const auto visits_before = traversal_node_visits;
+            const auto start = std::chrono::steady_clock::now();
+            for (const auto& r : rays)
+            {
+                if (timing.hit(r, interval(0.001, infinity), rec))
+                {
+                    ++timing.hits;
+                    timing.distance += rec.t;
+                }
+            }
+            const auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            timing.seconds = std::min(timing.seconds, seconds);
+            timing.visits = traversal_node_visits - visits_before;
+        }
+    }
+}
+
+// Rays starting anywhere in the box, in uniformly random directions
+std::vector<ray> random_rays(const aabb& box, int count)
+{
+    std::vector<ray> rays;
+    for (int i = 0; i < count; ++i)
+    {
+        const point3 origin(random_double(box.x.min, box.x.max), random_double(box.y.min, box.y.max),
+            random_double(box.z.min, box.z.max));
+        rays.emplace_back(origin, random_unit_vector());
+    }
+    return rays;
+}
+
+// A tessellated bumpy sphere centred in the cube from 0 to 100, standing in for a scanned mesh
+void add_bumpy_sphere(hittable_list& list, typed_bvh<triangle>* flat, int rings, scene_arena& arena,
+    const material* mat)
 {
+    const auto segments = 2 * rings;
+    const auto vertex = [&](int ring, int segment)
+    {
+        const auto theta = pi * ring / rings;
+        const auto phi = 2 * pi * segment / segments;
+        const auto radius = 40 * (1 + 0.08 * std::sin(7 * theta) * std::cos(9 * phi));
+        return point3(50 + radius * std::sin(theta) * std::cos(phi), 50 + radius * std::cos(theta),
+            50 + radius * std::sin(theta) * std::sin(phi));
+    };
+
+    for (int ring = 0; ring < rings; ++ring)
+    {
+        for (int segment = 0; segment < segments; ++segment)
+        {
+            const auto a = vertex(ring, segment);
+            const auto b = vertex(ring, segment + 1);
+            const auto c = vertex(ring + 1, segment);
+            const auto d = vertex(ring + 1, segment + 1);
+            for (const auto& [q, u, v] : {std::tuple{a, c - a, b - a}, std::tuple{b, c - b, d - b}})
+            {
+                list.add(arena.make<triangle>(q, u, v, mat));
+                if (flat)
+                {
+                    flat->add(triangle(q, u, v, mat));
+                }
+            }
+        }
+    }
+}
+
+// Memory and traversal speed of the hierarchies over the same mesh, a tessellated bumpy
+// sphere: bvh_node with its shared_ptr children, the flat typed_bvh with double boxes and leaf
+// batches, and quantized_bvh. Rays start anywhere in the mesh's bounding cube.
+void hierarchy_benchmark(int rings, int ray_count)
+{
+    scene_arena arena;
+    material_table materials(&arena);
+    auto white = materials.make_material<lambertian>(color(0.73, 0.73, 0.73));
+
+    hittable_list list;
+    typed_bvh<triangle> flat;
+    add_bumpy_sphere(list, &flat, rings, arena, white);
+    const auto triangle_count = list.objects.size();
+
+    const auto arena_before = arena.bytes_used();
+    bvh_node tree(list, &arena);
+    const auto tree_bytes = arena.bytes_used() - arena_before + sizeof(bvh_node);
+    flat.build();
+    quantized_bvh quantized(list);
+
+    const auto rays = random_rays(aabb(point3(0, 0, 0), point3(100, 100, 100)), ray_count);
+    hierarchy_timing results[] = {
+        {"bvh_node", tree_bytes, [&](const ray& r, interval t, hit_record& rec) { return tree.hit(r, t, rec); }},
+        {"typed_bvh", flat.hierarchy_bytes(), [&](const ray& r, interval t, hit_record& rec) { return flat.hit(r, t, rec); }},
+        {"quantized_bvh", quantized.hierarchy_bytes(), [&](const ray& r, interval t, hit_record& rec) { return quantized.hit(r, t, rec); }},
+    };
+    time_hierarchies(rays, results);
+
+    std::println(std::clog, "{} triangles, {} rays", triangle_count, ray_count);
+    for (const auto& result : results)
+    {
+        std::println(std::clog, "  {:<14} {:>6.1f} bytes/primitive {:>6.2f} Mrays/s {:>6.1f} nodes/ray, {} hits, mean t {:.6f}",
+            result.name, double(result.bytes) / triangle_count, ray_count / result.seconds / 1e6,
+            double(result.visits) / ray_count, result.hits, result.hits ? result.distance / result.hits : 0.0);
+    }
+}
+
+// A storeyed building of quads and triangles, the kind of model spatial splits are for: floor
+// slabs and walls spanning the whole floor plan, diagonal ramps, a long thin roof fan and small
+// tables in every room
+void add_building(hittable_list& list, int storeys, int rooms, scene_arena& arena, const material* mat)
+{
+    constexpr double room = 10;
+    constexpr double height = 4;
+    const auto side = rooms * room;
+    const auto add_quad = [&](const point3& q, const vec3& u, const vec3& v)
+    {
+        list.add(arena.make<quad>(q, u, v, mat));
+    };
+
+    for (int storey = 0; storey < storeys; ++storey)
+    {
+        const auto floor = storey * height;
+        add_quad(point3(0, floor, 0), vec3(side, 0, 0), vec3(0, 0, side));
+        for (int wall = 0; wall <= rooms; ++wall)
+        {
+            add_quad(point3(wall * room, floor, 0), vec3(0, height, 0), vec3(0, 0, side));
+            add_quad(point3(0, floor, wall * room), vec3(side, 0, 0), vec3(0, height, 0));
+        }
+
+        for (int i = 0; i < rooms; ++i)
+        {
+            for (int k = 0; k < rooms; ++k)
+            {
+                const point3 corner(i * room, floor, k * room);
+                // A ramp rising across the room's diagonal
+                const auto along = vec3(room - 2, height, room - 2) * 0.9;
+                add_quad(corner + vec3(1, 0, 1), along, vec3(0.7, 0, -0.7));
+
+                // A table
+                const auto table = corner + vec3(6, 0.75, 2);
+                const vec3 dx(1.5, 0, 0), dy(0, 0.05, 0), dz(0, 0, 0.8);
+                add_quad(table, dx, dz);
+                add_quad(table + dy, dx, dz);
+                add_quad(table, dx, dy);
+                add_quad(table + dz, dx, dy);
+                add_quad(table, dz, dy);
+                add_quad(table + dx, dz, dy);
+            }
+        }
+    }
+
+    // A pitched roof fanned out from the ridge point
+    const point3 apex(side / 2, storeys * height + side / 4, side / 2);
+    const int fan = 64;
+    const point3 corners[] = {point3(0, 0, 0), point3(side, 0, 0), point3(side, 0, side), point3(0, 0, side)};
+    for (int edge = 0; edge < 4; ++edge)
+    {
+        const auto from = corners[edge] + vec3(0, storeys * height, 0);
+        const auto step = (corners[(edge + 1) % 4] - corners[edge]) / fan;
+        for (int i = 0; i < fan; ++i)
+        {
+            const auto q = from + i * step;
+            list.add(arena.make<triangle>(q, step, apex - q, mat));
+        }
+    }
+}
+
+// Traversal cost of split_bvh with and without spatial splits, against bvh_node's median
+// object splits, on the building and on a bumpy-sphere stand-in for a scanned mesh
+void split_benchmark(int ray_count)
+{
+    scene_arena arena;
+    material_table materials(&arena);
+    auto white = materials.make_material<lambertian>(color(0.73, 0.73, 0.73));
+
+    hittable_list building;
+    add_building(building, 10, 10, arena, white);
+    hittable_list scanned;
+    add_bumpy_sphere(scanned, nullptr, 150, arena, white);
+
+    for (const auto& [name, list] : {std::pair{"building", &building}, std::pair{"scanned mesh", &scanned}})
+    {
+        const auto object_count = list->objects.size();
+
+        const auto arena_before = arena.bytes_used();
+        bvh_node tree(*list, &arena);
+        const auto tree_bytes = arena.bytes_used() - arena_before + sizeof(bvh_node);
+
+        split_bvh::settings object_only;
+        object_only.spatial_splits = false;
+        auto start = std::chrono::steady_clock::now();
+        split_bvh objects(*list, object_only);
+        const auto object_build = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        start = std::chrono::steady_clock::now();
+        split_bvh spatial(*list);
+        const auto spatial_build = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        const auto rays = random_rays(list->bounding_box(), ray_count);
+        hierarchy_timing results[] = {
+            {"bvh_node", tree_bytes, [&](const ray& r, interval t, hit_record& rec) { return tree.hit(r, t, rec); }},
+            {"object splits", objects.hierarchy_bytes(), [&](const ray& r, interval t, hit_record& rec) { return objects.hit(r, t, rec); }},
+            {"spatial splits", spatial.hierarchy_bytes(), [&](const ray& r, interval t, hit_record& rec) { return spatial.hit(r, t, rec); }},
+        };
+        time_hierarchies(rays, results);
+
+        std::println(std::clog, "{}: {} objects, {} rays", name, object_count, ray_count);
+        for (const auto& result : results)
+        {
+            std::println(std::clog, "  {:<14} {:>6.1f} bytes/object {:>6.2f} Mrays/s {:>6.1f} nodes/ray, {} hits, mean t {:.6f}",
+                result.name, double(result.bytes) / object_count, ray_count / result.seconds / 1e6,
+                double(result.visits) / ray_count, result.hits, result.hits ? result.distance / result.hits : 0.0);
+        }
+        for (const auto& [label, tree, seconds] : {std::tuple{"object splits", &objects, object_build},
+            std::tuple{"spatial splits", &spatial, spatial_build}})
+        {
+            std::println(std::clog, "  {:<14} SAH cost {:.1f}, {:.3f} references/object, {} spatial splits, built in {:.3f} s",
+                label, tree->sah_cost(), double(tree->reference_count()) / object_count, tree->spatial_split_count(), seconds);
+        }
+    }
+}
+
+// Traversal cost of uniform_grid against bvh_node and the batched sphere leaves of
+// primitive_groups, on final_scene's cluster of 1000 equal spheres and on the same cluster
+// with a dense clump of small spheres in one corner
+void grid_benchmark(int ray_count)
+{
+    scene_arena arena;
+    material_table materials(&arena);
+    auto white = materials.make_material<lambertian>(color(0.73, 0.73, 0.73));
+
+    hittable_list cluster;
+    auto cluster_groups = arena.make<primitive_groups>(&arena);
+    for (int j = 0; j < 1000; ++j)
+    {
+        const auto center = point3::random(0, 165);
+        cluster.add(arena.make<sphere>(center, 10, white));
+        cluster_groups->add(sphere(center, 10, white));
+    }
+    hittable_list clumped = cluster;
+    auto clumped_groups = arena.make<primitive_groups>(&arena);
+    for (const auto& object : cluster.objects)
+    {
+        clumped_groups->add(object);
+    }
+    for (int j = 0; j < 4000; ++j)
+    {
+        const auto center = point3::random(0, 20);
+        clumped.add(arena.make<sphere>(center, 0.5, white));
+        clumped_groups->add(sphere(center, 0.5, white));
+    }
+    cluster_groups->build();
+    clumped_groups->build();
+
+    for (const auto& [name, list, groups] : {std::tuple{"sphere cluster", &cluster, cluster_groups.get()},
+        std::tuple{"clumped cluster", &clumped, clumped_groups.get()}})
+    {
+        const auto object_count = list->objects.size();
+        const auto arena_before = arena.bytes_used();
+        bvh_node tree(*list, &arena);
+        const auto tree_bytes = arena.bytes_used() - arena_before + sizeof(bvh_node);
+        const auto start = std::chrono::steady_clock::now();
+        uniform_grid grid(*list);
+        const auto grid_build = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        const auto rays = random_rays(list->bounding_box(), ray_count);
+        hierarchy_timing results[] = {
+            {"bvh_node", tree_bytes, [&](const ray& r, interval t, hit_record& rec) { return tree.hit(r, t, rec); }},
+            {"sphere groups", 0, [&](const ray& r, interval t, hit_record& rec) { return groups->hit(r, t, rec); }},
+            {"uniform_grid", grid.grid_bytes(), [&](const ray& r, interval t, hit_record& rec) { return grid.hit(r, t, rec); }},
+        };
+        time_hierarchies(rays, results);
+
+        std::println(std::clog, "{}: {} objects, {} rays", name, object_count, ray_count);
+        for (const auto& result : results)
+        {
+            std::println(std::clog, "  {:<14} {:>6.2f} Mrays/s {:>6.1f} nodes or cells/ray, {} hits, mean t {:.6f}",
+                result.name, ray_count / result.seconds / 1e6, double(result.visits) / ray_count, result.hits,
+                result.hits ? result.distance / result.hits : 0.0);
+        }
+        std::println(std::clog, "  uniform_grid   {} cells, {} nested grids, {:.2f} entries/object, {:.1f} bytes/object, built in {:.4f} s",
+            grid.cell_count(), grid.nested_grid_count(), double(grid.reference_count()) / object_count,
+            double(grid.grid_bytes()) / object_count, grid_build);
+    }
+}
+
+// Time to first pixel and to a whole preview frame with lazy_bvh against a full bvh_node
+// build, over a 1M triangle bumpy sphere seen close up and whole. A preview pixel is one
+// camera ray and one diffuse bounce.
+void lazy_benchmark(int rings, int image_width)
+{
+    scene_arena arena;
+    material_table materials(&arena);
+    auto white = materials.make_material<lambertian>(color(0.73, 0.73, 0.73));
+    hittable_list list;
+    add_bumpy_sphere(list, nullptr, rings, arena, white);
+
+    const auto seconds_since = [](std::chrono::steady_clock::time_point start)
+    {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    };
+
+    struct view
+    {
+        const char* name;
+        point3 lookfrom;
+        double vfov;
+    };
+    for (const auto& v : {view{"close up", point3(50, 50, -5), 12}, view{"whole mesh", point3(50, 50, -150), 40}})
+    {
+        // Pinhole rays towards the mesh center, row by row
+        const auto half = std::tan(degrees_to_radians(v.vfov) / 2);
+        const auto w = unit_vector(v.lookfrom - point3(50, 50, 50));
+        const auto u = unit_vector(cross(vec3(0, 1, 0), w));
+        const auto up = cross(w, u);
+        const auto preview_pixel = [&](const hittable& world, int i, int j)
+        {
+            const auto x = (2 * (i + 0.5) / image_width - 1) * half;
+            const auto y = (1 - 2 * (j + 0.5) / image_width) * half;
+            hit_record rec;
+            if (world.hit(ray(v.lookfrom, x * u + y * up - w), interval(0.001, infinity), rec))
+            {
+                world.hit(ray(rec.p, rec.normal + random_unit_vector()), interval(0.001, infinity), rec);
+            }
+        };
+
+        std::println(std::clog, "{}: {} triangles, {}x{} preview", v.name, list.objects.size(), image_width, image_width);
+        for (int lazy = 0; lazy < 2; ++lazy)
+        {
+            const auto start = std::chrono::steady_clock::now();
+            std::unique_ptr<hittable> world;
+            if (lazy)
+            {
+                world = std::make_unique<lazy_bvh>(list);
+            }
+            else
+            {
+                world = std::make_unique<bvh_node>(list);
+            }
+            const auto built = seconds_since(start);
+            preview_pixel(*world, 0, 0);
+            const auto first_pixel = seconds_since(start);
+            for (int j = 0; j < image_width; ++j)
+            {
+                for (int i = j == 0 ? 1 : 0; i < image_width; ++i)
+                {
+                    preview_pixel(*world, i, j);
+                }
+            }
+            const auto frame = seconds_since(start);
+
+            std::println(std::clog, "  {:<9} built in {:.3f} s, first pixel at {:.3f} s, preview at {:.3f} s",
+                lazy ? "lazy_bvh" : "bvh_node", built, first_pixel, frame);
+            if (lazy)
+            {
+                auto& tree = static_cast<lazy_bvh&>(*world);
+                const auto used = tree.built_node_count();
+                const auto expand_start = std::chrono::steady_clock::now();
+                tree.expand_all();
+                std::println(std::clog, "  lazy_bvh  {} of {} nodes built ({:.1f}%), the rest in {:.3f} s",
+                    used, tree.built_node_count(), 100.0 * used / tree.built_node_count(), seconds_since(expand_start));
+            }
+        }
+    }
+}
+
+// Build a scene and render it to standard output, return whether the image was written
+bool render_scene(void (*build)(scene&))
+{
+    scene s;
+    build(s);
+    return s.cam.render(s.world, s.lights);
+}
+
+int main(int argc, char* argv[])
+{
+    // ray_tracer --serve [socket] [--output=<directory>] [scene files] keeps the scenes built and
+    // renders requests sent to the socket into the output directory, by default the current one
+    if (argc > 1 && std::string_view(argv[1]) == "--serve")
+    {
+        std::filesystem::path output_directory = ".";
+        std::vector<std::string_view> scene_files;
+        for (int i = 3; i < argc; ++i)
+        {
+            const std::string_view arg = argv[i];
+            if (arg.starts_with("--output="))
+            {
+                output_directory = arg.substr(9);
+            }
+            else
+            {
+                scene_files.push_back(arg);
+            }
+        }
+
+        render_service service(output_directory);
+        service.add_scene("cornell_box", cornell_box);
+        service.add_scene("cornell_box_glossy", cornell_box_glossy);
+        service.add_scene("cornell_cloud", cornell_cloud);
+        service.add_scene("cornell_voxels", cornell_voxels);
+        for (const auto filename : scene_files)
+        {
+            if (!service.add_scene_file(filename))
+            {
+                return 1;
+            }
+        }
+        return service.serve(argc > 2 ? argv[2] : "ray_tracer.sock") ? 0 : 1;
+    }
+
+    // ray_tracer --pack-mesh <obj file> <pack file> prepares a mesh for out-of-core rendering
+    if (argc == 4 && std::string_view(argv[1]) == "--pack-mesh")
+    {
+        std::vector<mesh_pack::triangle> triangles;
+        mesh_pack::packer packer;
+        return mesh_pack::read_obj(argv[2], triangles) && packer.write(argv[3], std::move(triangles)) ? 0 : 1;
+    }
+
+    // ray_tracer <scene file> renders the file to standard output
+    if (argc > 1)
+    {
+        scene s;
+        if (!load_scene_file(argv[1], s))
+        {
+            return 1;
+        }
+        const auto before = mesh_pack::paging_counters::now();
+        const bool rendered = s.cam.render(s.world, s.lights);
+        if (!s.meshes.empty())
+        {
+            print_paging_stats(s.meshes, mesh_pack::paging_counters::now() - before);
+        }
+        return rendered ? 0 : 1;
+    }
+
+    bool rendered = true;
     switch (10)
     {
         case 1: bouncing_spheres();  break;
@@ -450,11 +1143,18 @@ int main()
         case 4: perlin_spheres(); break;
         case 5: quads(); break;
         case 6: simple_light(); break;
-        case 7: cornell_box(); break;
+        case 7: rendered = render_scene(cornell_box); break;
         case 8: cornell_smoke(); break;
         case 9: final_scene(400, 250, 4); break;
-        case 10: cornell_box_glossy(); break;
+        case 10: rendered = render_scene(cornell_box_glossy); break;
+        case 11: rendered = render_scene(cornell_cloud); break;
+        case 12: rendered = render_scene(cornell_voxels); break;
+        case 13: cornell_animation(); break;
+        case 14: hierarchy_benchmark(500, 1000000); break;
+        case 15: split_benchmark(1000000); break;
+        case 16: grid_benchmark(1000000); break;
+        case 17: lazy_benchmark(500, 200); break;
     }
 
-    return 0;
+    return rendered ? 0 : 1;
 }
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <print>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Read only memory mapping of a whole file. Pages are read on first access, so opening a large
+// file costs next to nothing and only the parts that are used are ever loaded.
+class mapped_file
+{
+public:
+    mapped_file() = default;
+    mapped_file(const mapped_file&) = delete;
+    mapped_file& operator=(const mapped_file&) = delete;
+
+    ~mapped_file() { close(); }
+
+    bool open(const std::filesystem::path& filename)
+    {
+        close();
+        const int fd = ::open(filename.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            std::println(std::cerr, "ERROR: Could not open {}: {}", filename.string(), std::strerror(errno));
+            return false;
+        }
+
+        struct stat info;
+        if (::fstat(fd, &info) < 0 || info.st_size == 0)
+        {
+            std::println(std::cerr, "ERROR: Could not map empty or unreadable file {}", filename.string());
+            ::close(fd);
+            return false;
+        }
+
+        void* address = ::mmap(nullptr, size_t(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (address == MAP_FAILED)
+        {
+            std::println(std::cerr, "ERROR: Could not map {}: {}", filename.string(), std::strerror(errno));
+            return false;
+        }
+
+        bytes = static_cast<const std::byte*>(address);
+        length = size_t(info.st_size);
+        return true;
+    }
+
+    void close()
+    {
+        if (bytes)
+        {
+            ::munmap(const_cast<std::byte*>(bytes), length);
+            bytes = nullptr;
+            length = 0;
+        }
+    }
+
+    const std::byte* data() const { return bytes; }
+    size_t size() const { return length; }
+
+    // Bytes of the mapping in this process's resident set, from /proc/self/smaps. Unlike
+    // mincore, which reports the page cache, this drops when pages are released with advise.
+    size_t resident_bytes() const
+    {
+        char start[32];
+        const auto end = std::to_chars(start, start + sizeof(start), reinterpret_cast<uintptr_t>(bytes), 16).ptr;
+        const auto prefix = std::string(start, end) + "-";
+
+        std::ifstream smaps("/proc/self/smaps");
+        std::string line;
+        bool found = false;
+        while (std::getline(smaps, line))
+        {
+            if (!found)
+            {
+                found = line.starts_with(prefix);
+            }
+            else if (line.starts_with("Rss:"))
+            {
+                return size_t(std::strtoull(line.c_str() + 4, nullptr, 10)) * 1024;
+            }
+        }
+        return 0;
+    }
+
+    // Pass an madvise hint for the bytes [offset, offset + count), rounded out to whole pages
+    void advise(size_t offset, size_t count, int advice) const
+    {
+        const auto page_size = size_t(::sysconf(_SC_PAGESIZE));
+        const auto first = offset / page_size * page_size;
+        const auto end = std::min(length, offset + count);
+        if (bytes && first < end)
+        {
+            ::madvise(const_cast<std::byte*>(bytes) + first, end - first, advice);
+        }
+    }
+
+private:
+    const std::byte* bytes = nullptr;
+    size_t length = 0;
+};
@@ -0,0 +1,643 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <print>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <sys/mman.h>
+#include <sys/resource.h>
+
+#include "hittable.h"
+#include "mapped_file.h"
+
+// Packed triangle meshes for rendering out of core. A pack file holds a hierarchy over the
+// triangles that is traversed straight from a memory mapping, so only the pages rays actually
+// reach are ever read and the OS can drop them again under memory pressure.
+//
+// Layout: the header in the first page, then the nodes from the second page, then the
+// triangles page aligned after them. The nodes are cut into treelets that each fill the rest
+// of a page, top down in breadth first order, with the treelets below a treelet following it
+// depth first. A ray going down the hierarchy thus touches about one page per treelet level,
+// and the triangles are stored in the order their leaves appear, so the triangles of any
+// subtree share as few pages as possible.
+namespace mesh_pack
+{
+    constexpr size_t page_size = 4096;
+    constexpr uint32_t max_leaf_size = 4;
+    constexpr uint32_t leaf_bit = 0x80000000u;
+
+    // Inner nodes refer to their children by index in a and b. Leaves have leaf_bit set in b
+    // with the triangle count below it, and the first triangle in a.
+    struct node
+    {
+        float min[3];
+        float max[3];
+        uint32_t a = 0;
+        uint32_t b = 0;
+    };
+
+    struct triangle
+    {
+        float p[3][3];
+    };
+
+    struct header
+    {
+        char magic[4] = {'R', 'T', 'M', 'P'};
+        uint32_t version = 1;
+        uint64_t node_count = 0;
+        uint64_t triangle_count = 0;
+        uint64_t node_offset = 0;
+        uint64_t triangle_offset = 0;
+    };
+
+    inline vec3 vertex(const triangle& t, int i)
+    {
+        return vec3(t.p[i][0], t.p[i][1], t.p[i][2]);
+    }
+
+    // Read the triangles of a Wavefront OBJ file, keeping only vertex positions and fanning
+    // faces with more than three corners
+    inline bool read_obj(const std::filesystem::path& filename, std::vector<triangle>& triangles)
+    {
+        std::ifstream in(filename);
+        if (!in)
+        {
+            std::println(std::cerr, "ERROR: Could not open {}", filename.string());
+            return false;
+        }
+
+        std::vector<vec3> vertices;
+        std::string line;
+        int line_number = 0;
+        while (std::getline(in, line))
+        {
+            ++line_number;
+            std::istringstream words(line);
+            std::string keyword;
+            words >> keyword;
+            if (keyword == "v")
+            {
+                double x, y, z;
+                if (!(words >> x >> y >> z))
+                {
+                    std::println(std::cerr, "ERROR: {}:{}: Bad vertex", filename.string(), line_number);
+                    return false;
+                }
+                vertices.emplace_back(x, y, z);
+            }
+            else if (keyword == "f")
+            {
+                std::vector<size_t> corners;
+                std::string corner;
+                while (words >> corner)
+                {
+                    // v, v/vt, v//vn or v/vt/vn, negative indices count back from the last vertex
+                    const long index = std::strtol(corner.c_str(), nullptr, 10);
+                    const long resolved = index < 0 ? long(vertices.size()) + index : index - 1;
+                    if (index == 0 || resolved < 0 || resolved >= long(vertices.size()))
+                    {
+                        std::println(std::cerr, "ERROR: {}:{}: Bad face index {}", filename.string(), line_number, corner);
+                        return false;
+                    }
+                    corners.push_back(size_t(resolved));
+                }
+                for (size_t i = 2; i < corners.size(); ++i)
+                {
+                    triangle t;
+                    const vec3* p[3] = {&vertices[corners[0]], &vertices[corners[i - 1]], &vertices[corners[i]]};
+                    for (int k = 0; k < 3; ++k)
+                    {
+                        for (int axis = 0; axis < 3; ++axis)
+                        {
+                            t.p[k][axis] = float((*p[k])[axis]);
+                        }
+                    }
+                    triangles.push_back(t);
+                }
+            }
+        }
+        return true;
+    }
+
+    // Builds the hierarchy in memory and writes it in the paged layout
+    class packer
+    {
+    public:
+        bool write(const std::filesystem::path& filename, std::vector<triangle> input)
+        {
+            if (input.empty())
+            {
+                std::println(std::cerr, "ERROR: No triangles to pack into {}", filename.string());
+                return false;
+            }
+
+            triangles = std::move(input);
+            order.resize(triangles.size());
+            for (uint32_t i = 0; i < order.size(); ++i)
+            {
+                order[i] = i;
+            }
+            built.clear();
+            build(0, uint32_t(triangles.size()));
+            lay_out();
+
+            header h;
+            h.node_count = placed.size();
+            h.triangle_count = triangles.size();
+            h.node_offset = page_size;
+            h.triangle_offset = (h.node_offset + placed.size() * sizeof(node) + page_size - 1) / page_size * page_size;
+
+            auto partial = filename;
+            partial += ".partial";
+            {
+                std::ofstream out(partial, std::ios::binary | std::ios::trunc);
+                const auto pad_to = [&](uint64_t offset)
+                {
+                    static const char zeros[page_size] = {};
+                    out.write(zeros, std::streamsize(offset - uint64_t(out.tellp())));
+                };
+                out.write(reinterpret_cast<const char*>(&h), sizeof(h));
+                pad_to(h.node_offset);
+                out.write(reinterpret_cast<const char*>(placed.data()), std::streamsize(placed.size() * sizeof(node)));
+                pad_to(h.triangle_offset);
+                for (const auto index : leaf_triangles)
+                {
+                    out.write(reinterpret_cast<const char*>(&triangles[index]), sizeof(triangle));
+                }
+                if (!out.flush())
+                {
+                    std::println(std::cerr, "ERROR: Could not write {}", partial.string());
+                    return false;
+                }
+            }
+
+            std::error_code error;
+            std::filesystem::rename(partial, filename, error);
+            if (error)
+            {
+                std::println(std::cerr, "ERROR: Could not replace {}: {}", filename.string(), error.message());
+                return false;
+            }
+            std::println(std::clog, "Packed {} triangles and {} nodes into {}", triangles.size(), placed.size(),
+                filename.string());
+            return true;
+        }
+
+    private:
+        struct build_node
+        {
+            aabb bbox;
+            uint32_t left = 0; // Children for inner nodes
+            uint32_t right = 0;
+            uint32_t first = 0; // Range of order for leaves
+            uint32_t count = 0;
+        };
+
+        aabb bounds(const triangle& t) const
+        {
+            return aabb(aabb(vertex(t, 0), vertex(t, 1)), aabb(vertex(t, 0), vertex(t, 2)));
+        }
+
+        // Median split along the longest axis of the centroid bounds
+        uint32_t build(uint32_t start, uint32_t end)
+        {
+            const auto index = uint32_t(built.size());
+            built.emplace_back();
+
+            aabb bbox = aabb::empty;
+            aabb centroids = aabb::empty;
+            for (auto i = start; i < end; ++i)
+            {
+                const auto& t = triangles[order[i]];
+                bbox = aabb(bbox, bounds(t));
+                const auto c = (vertex(t, 0) + vertex(t, 1) + vertex(t, 2)) / 3;
+                centroids = aabb(centroids, aabb(c, c));
+            }
+
+            if (end - start <= max_leaf_size)
+            {
+                built[index] = build_node{bbox, 0, 0, start, end - start};
+                return index;
+            }
+
+            const auto axis = centroids.longest_axis();
+            const auto mid = start + (end - start) / 2;
+            std::nth_element(order.begin() + start, order.begin() + mid, order.begin() + end, [&](uint32_t a, uint32_t b)
+            {
+                const auto& ta = triangles[a];
+                const auto& tb = triangles[b];
+                return ta.p[0][axis] + ta.p[1][axis] + ta.p[2][axis] < tb.p[0][axis] + tb.p[1][axis] + tb.p[2][axis];
+            });
+
+            const auto left = build(start, mid);
+            const auto right = build(mid, end);
+            built[index] = build_node{bbox, left, right, 0, 0};
+            return index;
+        }
+
+        // Place the nodes treelet by treelet, each filling the rest of its page breadth first
+        void lay_out()
+        {
+            constexpr size_t nodes_per_page = page_size / sizeof(node);
+            std::vector<uint32_t> position(built.size());
+            std::vector<uint32_t> sequence; // Built node indices in file order
+            std::vector<uint32_t> treelets{0};
+            while (!treelets.empty())
+            {
+                const auto root = treelets.back();
+                treelets.pop_back();
+
+                const auto room = nodes_per_page - sequence.size() % nodes_per_page;
+                std::vector<uint32_t> level{root};
+                std::vector<uint32_t> frontier; // Children left for later treelets
+                for (size_t i = 0; i < level.size(); ++i)
+                {
+                    const auto n = level[i];
+                    position[n] = uint32_t(sequence.size());
+                    sequence.push_back(n);
+                    if (built[n].count > 0)
+                    {
+                        continue;
+                    }
+                    for (const auto child : {built[n].left, built[n].right})
+                    {
+                        if (level.size() < room)
+                        {
+                            level.push_back(child);
+                        }
+                        else
+                        {
+                            frontier.push_back(child);
+                        }
+                    }
+                }
+                // Depth first over the subtrees below, the leftmost first
+                treelets.insert(treelets.end(), frontier.rbegin(), frontier.rend());
+            }
+
+            placed.resize(sequence.size());
+            leaf_triangles.clear();
+            leaf_triangles.reserve(triangles.size());
+            for (size_t i = 0; i < sequence.size(); ++i)
+            {
+                const auto& n = built[sequence[i]];
+                auto& out = placed[i];
+                for (int axis = 0; axis < 3; ++axis)
+                {
+                    // Rounded outwards, so the float box still encloses the triangles
+                    const auto& range = n.bbox.axis_interval(axis);
+                    out.min[axis] = std::nextafter(float(range.min), -std::numeric_limits<float>::infinity());
+                    out.max[axis] = std::nextafter(float(range.max), std::numeric_limits<float>::infinity());
+                }
+                if (n.count > 0)
+                {
+                    out.a = uint32_t(leaf_triangles.size());
+                    out.b = n.count | leaf_bit;
+                    leaf_triangles.insert(leaf_triangles.end(), order.begin() + n.first, order.begin() + n.first + n.count);
+                }
+                else
+                {
+                    out.a = position[n.left];
+                    out.b = position[n.right];
+                }
+            }
+        }
+
+        std::vector<triangle> triangles;
+        std::vector<uint32_t> order;
+        std::vector<build_node> built;
+        std::vector<node> placed;
+        std::vector<uint32_t> leaf_triangles; // Triangle indices in file order
+    };
+
+    // Page faults and reads of the whole process, from getrusage
+    struct paging_counters
+    {
+        long minor_faults = 0;
+        long major_faults = 0;
+        long blocks_read = 0;
+
+        static paging_counters now()
+        {
+            rusage usage{};
+            ::getrusage(RUSAGE_SELF, &usage);
+            return {usage.ru_minflt, usage.ru_majflt, usage.ru_inblock};
+        }
+
+        paging_counters operator-(const paging_counters& other) const
+        {
+            return {minor_faults - other.minor_faults, major_faults - other.major_faults, blocks_read - other.blocks_read};
+        }
+    };
+}
+
+// A packed mesh traversed in place from its mapping, with one material for all triangles.
+// With a resident budget the mapped pages in memory are kept under that many bytes. Traversal
+// marks the 64 KiB chunks it reads as present and referenced, which matches the 64 KiB the
+// kernel maps around a fault, so the present chunks count what is resident. The thread that
+// takes the count over the budget evicts in clock order: the hand clears referenced marks and
+// drops the pages of present chunks not referenced again since its last pass. The first chunk,
+// holding the header and the top treelets, is never dropped.
+class mapped_mesh final : public hittable
+{
+public:
+    mapped_mesh(const material* mat, size_t resident_budget = 0)
+        : mat(mat)
+        , budget(resident_budget)
+    {
+    }
+
+    mapped_mesh(const mapped_mesh&) = delete;
+    mapped_mesh& operator=(const mapped_mesh&) = delete;
+
+    bool open(const std::filesystem::path& filename)
+    {
+        if (!file.open(filename))
+        {
+            return false;
+        }
+
+        const auto invalid = [&](const char* what)
+        {
+            std::println(std::cerr, "ERROR: {} is not a valid mesh pack: {}", filename.string(), what);
+            file.close();
+            return false;
+        };
+        if (file.size() < sizeof(mesh_pack::header))
+        {
+            return invalid("too short");
+        }
+        const auto& h = *reinterpret_cast<const mesh_pack::header*>(file.data());
+        if (std::string_view(h.magic, 4) != "RTMP" || h.version != 1)
+        {
+            return invalid("wrong magic or version");
+        }
+        if (h.node_count == 0 || h.node_count > UINT32_MAX || h.triangle_count > UINT32_MAX
+            || h.node_offset % alignof(mesh_pack::node) != 0 || h.triangle_offset % alignof(mesh_pack::triangle) != 0
+            || h.node_offset > file.size() || h.node_count > (file.size() - h.node_offset) / sizeof(mesh_pack::node)
+            || h.triangle_offset > file.size()
+            || h.triangle_count > (file.size() - h.triangle_offset) / sizeof(mesh_pack::triangle))
+        {
+            return invalid("sections out of bounds");
+        }
+        nodes = reinterpret_cast<const mesh_pack::node*>(file.data() + h.node_offset);
+        triangles = reinterpret_cast<const mesh_pack::triangle*>(file.data() + h.triangle_offset);
+        node_count = uint32_t(h.node_count);
+        triangle_count = uint32_t(h.triangle_count);
+
+        // Checking every node would read the whole file. Traversal instead checks child and
+        // triangle indices as it goes and skips any that are out of range.
+        const auto& root = nodes[0];
+        bbox = aabb(point3(root.min[0], root.min[1], root.min[2]), point3(root.max[0], root.max[1], root.max[2]));
+
+        // Readahead would mostly bring in pages of subtrees no ray enters
+        file.advise(0, file.size(), MADV_RANDOM);
+
+        if (budget > 0)
+        {
+            chunk_count = (file.size() + chunk_size - 1) / chunk_size;
+            chunks = std::make_unique<std::atomic<uint8_t>[]>(chunk_count);
+        }
+        return true;
+    }
+
+    aabb bounding_box() const override { return bbox; }
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override
+    {
+        const auto& o = r.origin();
+        const auto& d = r.direction();
+        const double inverse[3] = {1.0 / d.x(), 1.0 / d.y(), 1.0 / d.z()};
+
+        uint32_t stack[64];
+        int stack_size = 0;
+        stack[stack_size++] = 0;
+        uint32_t closest = UINT32_MAX;
+        double closest_u = 0;
+        double closest_v = 0;
+
+        while (stack_size > 0)
+        {
+            const auto index = stack[--stack_size];
+            const auto& n = nodes[index];
+            mark(&n);
+            count_node_visit();
+
+            // Same slab test as aabb::hit on the float bounds
+            auto t_min = ray_t.min;
+            auto t_max = ray_t.max;
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                const auto t0 = (n.min[axis] - o[axis]) * inverse[axis];
+                const auto t1 = (n.max[axis] - o[axis]) * inverse[axis];
+                t_min = std::max(t_min, std::min(t0, t1));
+                t_max = std::min(t_max, std::max(t0, t1));
+            }
+            if (t_max <= t_min)
+            {
+                continue;
+            }
+
+            if (n.b & mesh_pack::leaf_bit)
+            {
+                const auto count = n.b & ~mesh_pack::leaf_bit;
+                if (n.a > triangle_count || count > triangle_count - n.a)
+                {
+                    continue;
+                }
+                for (auto i = n.a; i < n.a + count; ++i)
+                {
+                    mark(&triangles[i]);
+                    if (intersect(triangles[i], r, ray_t, closest_u, closest_v))
+                    {
+                        closest = i;
+                    }
+                }
+                continue;
+            }
+
+            // Left child on top, so it is visited first. Children always follow their parent,
+            // which keeps a damaged file from sending traversal round in circles.
+            if (n.a > index && n.b > index && n.a < node_count && n.b < node_count && stack_size + 2 <= 64)
+            {
+                stack[stack_size++] = n.b;
+                stack[stack_size++] = n.a;
+            }
+        }
+
+        if (closest == UINT32_MAX)
+        {
+            return false;
+        }
+        const auto& t = triangles[closest];
+        const auto p0 = mesh_pack::vertex(t, 0);
+        rec.t = ray_t.max;
+        rec.p = r.at(rec.t);
+        rec.u = closest_u;
+        rec.v = closest_v;
+        rec.mat = mat;
+        rec.set_face_normal(r, unit_vector(cross(mesh_pack::vertex(t, 1) - p0, mesh_pack::vertex(t, 2) - p0)));
+        return true;
+    }
+
+    // Paging behaviour of this mesh since it was opened
+    struct paging_statistics
+    {
+        size_t file_bytes = 0;
+        size_t resident_bytes = 0;
+        size_t peak_resident_bytes = 0; // Most chunks present at once, only counted with a budget
+        size_t evicted_bytes = 0;
+    };
+
+    paging_statistics statistics() const
+    {
+        paging_statistics stats;
+        stats.file_bytes = file.size();
+        stats.resident_bytes = file.resident_bytes();
+        stats.peak_resident_bytes = std::max(peak_present.load() * chunk_size, stats.resident_bytes);
+        stats.evicted_bytes = evicted_chunks.load() * chunk_size;
+        return stats;
+    }
+
+    size_t resident_budget() const { return budget; }
+
+private:
+    static constexpr size_t chunk_size = size_t(64) << 10;
+
+    // Moller-Trumbore, on success narrowing ray_t.max to the hit
+    static bool intersect(const mesh_pack::triangle& t, const ray& r, interval& ray_t, double& u, double& v)
+    {
+        const auto p0 = mesh_pack::vertex(t, 0);
+        const auto e1 = mesh_pack::vertex(t, 1) - p0;
+        const auto e2 = mesh_pack::vertex(t, 2) - p0;
+        const auto pvec = cross(r.direction(), e2);
+        const auto det = dot(e1, pvec);
+        if (std::fabs(det) < 1e-12)
+        {
+            return false;
+        }
+        const auto inverse = 1.0 / det;
+        const auto tvec = r.origin() - p0;
+        const auto a = dot(tvec, pvec) * inverse;
+        if (a < 0 || a > 1)
+        {
+            return false;
+        }
+        const auto qvec = cross(tvec, e1);
+        const auto b = dot(r.direction(), qvec) * inverse;
+        if (b < 0 || a + b > 1)
+        {
+            return false;
+        }
+        const auto distance = dot(e2, qvec) * inverse;
+        if (!ray_t.surrounds(distance))
+        {
+            return false;
+        }
+        ray_t.max = distance;
+        u = a;
+        v = b;
+        return true;
+    }
+
+    static constexpr uint8_t present = 1;
+    static constexpr uint8_t referenced = 2;
+
+    // Note a read for the clock, writing only when the marks are not already set
+    void mark(const void* address) const
+    {
+        if (!chunks)
+        {
+            return;
+        }
+        const auto chunk = size_t(static_cast<const std::byte*>(address) - file.data()) / chunk_size;
+        if (chunks[chunk].load(std::memory_order_relaxed) == (present | referenced))
+        {
+            return;
+        }
+        if (chunks[chunk].fetch_or(present | referenced, std::memory_order_relaxed) & present)
+        {
+            return;
+        }
+
+        const auto count = present_chunks.fetch_add(1, std::memory_order_relaxed) + 1;
+        auto peak = peak_present.load(std::memory_order_relaxed);
+        while (count > peak && !peak_present.compare_exchange_weak(peak, count, std::memory_order_relaxed))
+        {
+        }
+        if (count * chunk_size > budget)
+        {
+            // One thread evicts at a time, the others carry on over budget for that long
+            std::unique_lock lock(clock_mutex, std::try_to_lock);
+            if (lock)
+            {
+                evict();
+            }
+        }
+    }
+
+    // Run the clock hand until the present chunks fit the budget again
+    void evict() const
+    {
+        for (size_t step = 0; present_chunks.load(std::memory_order_relaxed) * chunk_size > budget
+            && chunk_count > 1 && step < 2 * chunk_count; ++step)
+        {
+            const auto chunk = hand;
+            hand = hand + 1 < chunk_count ? hand + 1 : 1;
+            auto state = chunks[chunk].load(std::memory_order_relaxed);
+            if (state & referenced)
+            {
+                chunks[chunk].fetch_and(present, std::memory_order_relaxed);
+            }
+            else if ((state & present) && chunks[chunk].compare_exchange_strong(state, 0, std::memory_order_relaxed))
+            {
+                file.advise(chunk * chunk_size, chunk_size, MADV_DONTNEED);
+                present_chunks.fetch_sub(1, std::memory_order_relaxed);
+                evicted_chunks.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+    }
+
+    mapped_file file;
+    const mesh_pack::node* nodes = nullptr;
+    const mesh_pack::triangle* triangles = nullptr;
+    uint32_t node_count = 0;
+    uint32_t triangle_count = 0;
+    const material* mat;
+    aabb bbox;
+
+    size_t budget;
+    size_t chunk_count = 0;
+    std::unique_ptr<std::atomic<uint8_t>[]> chunks; // Clock marks, with a budget
+    mutable std::mutex clock_mutex;
+    mutable size_t hand = 1;
+    mutable std::atomic<size_t> present_chunks = 0;
+    mutable std::atomic<size_t> peak_present = 0;
+    mutable std::atomic<size_t> evicted_chunks = 0;
+};
+
+// Print the paging of the meshes and the page faults and reads of the process during a render
+inline void print_paging_stats(const std::vector<const mapped_mesh*>& meshes, const mesh_pack::paging_counters& during)
+{
+    constexpr double mib = 1024.0 * 1024.0;
+    for (const auto* mesh : meshes)
+    {
+        const auto stats = mesh->statistics();
+        std::println(std::clog, "Mapped mesh: {:.1f} MiB file, {:.1f} MiB resident, peak {:.1f} MiB, budget {:.1f} MiB, "
+            "{:.1f} MiB evicted", stats.file_bytes / mib, stats.resident_bytes / mib, stats.peak_resident_bytes / mib,
+            mesh->resident_budget() / mib, stats.evicted_bytes / mib);
+    }
+    std::println(std::clog, "Paging: {} minor faults, {} major faults, {} blocks read", during.minor_faults,
+        during.major_faults, during.blocks_read);
+}
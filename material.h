@@ -13,11 +13,25 @@ struct scatter_record
     ray skip_pdf_ray;
 };
 
+// Tags for the built-in materials, used like texture_kind (see texture.h)
+enum class material_kind
+{
+    custom,
+    lambertian,
+    metal,
+    dielectric,
+    diffuse_light,
+    isotropic,
+    glossy
+};
+
 class material
 {
 public:
     virtual ~material() = default;
 
+    material_kind kind() const { return tag; }
+
     virtual color emitted(const ray& r_in, const hit_record& rec, double u, double v, const point3& p) const
     {
         return color(0, 0, 0);
@@ -32,23 +46,32 @@ public:
     {
         return 0;
     }
+
+protected:
+    material() = default;
+    explicit material(material_kind kind) : tag(kind) {}
+
+private:
+    material_kind tag = material_kind::custom;
 };
 
-class lambertian : public material
+class lambertian final : public material
 {
 public:
     lambertian(const color& albedo)
-        : tex(std::make_shared<solid_color>(albedo))
+        : material(material_kind::lambertian)
+        , albedo(albedo)
     {
     }
-    lambertian(std::shared_ptr<texture> tex) 
-        : tex(tex)
+    lambertian(const texture* tex) 
+        : material(material_kind::lambertian)
+        , tex(tex)
     {
     }
 
     bool scatter(const ray& r_in, const hit_record& rec, scatter_record& srec) const override
     {
-        srec.attenuation = tex->value(rec.u, rec.v, rec.p);
+        srec.attenuation = tex ? texture_value(*tex, rec.u, rec.v, rec.p) : albedo;
         srec.pdf_ptr = std::make_shared<cosine_pdf>(rec.normal);
         srec.skip_pdf = false;
         return true;
@@ -61,16 +84,18 @@ public:
     }
 
 private:
-    std::shared_ptr<texture> tex; // Tex (Albedo) is used to define some form of fractional reflectance
+    color albedo; // Used when constructed from a plain color, without a texture
+    const texture* tex = nullptr; // Tex (Albedo) is used to define some form of fractional reflectance
 };
 
-class metal : public material
+class metal final : public material
 {
 public:
     // We randomize the reflected direction by using a small sphere centered around the original endpoint
     // and choosing a new endpoint for the ray. fuzz is equal to the radius of the additional sphere.
     metal(const color& albedo, double fuzz)
-        : albedo(albedo)
+        : material(material_kind::metal)
+        , albedo(albedo)
         , fuzz(fuzz < 1 ? fuzz : 1)
     {
 
@@ -94,11 +119,11 @@ private:
     double fuzz;
 };
 
-class dielectric : public material
+class dielectric final : public material
 {
 public:
     // A dielectic material that only refracts (when possible)
-    dielectric(double refraction_index) : refraction_index(refraction_index) {}
+    dielectric(double refraction_index) : material(material_kind::dielectric), refraction_index(refraction_index) {}
 
     bool scatter(const ray& r_in, const hit_record& rec, scatter_record& srec) const override
     {
@@ -142,11 +167,11 @@ private:
     double refraction_index;
 };
 
-class diffuse_light : public material
+class diffuse_light final : public material
 {
 public:
-    diffuse_light(std::shared_ptr<texture> tex) : tex(tex) {}
-    diffuse_light(const color& emit) : tex(std::make_shared<solid_color>(emit)) {}
+    diffuse_light(const texture* tex) : material(material_kind::diffuse_light), tex(tex) {}
+    diffuse_light(const color& emit) : material(material_kind::diffuse_light), emit(emit) {}
 
     color emitted(const ray& r_in, const hit_record& rec, double u, double v, const point3& p) const override
     {
@@ -154,22 +179,23 @@ public:
         {
             return color(0, 0, 0);
         }
-        return tex->value(u, v, p);
+        return tex ? texture_value(*tex, u, v, p) : emit;
     }
 
 private:
-    std::shared_ptr<texture> tex;
+    color emit;
+    const texture* tex = nullptr;
 };
 
-class isotropic : public material
+class isotropic final : public material
 {
 public:
-    isotropic(const color& albedo) : tex(std::make_shared<solid_color>(albedo)) {}
-    isotropic(std::shared_ptr<texture> tex) : tex(tex) {}
+    isotropic(const color& albedo) : material(material_kind::isotropic), albedo(albedo) {}
+    isotropic(const texture* tex) : material(material_kind::isotropic), tex(tex) {}
     // The scattering function of isotropic picks a uniform random direction
     bool scatter(const ray& r_in, const hit_record& rec, scatter_record& srec) const override
     {
-        srec.attenuation = tex->value(rec.u, rec.v, rec.p);
+        srec.attenuation = tex ? texture_value(*tex, rec.u, rec.v, rec.p) : albedo;
         srec.pdf_ptr = std::make_shared<sphere_pdf>();
         srec.skip_pdf = false;
         return true;
@@ -181,15 +207,17 @@ public:
     }
 
 private:
-    std::shared_ptr<texture> tex;
+    color albedo;
+    const texture* tex = nullptr;
 };
 
 // Modified Phong reflectance model for glossy materials
-class glossy : public material
+class glossy final : public material
 {
 public:
     glossy(const color& albedo, double exponent)
-        : albedo(albedo)
+        : material(material_kind::glossy)
+        , albedo(albedo)
         , n(exponent)
     {
     }
@@ -214,4 +242,21 @@ public:
 private:
     color albedo;
     double n;
-};
\ No newline at end of file
+};
+
+// Call f with the material downcast to its concrete built-in type, or with the base class
+// for custom materials, as visit_texture does for textures
+template<typename F>
+decltype(auto) visit_material(const material& mat, F&& f)
+{
+    switch (mat.kind())
+    {
+        case material_kind::lambertian: return f(static_cast<const lambertian&>(mat));
+        case material_kind::metal: return f(static_cast<const metal&>(mat));
+        case material_kind::dielectric: return f(static_cast<const dielectric&>(mat));
+        case material_kind::diffuse_light: return f(static_cast<const diffuse_light&>(mat));
+        case material_kind::isotropic: return f(static_cast<const isotropic&>(mat));
+        case material_kind::glossy: return f(static_cast<const glossy&>(mat));
+        default: return f(mat);
+    }
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "material.h"
+#include "scene_arena.h"
+#include "texture.h"
+
+// Scene-owned storage for materials and textures. Primitives, hit records and materials only
+// keep raw handles into the table, so the hot intersection path never touches a reference count.
+// The table must outlive every object that holds one of its handles. When given an arena the
+// entries are allocated from it, next to the primitives that use them.
+class material_table
+{
+public:
+    explicit material_table(scene_arena* arena = nullptr) : arena(arena) {}
+    material_table(const material_table&) = delete;
+    material_table& operator=(const material_table&) = delete;
+
+    template<typename T, typename... Args>
+    const T* make_material(Args&&... args)
+    {
+        auto mat = make_scene_object<T>(arena, std::forward<Args>(args)...);
+        const T* handle = mat.get();
+        materials.push_back(std::move(mat));
+        return handle;
+    }
+
+    template<typename T, typename... Args>
+    const T* make_texture(Args&&... args)
+    {
+        auto tex = make_scene_object<T>(arena, std::forward<Args>(args)...);
+        const T* handle = tex.get();
+        textures.push_back(std::move(tex));
+        return handle;
+    }
+
+    // Drop every entry. Handles into the table must not be used afterwards.
+    void clear()
+    {
+        materials.clear();
+        textures.clear();
+    }
+
+    size_t material_count() const { return materials.size(); }
+    size_t texture_count() const { return textures.size(); }
+
+private:
+    scene_arena* arena;
+    std::vector<std::shared_ptr<material>> materials;
+    std::vector<std::shared_ptr<texture>> textures;
+};
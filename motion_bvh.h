@@ -0,0 +1,667 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <memory>
+#include <numeric>
+#include <vector>
+
+#include "hittable.h"
+#include "hittable_list.h"
+
+// Translates an object along a piecewise linear path over the shutter interval. The offsets
+// are keyframes at the uniform times i / (offsets.size() - 1), so a path with n keyframes is a
+// motion with n - 1 linear segments.
+class motion_path : public hittable
+{
+public:
+    motion_path(std::shared_ptr<hittable> object, std::vector<vec3> offsets)
+        : object(object)
+        , offsets(std::move(offsets))
+    {
+        if (this->offsets.empty())
+        {
+            this->offsets.push_back(vec3(0, 0, 0));
+        }
+
+        // Each path segment sweeps the object bounds between its two keyframes
+        bbox = aabb::empty;
+        for (const auto& offset : this->offsets)
+        {
+            bbox = aabb(bbox, object->bounding_box() + offset);
+        }
+    }
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override
+    {
+        const auto offset = offset_at(r.time());
+        ray offset_r(r.origin() - offset, r.direction(), r.time());
+        if (!object->hit(offset_r, ray_t, rec))
+        {
+            return false;
+        }
+        rec.p += offset;
+        return true;
+    }
+
+    aabb bounding_box() const override { return bbox; }
+
+    int motion_segments() const override
+    {
+        const auto path_segments = int(offsets.size()) - 1;
+        const auto object_segments = object->motion_segments();
+        if (object_segments == 0 || path_segments == 0)
+        {
+            return std::max(path_segments, object_segments);
+        }
+        return std::lcm(path_segments, object_segments);
+    }
+
+    aabb bounding_box_at(double time) const override
+    {
+        return object->bounding_box_at(time) + offset_at(time);
+    }
+
+    vec3 offset_at(double time) const
+    {
+        if (offsets.size() == 1)
+        {
+            return offsets[0];
+        }
+
+        const auto segments = offsets.size() - 1;
+        const auto scaled = std::clamp(time, 0.0, 1.0) * segments;
+        const auto segment = std::min(size_t(scaled), segments - 1);
+        const auto f = scaled - segment;
+        return (1 - f) * offsets[segment] + f * offsets[segment + 1];
+    }
+
+private:
+    std::shared_ptr<hittable> object;
+    std::vector<vec3> offsets;
+    aabb bbox;
+};
+
+// A bounding volume hierarchy for motion blurred scenes. Every node stores its bounds at
+// time_keys evenly spaced times over the shutter interval and a ray tests the bounds
+// interpolated to its own time. Moving objects then cost about as much as static ones instead
+// of being bounded by the box swept over their whole motion.
+//
+// The bounds are exact for objects whose motion segments line up with the node keys. Objects
+// with more or misaligned segments fall back to their swept bounds at every key.
+class motion_bvh : public hittable
+{
+public:
+    static constexpr uint32_t max_leaf_size = 2;
+    static constexpr int max_segments = 8;
+    static constexpr int max_depth = 60; // Keeps the traversal stack in bounds
+
+    // segments == 0 picks the largest segment count of the objects, up to max_segments
+    motion_bvh(const hittable_list& list, int segments = 0)
+        : objects(list.objects)
+    {
+        if (segments <= 0)
+        {
+            for (const auto& object : objects)
+            {
+                segments = std::max(segments, object->motion_segments());
+            }
+        }
+        segments = std::clamp(segments, 0, max_segments);
+        time_keys = segments + 1;
+
+        build();
+    }
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override
+    {
+        if (nodes.empty())
+        {
+            return false;
+        }
+
+        // Key interval and interpolation weight of the ray time
+        size_t key = 0;
+        double f = 0;
+        if (time_keys > 1)
+        {
+            const auto scaled = std::clamp(r.time(), 0.0, 1.0) * (time_keys - 1);
+            key = std::min(size_t(scaled), size_t(time_keys - 2));
+            f = scaled - key;
+        }
+
+        const double origin[3] = {r.origin().x(), r.origin().y(), r.origin().z()};
+        const double inv_dir[3] = {1.0 / r.direction().x(), 1.0 / r.direction().y(), 1.0 / r.direction().z()};
+        const bool negative[3] = {inv_dir[0] < 0, inv_dir[1] < 0, inv_dir[2] < 0};
+
+        // Every level leaves at most one sibling behind, and max_depth bounds the levels
+        uint32_t stack[64];
+        int stack_size = 0;
+        stack[stack_size++] = 0;
+        bool hit_anything = false;
+
+        while (stack_size > 0)
+        {
+            const auto node_index = stack[--stack_size];
+            const auto& n = nodes[node_index];
+            count_node_visit();
+            if (!hit_bounds(node_index, key, f, origin, inv_dir, ray_t))
+            {
+                continue;
+            }
+
+            if (n.count > 0)
+            {
+                for (uint32_t i = n.first; i < n.first + n.count; ++i)
+                {
+                    if (objects[i]->hit(r, ray_t, rec))
+                    {
+                        hit_anything = true;
+                        ray_t.max = rec.t;
+                    }
+                }
+            }
+            else
+            {
+                // Visit the child nearer along the split axis first, so the closest hit found
+                // there culls the far child
+                if (negative[n.axis])
+                {
+                    stack[stack_size++] = node_index + 1;
+                    stack[stack_size++] = n.first;
+                }
+                else
+                {
+                    stack[stack_size++] = n.first;
+                    stack[stack_size++] = node_index + 1;
+                }
+            }
+        }
+
+        return hit_anything;
+    }
+
+    aabb bounding_box() const override { return bbox; }
+
+    int motion_segments() const override { return time_keys - 1; }
+
+    aabb bounding_box_at(double time) const override
+    {
+        if (nodes.empty() || time_keys == 1)
+        {
+            return bbox;
+        }
+
+        const auto scaled = std::clamp(time, 0.0, 1.0) * (time_keys - 1);
+        const auto key = std::min(size_t(scaled), size_t(time_keys - 2));
+        return bounds_at(0, key, scaled - key);
+    }
+
+    size_t node_count() const { return nodes.size(); }
+    int key_count() const { return time_keys; }
+
+    struct refit_stats
+    {
+        size_t refit_nodes = 0;
+        size_t rebuilt_subtrees = 0;
+        size_t rebuilt_objects = 0;
+    };
+
+    // Update the hierarchy after objects moved without being added or removed. All node bounds
+    // are recomputed bottom-up keeping the topology. Then the largest subtrees whose cost grew
+    // past rebuild_threshold times their cost at build time are rebuilt from scratch. The cost
+    // of a subtree is the keyed bounds area summed over its nodes, weighted by the object count
+    // in leaves, so it also catches inner nodes inflated by a few far moving objects.
+    // A threshold of 0 only refits.
+    refit_stats refit(double rebuild_threshold = 1.5)
+    {
+        refit_stats stats;
+        if (nodes.empty())
+        {
+            return stats;
+        }
+
+        refit_bounds();
+        stats.refit_nodes = nodes.size();
+        if (rebuild_threshold <= 0 || !degraded_below(0, rebuild_threshold))
+        {
+            return stats;
+        }
+
+        // Copy the tree in depth-first order, replacing degraded subtrees with fresh ones. A
+        // rebuilt subtree covers the same objects, so the bounds of its ancestors still hold.
+        node_arrays old;
+        old.nodes = std::move(nodes);
+        old.key_bounds = std::move(key_bounds);
+        old.cost = std::move(cost);
+        old.build_cost = std::move(build_cost);
+        reserve(old.nodes.size());
+        copy_or_rebuild(old, 0, 0, rebuild_threshold, stats);
+        return stats;
+    }
+
+    // Rebuild the whole hierarchy over the current object bounds
+    void rebuild() { build(); }
+
+private:
+    // Leaves have count > 0 and refer to objects [first, first + count). Inner nodes have
+    // count == 0, their left child directly follows them and first is the right child index.
+    struct node
+    {
+        uint32_t first = 0;
+        uint16_t count = 0;
+        uint16_t axis = 0; // Split axis of inner nodes
+    };
+
+    // Node arrays of a hierarchy that is being replaced
+    struct node_arrays
+    {
+        std::vector<node> nodes;
+        std::vector<aabb> key_bounds;
+        std::vector<double> cost;
+        std::vector<double> build_cost;
+    };
+
+    // Node bounds interpolated between keys key and key + 1
+    aabb bounds_at(size_t node_index, size_t key, double f) const
+    {
+        const auto* box = &key_bounds[node_index * time_keys + key];
+        if (f == 0)
+        {
+            return box[0];
+        }
+
+        aabb result;
+        result.x = interval((1 - f) * box[0].x.min + f * box[1].x.min, (1 - f) * box[0].x.max + f * box[1].x.max);
+        result.y = interval((1 - f) * box[0].y.min + f * box[1].y.min, (1 - f) * box[0].y.max + f * box[1].y.max);
+        result.z = interval((1 - f) * box[0].z.min + f * box[1].z.min, (1 - f) * box[0].z.max + f * box[1].z.max);
+        return result;
+    }
+
+    // Slab test against the node bounds interpolated to the ray time
+    bool hit_bounds(size_t node_index, size_t key, double f, const double (&origin)[3],
+        const double (&inv_dir)[3], interval ray_t) const
+    {
+        const auto* box = &key_bounds[node_index * time_keys + key];
+        const auto* next = time_keys > 1 ? box + 1 : box;
+
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            const auto& a = box->axis_interval(axis);
+            const auto& b = next->axis_interval(axis);
+            const auto t0 = ((1 - f) * a.min + f * b.min - origin[axis]) * inv_dir[axis];
+            const auto t1 = ((1 - f) * a.max + f * b.max - origin[axis]) * inv_dir[axis];
+            if (t0 < t1)
+            {
+                if (t0 > ray_t.min) ray_t.min = t0;
+                if (t1 < ray_t.max) ray_t.max = t1;
+            }
+            else
+            {
+                if (t1 > ray_t.min) ray_t.min = t1;
+                if (t0 < ray_t.max) ray_t.max = t0;
+            }
+
+            if (ray_t.max <= ray_t.min)
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    // Bounds of one object at every key
+    void object_key_bounds(const hittable& object, aabb* out) const
+    {
+        const auto segments = time_keys - 1;
+        const auto object_segments = object.motion_segments();
+        const bool aligned = object_segments > 0 && segments % object_segments == 0;
+        for (int k = 0; k < time_keys; ++k)
+        {
+            out[k] = aligned ? object.bounding_box_at(double(k) / segments) : object.bounding_box();
+        }
+    }
+
+    // Node bounds area summed over the keys
+    double keyed_area(size_t node_index) const
+    {
+        double area = 0;
+        for (int k = 0; k < time_keys; ++k)
+        {
+            area += half_area(key_bounds[node_index * time_keys + k]);
+        }
+        return area;
+    }
+
+    void reserve(size_t node_count)
+    {
+        nodes.reserve(node_count);
+        key_bounds.reserve(node_count * time_keys);
+        cost.reserve(node_count);
+        build_cost.reserve(node_count);
+    }
+
+    void build()
+    {
+        nodes.clear();
+        key_bounds.clear();
+        cost.clear();
+        build_cost.clear();
+        bbox = aabb::empty;
+        if (objects.empty())
+        {
+            return;
+        }
+
+        for (const auto& object : objects)
+        {
+            bbox = aabb(bbox, object->bounding_box());
+        }
+
+        reserve(2 * objects.size() / max_leaf_size + 1);
+        build_range(0, uint32_t(objects.size()), 0);
+    }
+
+    // Build a subtree at depth over objects [begin, end) and append its nodes. The objects in
+    // the range are reordered so that every leaf refers to a contiguous span.
+    void build_range(uint32_t begin, uint32_t end, int depth)
+    {
+        range_begin = begin;
+        object_bounds.resize(size_t(end - begin) * time_keys);
+        for (auto i = begin; i < end; ++i)
+        {
+            object_key_bounds(*objects[i], bounds_of(i));
+        }
+
+        std::vector<uint32_t> order(end - begin);
+        std::iota(order.begin(), order.end(), begin);
+        build_node(order, 0, end - begin, depth);
+
+        std::vector<std::shared_ptr<hittable>> sorted;
+        sorted.reserve(end - begin);
+        for (auto index : order)
+        {
+            sorted.push_back(std::move(objects[index]));
+        }
+        std::move(sorted.begin(), sorted.end(), objects.begin() + begin);
+        object_bounds.clear();
+    }
+
+    // Key bounds of an object of the range being built
+    aabb* bounds_of(uint32_t object) { return &object_bounds[size_t(object - range_begin) * time_keys]; }
+    const aabb* bounds_of(uint32_t object) const { return &object_bounds[size_t(object - range_begin) * time_keys]; }
+
+    // Recompute all node bounds and costs from the current object bounds. Children always
+    // follow their parent, so a reverse pass sees both children before the parent.
+    void refit_bounds()
+    {
+        bbox = aabb::empty;
+        std::vector<aabb> object_keys(time_keys);
+        for (size_t node_index = nodes.size(); node_index-- > 0;)
+        {
+            const auto& n = nodes[node_index];
+            auto* box = &key_bounds[node_index * time_keys];
+            if (n.count > 0)
+            {
+                std::fill(box, box + time_keys, aabb::empty);
+                for (uint32_t i = n.first; i < n.first + n.count; ++i)
+                {
+                    object_key_bounds(*objects[i], object_keys.data());
+                    for (int k = 0; k < time_keys; ++k)
+                    {
+                        box[k] = aabb(box[k], object_keys[k]);
+                    }
+                    bbox = aabb(bbox, objects[i]->bounding_box());
+                }
+                cost[node_index] = n.count * keyed_area(node_index);
+            }
+            else
+            {
+                const auto* left = &key_bounds[(node_index + 1) * time_keys];
+                const auto* right = &key_bounds[size_t(n.first) * time_keys];
+                for (int k = 0; k < time_keys; ++k)
+                {
+                    box[k] = aabb(left[k], right[k]);
+                }
+                cost[node_index] = keyed_area(node_index) + cost[node_index + 1] + cost[n.first];
+            }
+        }
+    }
+
+    bool degraded(const node_arrays& tree, uint32_t node_index, double threshold) const
+    {
+        return tree.nodes[node_index].count == 0
+            && tree.cost[node_index] > threshold * tree.build_cost[node_index];
+    }
+
+    // Whether any inner node of the subtree is degraded
+    bool degraded_below(uint32_t node_index, double threshold) const
+    {
+        const auto& n = nodes[node_index];
+        if (n.count > 0)
+        {
+            return false;
+        }
+        return cost[node_index] > threshold * build_cost[node_index]
+            || degraded_below(node_index + 1, threshold)
+            || degraded_below(n.first, threshold);
+    }
+
+    // Append the subtree of old at old_index and depth, rebuilt if degraded and copied otherwise
+    void copy_or_rebuild(const node_arrays& old, uint32_t old_index, int depth, double threshold, refit_stats& stats)
+    {
+        if (degraded(old, old_index, threshold))
+        {
+            // Leaves of a subtree cover a contiguous object range
+            auto leftmost = old_index;
+            while (old.nodes[leftmost].count == 0)
+            {
+                ++leftmost;
+            }
+            auto rightmost = old_index;
+            while (old.nodes[rightmost].count == 0)
+            {
+                rightmost = old.nodes[rightmost].first;
+            }
+
+            const auto begin = old.nodes[leftmost].first;
+            const auto end = old.nodes[rightmost].first + old.nodes[rightmost].count;
+            build_range(begin, end, depth);
+            ++stats.rebuilt_subtrees;
+            stats.rebuilt_objects += end - begin;
+            return;
+        }
+
+        const auto node_index = uint32_t(nodes.size());
+        nodes.push_back(old.nodes[old_index]);
+        key_bounds.insert(key_bounds.end(), old.key_bounds.begin() + size_t(old_index) * time_keys,
+            old.key_bounds.begin() + size_t(old_index + 1) * time_keys);
+        cost.push_back(old.cost[old_index]);
+        build_cost.push_back(old.build_cost[old_index]);
+
+        if (old.nodes[old_index].count == 0)
+        {
+            copy_or_rebuild(old, old_index + 1, depth + 1, threshold, stats);
+            nodes[node_index].first = uint32_t(nodes.size());
+            copy_or_rebuild(old, old.nodes[old_index].first, depth + 1, threshold, stats);
+        }
+    }
+
+    // Centroid of an object averaged over the keys, the split key of the build
+    double centroid(uint32_t object, int axis) const
+    {
+        double sum = 0;
+        for (int k = 0; k < time_keys; ++k)
+        {
+            const auto& ax = bounds_of(object)[k].axis_interval(axis);
+            sum += ax.min + ax.max;
+        }
+        return sum / (2 * time_keys);
+    }
+
+    static double half_area(const aabb& box)
+    {
+        const auto dx = box.x.size();
+        const auto dy = box.y.size();
+        const auto dz = box.z.size();
+        return dx * dy + dy * dz + dz * dx;
+    }
+
+    // Partition [start, end) with a binned surface area heuristic over the time averaged
+    // centroids. A child costs its object count times its bounds area summed over all keys, so
+    // groups that stay compact over the whole shutter are kept together. Falls back to a median
+    // split when the centroids coincide. Returns the first index of the right child and the
+    // split axis.
+    uint32_t split(std::vector<uint32_t>& order, uint32_t start, uint32_t end, const aabb& centroids, int& split_axis)
+    {
+        constexpr int bins = 12;
+        int best_axis = -1;
+        int best_bin = 0;
+        double best_cost = infinity;
+
+        std::vector<aabb> bin_bounds(bins * time_keys);
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            const auto& extent = centroids.axis_interval(axis);
+            if (extent.size() <= 0)
+            {
+                continue;
+            }
+
+            int counts[bins] = {};
+            std::fill(bin_bounds.begin(), bin_bounds.end(), aabb::empty);
+            for (auto i = start; i < end; ++i)
+            {
+                const auto b = bin_of(order[i], axis, extent, bins);
+                ++counts[b];
+                for (int k = 0; k < time_keys; ++k)
+                {
+                    auto& box = bin_bounds[b * time_keys + k];
+                    box = aabb(box, bounds_of(order[i])[k]);
+                }
+            }
+
+            // Sweep from the right to get the cost of every right side, then from the left
+            double right_cost[bins] = {};
+            std::vector<aabb> sweep(time_keys, aabb::empty);
+            int count = 0;
+            for (int b = bins - 1; b > 0; --b)
+            {
+                count += counts[b];
+                double area = 0;
+                for (int k = 0; k < time_keys; ++k)
+                {
+                    sweep[k] = aabb(sweep[k], bin_bounds[b * time_keys + k]);
+                    area += count > 0 ? half_area(sweep[k]) : 0;
+                }
+                right_cost[b] = count * area;
+            }
+
+            std::fill(sweep.begin(), sweep.end(), aabb::empty);
+            count = 0;
+            for (int b = 0; b < bins - 1; ++b)
+            {
+                count += counts[b];
+                double area = 0;
+                for (int k = 0; k < time_keys; ++k)
+                {
+                    sweep[k] = aabb(sweep[k], bin_bounds[b * time_keys + k]);
+                    area += count > 0 ? half_area(sweep[k]) : 0;
+                }
+
+                const auto cost = count * area + right_cost[b + 1];
+                if (count > 0 && count < int(end - start) && cost < best_cost)
+                {
+                    best_cost = cost;
+                    best_axis = axis;
+                    best_bin = b + 1;
+                }
+            }
+        }
+
+        if (best_axis >= 0)
+        {
+            const auto& extent = centroids.axis_interval(best_axis);
+            const auto middle = std::partition(order.begin() + start, order.begin() + end, [&](uint32_t object)
+            {
+                return bin_of(object, best_axis, extent, bins) < best_bin;
+            });
+            split_axis = best_axis;
+            return uint32_t(middle - order.begin());
+        }
+
+        return median_split(order, start, end, centroids, split_axis);
+    }
+
+    // Partition [start, end) in half at the median centroid along the longest axis
+    uint32_t median_split(std::vector<uint32_t>& order, uint32_t start, uint32_t end, const aabb& centroids,
+        int& split_axis) const
+    {
+        split_axis = centroids.longest_axis();
+        const auto mid = start + (end - start) / 2;
+        std::nth_element(order.begin() + start, order.begin() + mid, order.begin() + end, [&](uint32_t a, uint32_t b)
+        {
+            return centroid(a, split_axis) < centroid(b, split_axis);
+        });
+        return mid;
+    }
+
+    int bin_of(uint32_t object, int axis, const interval& extent, int bins) const
+    {
+        const auto b = int(bins * (centroid(object, axis) - extent.min) / extent.size());
+        return std::clamp(b, 0, bins - 1);
+    }
+
+    uint32_t build_node(std::vector<uint32_t>& order, uint32_t start, uint32_t end, int depth)
+    {
+        const auto node_index = uint32_t(nodes.size());
+        nodes.emplace_back();
+        key_bounds.resize(key_bounds.size() + time_keys, aabb::empty);
+        cost.emplace_back();
+        build_cost.emplace_back();
+
+        aabb centroids = aabb::empty;
+        for (auto i = start; i < end; ++i)
+        {
+            for (int k = 0; k < time_keys; ++k)
+            {
+                auto& box = key_bounds[node_index * time_keys + k];
+                box = aabb(box, bounds_of(order[i])[k]);
+            }
+            const point3 c(centroid(order[i], 0), centroid(order[i], 1), centroid(order[i], 2));
+            centroids = aabb(centroids, aabb(c, c));
+        }
+
+        if (end - start <= max_leaf_size)
+        {
+            nodes[node_index] = node{range_begin + start, uint16_t(end - start), 0};
+            cost[node_index] = build_cost[node_index] = (end - start) * keyed_area(node_index);
+            return node_index;
+        }
+
+        // Median splits halve the range, so once depth plus the levels they still need reaches
+        // max_depth, they finish the subtree within it however clustered the centroids are
+        int axis = 0;
+        const auto count = end - start;
+        const auto mid = depth + std::bit_width(count) >= max_depth
+            ? median_split(order, start, end, centroids, axis)
+            : split(order, start, end, centroids, axis);
+        build_node(order, start, mid, depth + 1);
+        const auto right = build_node(order, mid, end, depth + 1);
+        nodes[node_index] = node{right, 0, uint16_t(axis)};
+        cost[node_index] = build_cost[node_index] = keyed_area(node_index) + cost[node_index + 1] + cost[right];
+        return node_index;
+    }
+
+    std::vector<std::shared_ptr<hittable>> objects;
+    std::vector<aabb> object_bounds; // Build only, objects of the range x time_keys
+    uint32_t range_begin = 0; // Build only, first object of the range
+    std::vector<node> nodes;
+    std::vector<aabb> key_bounds; // nodes x time_keys
+    std::vector<double> cost; // Subtree cost of every node after the last refit
+    std::vector<double> build_cost; // Subtree cost of every node when it was built
+    int time_keys = 1;
+    aabb bbox;
+};
@@ -75,36 +75,6 @@ private:
     point3 origin;
 };
 
-class mixture_pdf : public pdf
-{
-public:
-    mixture_pdf(std::shared_ptr<pdf> p0, std::shared_ptr<pdf> p1)
-    {
-        p[0] = p0;
-        p[1] = p1;
-    }
-
-    double value(const vec3& direction) const override
-    {
-        return 0.5 * p[0]->value(direction) + 0.5 * p[1]->value(direction);
-    }
-
-    vec3 generate() const override
-    {
-        if (random_double() < 0.5)
-        {
-            return p[0]->generate();
-        }
-        else
-        {
-            return p[1]->generate();
-        }
-    }
-
-private:
-    std::shared_ptr<pdf> p[2];
-};
-
 class power_cosine_pdf : public pdf
 {
 public:
@@ -141,3 +111,34 @@ private:
     onb uvw;
     double n;
 };
+
+// How light that two sampling strategies can both find is shared between them
+enum class mis_heuristic
+{
+    balance, // In proportion to the densities
+    power // In proportion to the squared densities, nearly all to a strategy that is much better
+};
+
+// Share of a sample drawn with density pdf when the other strategy has density other_pdf for
+// the same direction. The shares of both strategies add up to one.
+inline double mis_weight(mis_heuristic heuristic, double pdf, double other_pdf)
+{
+    if (heuristic == mis_heuristic::power)
+    {
+        pdf *= pdf;
+        other_pdf *= other_pdf;
+    }
+    return pdf + other_pdf > 0 ? pdf / (pdf + other_pdf) : 0;
+}
+
+// Share of the light found by r that is left to it, against the light sample taken at its
+// origin. scatter_pdf is the density r was scattered with, 0 when no light sample could have
+// found the same light.
+inline double scattered_light_weight(mis_heuristic heuristic, const ray& r, const hittable& lights, double scatter_pdf)
+{
+    if (scatter_pdf <= 0)
+    {
+        return 1;
+    }
+    return mis_weight(heuristic, scatter_pdf, lights.pdf_value(r.origin(), r.direction()));
+}
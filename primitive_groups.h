@@ -0,0 +1,342 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <numeric>
+#include <type_traits>
+#include <vector>
+
+#include "hittable.h"
+#include "hittable_list.h"
+#include "box.h"
+#include "bvh.h"
+#include "sphere.h"
+#include "quad.h"
+#include "triangle.h"
+#include "constant_medium.h"
+#include "leaf_batch.h"
+#include "scene_arena.h"
+
+// A flat bounding volume hierarchy over primitives of one concrete type. The primitives are
+// stored by value and every leaf tests its span with the same non-virtual kernel. Types with a
+// leaf_batch specialization additionally get an SoA copy of every leaf tested all at once.
+template<typename T>
+class typed_bvh
+{
+public:
+    static constexpr uint32_t max_leaf_size = 4;
+    static constexpr uint32_t max_depth = 60; // Keeps the traversal stack in bounds
+    static_assert(!leaf_batch<T>::enabled || leaf_batch<T>::width >= max_leaf_size);
+
+    // Leaves have count > 0 and refer to primitives [first, first + count). Inner nodes have
+    // count == 0, their left child directly follows them and first is the right child index.
+    struct node
+    {
+        aabb bbox;
+        uint32_t first = 0;
+        uint32_t count = 0;
+        uint32_t batch = 0; // Index into batches for leaves of batched types
+    };
+
+    void add(T object)
+    {
+        primitives.push_back(std::move(object));
+    }
+
+    void reserve(size_t count) { primitives.reserve(count); }
+
+    bool empty() const { return primitives.empty(); }
+    size_t size() const { return primitives.size(); }
+
+    aabb bounding_box() const { return nodes.empty() ? aabb::empty : nodes[0].bbox; }
+
+    // Build the hierarchy over all added primitives. The primitives are reordered so that
+    // every leaf refers to a contiguous span. When added_order is given, it receives for every
+    // primitive in its new place the index it was added at.
+    void build(std::vector<uint32_t>* added_order = nullptr)
+    {
+        nodes.clear();
+        if (primitives.empty())
+        {
+            return;
+        }
+
+        std::vector<uint32_t> order(primitives.size());
+        std::iota(order.begin(), order.end(), 0);
+        nodes.reserve(2 * primitives.size() / max_leaf_size + 1);
+        build_node(order, 0, uint32_t(order.size()));
+
+        std::vector<T> sorted;
+        sorted.reserve(primitives.size());
+        for (auto index : order)
+        {
+            sorted.push_back(std::move(primitives[index]));
+        }
+        primitives = std::move(sorted);
+        build_batches();
+        if (added_order)
+        {
+            *added_order = std::move(order);
+        }
+    }
+
+    // Nodes of the built hierarchy
+    const std::vector<node>& hierarchy() const { return nodes; }
+
+    // Memory of the nodes and the leaf batches
+    size_t hierarchy_bytes() const
+    {
+        if constexpr (leaf_batch<T>::enabled)
+        {
+            return nodes.size() * sizeof(node) + batches.size() * sizeof(leaf_batch<T>);
+        }
+        return nodes.size() * sizeof(node);
+    }
+
+    // Take over saved nodes instead of building, with the primitives added in the order the
+    // saved hierarchy left them. Returns false if the nodes do not fit the primitives or nest
+    // deeper than the traversal stack holds.
+    bool restore(const node* saved, size_t count)
+    {
+        nodes.assign(saved, saved + count);
+        // Children follow their parents, so every depth is final before its node is checked
+        std::vector<uint32_t> depth(nodes.size(), 0);
+        for (size_t index = 0; index < nodes.size(); ++index)
+        {
+            const auto& n = nodes[index];
+            const bool fits = n.count > 0
+                ? n.count <= max_leaf_size && size_t(n.first) + n.count <= primitives.size()
+                : n.first > index + 1 && n.first < nodes.size() && depth[index] < max_depth;
+            if (!fits)
+            {
+                nodes.clear();
+                return false;
+            }
+            if (n.count == 0)
+            {
+                depth[index + 1] = std::max(depth[index + 1], depth[index] + 1);
+                depth[n.first] = std::max(depth[n.first], depth[index] + 1);
+            }
+        }
+        if (nodes.empty() != primitives.empty())
+        {
+            nodes.clear();
+            return false;
+        }
+        build_batches();
+        return true;
+    }
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const
+    {
+        if (nodes.empty())
+        {
+            return false;
+        }
+
+        uint32_t stack[64];
+        int stack_size = 0;
+        stack[stack_size++] = 0;
+        bool hit_anything = false;
+
+        while (stack_size > 0)
+        {
+            const auto node_index = stack[--stack_size];
+            const auto& n = nodes[node_index];
+            count_node_visit();
+            if (!n.bbox.hit(r, ray_t))
+            {
+                continue;
+            }
+
+            if constexpr (leaf_batch<T>::enabled)
+            {
+                if (n.count > 0)
+                {
+                    if (batches[n.batch].hit(r, ray_t, rec, &primitives[n.first]))
+                    {
+                        hit_anything = true;
+                        ray_t.max = rec.t;
+                    }
+                    continue;
+                }
+            }
+
+            if (n.count > 0)
+            {
+                for (uint32_t i = n.first; i < n.first + n.count; ++i)
+                {
+                    if (primitives[i].hit(r, ray_t, rec))
+                    {
+                        hit_anything = true;
+                        ray_t.max = rec.t;
+                    }
+                }
+            }
+            else
+            {
+                // Push the right child first so the left one is visited first
+                stack[stack_size++] = n.first;
+                stack[stack_size++] = node_index + 1;
+            }
+        }
+
+        return hit_anything;
+    }
+
+private:
+    void build_batches()
+    {
+        if constexpr (leaf_batch<T>::enabled)
+        {
+            batches.clear();
+            for (auto& n : nodes)
+            {
+                if (n.count > 0)
+                {
+                    n.batch = uint32_t(batches.size());
+                    batches.emplace_back().assign(&primitives[n.first], n.count);
+                }
+            }
+        }
+    }
+
+    uint32_t build_node(std::vector<uint32_t>& order, uint32_t start, uint32_t end)
+    {
+        const auto node_index = uint32_t(nodes.size());
+        nodes.emplace_back();
+
+        aabb bbox = aabb::empty;
+        for (auto i = start; i < end; ++i)
+        {
+            bbox = aabb(bbox, primitives[order[i]].bounding_box());
+        }
+
+        if (end - start <= max_leaf_size)
+        {
+            nodes[node_index] = node{bbox, start, end - start, 0};
+            return node_index;
+        }
+
+        // Same median split along the longest axis as bvh_node
+        const auto axis = bbox.longest_axis();
+        std::sort(order.begin() + start, order.begin() + end, [&](uint32_t a, uint32_t b)
+        {
+            return primitives[a].bounding_box().axis_interval(axis).min
+                < primitives[b].bounding_box().axis_interval(axis).min;
+        });
+
+        const auto mid = start + (end - start) / 2;
+        build_node(order, start, mid);
+        const auto right = build_node(order, mid, end);
+        nodes[node_index] = node{bbox, right, 0, 0};
+        return node_index;
+    }
+
+    std::vector<T> primitives;
+    std::vector<node> nodes;
+    std::vector<leaf_batch<T>> batches;
+};
+
+// An alternative scene representation for the closed set of built-in primitives. Primitives of
+// the same type are grouped into their own typed_bvh, so intersection never goes through a
+// virtual call until it reaches the material. Any other hittable can still be added and is
+// traversed through a regular bvh_node, allocated from the arena when given one.
+class primitive_groups : public hittable
+{
+public:
+    explicit primitive_groups(scene_arena* arena = nullptr) : arena(arena) {}
+
+    void add(sphere object) { spheres.add(std::move(object)); }
+    void add(quad object) { quads.add(std::move(object)); }
+    void add(triangle object) { triangles.add(std::move(object)); }
+    void add(aligned_box object) { boxes.add(std::move(object)); }
+    void add(oriented_box object) { oriented_boxes.add(std::move(object)); }
+    void add(constant_medium object) { media.add(std::move(object)); }
+    void add(const std::shared_ptr<hittable>& object) { others.add(object); }
+
+    // Build the per-type hierarchies. Must be called after the last add and before rendering.
+    void build()
+    {
+        spheres.build();
+        quads.build();
+        triangles.build();
+        boxes.build();
+        oriented_boxes.build();
+        media.build();
+        finish();
+    }
+
+    // The hierarchy of one primitive type, to build or restore it on its own
+    template<typename T>
+    typed_bvh<T>& group()
+    {
+        if constexpr (std::is_same_v<T, sphere>) return spheres;
+        else if constexpr (std::is_same_v<T, quad>) return quads;
+        else if constexpr (std::is_same_v<T, triangle>) return triangles;
+        else if constexpr (std::is_same_v<T, aligned_box>) return boxes;
+        else if constexpr (std::is_same_v<T, oriented_box>) return oriented_boxes;
+        else return media;
+    }
+
+    // Build the hierarchy of the other hittables and the bounds, once every group is built
+    void finish()
+    {
+        others_bvh = others.objects.empty() ? nullptr : make_scene_object<bvh_node>(arena, others, arena);
+
+        bbox = aabb(aabb(spheres.bounding_box(), quads.bounding_box()),
+                    aabb(triangles.bounding_box(), media.bounding_box()));
+        bbox = aabb(bbox, aabb(boxes.bounding_box(), oriented_boxes.bounding_box()));
+        if (others_bvh)
+        {
+            bbox = aabb(bbox, others_bvh->bounding_box());
+        }
+    }
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override
+    {
+        bool hit_anything = false;
+
+        hit_anything |= hit_group(spheres, r, ray_t, rec);
+        hit_anything |= hit_group(quads, r, ray_t, rec);
+        hit_anything |= hit_group(triangles, r, ray_t, rec);
+        hit_anything |= hit_group(boxes, r, ray_t, rec);
+        hit_anything |= hit_group(oriented_boxes, r, ray_t, rec);
+        hit_anything |= hit_group(media, r, ray_t, rec);
+
+        if (others_bvh && others_bvh->hit(r, ray_t, rec))
+        {
+            hit_anything = true;
+        }
+
+        return hit_anything;
+    }
+
+    aabb bounding_box() const override { return bbox; }
+
+private:
+    // Test one group and shrink the ray interval to the closest hit found so far
+    template<typename T>
+    static bool hit_group(const typed_bvh<T>& group, const ray& r, interval& ray_t, hit_record& rec)
+    {
+        if (!group.hit(r, ray_t, rec))
+        {
+            return false;
+        }
+
+        ray_t.max = rec.t;
+        return true;
+    }
+
+    typed_bvh<sphere> spheres;
+    typed_bvh<quad> quads;
+    typed_bvh<triangle> triangles;
+    typed_bvh<aligned_box> boxes;
+    typed_bvh<oriented_box> oriented_boxes;
+    typed_bvh<constant_medium> media;
+    hittable_list others;
+    scene_arena* arena;
+    std::shared_ptr<bvh_node> others_bvh;
+    aabb bbox;
+};
@@ -0,0 +1,147 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <print>
+#include <string_view>
+#include <vector>
+
+#include "rtweekend.h"
+#include "sampler.h"
+
+// Unnormalised radiance sums and sample counts of a progressive render. Every sampler draws
+// the values of a sample from the pixel, the sample index and the seed alone, so the sample
+// count of a pixel is also its generator state: the next pass continues exactly where an
+// uninterrupted render would be.
+class accumulation_buffer
+{
+public:
+    accumulation_buffer(int width, int height, sampler_type sampling, uint32_t seed)
+        : image_width(width)
+        , image_height(height)
+        , sampling(sampling)
+        , seed(seed)
+        , sums(size_t(width) * height, color(0, 0, 0))
+        , counts(size_t(width) * height, 0)
+    {
+    }
+
+    size_t size() const { return counts.size(); }
+
+    uint32_t samples(size_t pixel) const { return counts[pixel]; }
+
+    // Fewest samples of any pixel
+    uint32_t min_samples() const
+    {
+        return counts.empty() ? 0 : *std::min_element(counts.begin(), counts.end());
+    }
+
+    // Add the radiance of the pixel's next sample
+    void add(size_t pixel, const color& radiance)
+    {
+        sums[pixel] += radiance;
+        ++counts[pixel];
+    }
+
+    color mean(size_t pixel) const { return counts[pixel] > 0 ? sums[pixel] * (1.0 / counts[pixel]) : color(0, 0, 0); }
+
+    // Read a checkpoint written with the same image size, sampler and seed
+    bool load(const std::filesystem::path& filename)
+    {
+        std::ifstream in(filename, std::ios::binary);
+        if (!in)
+        {
+            std::println(std::cerr, "ERROR: Could not open checkpoint {}", filename.string());
+            return false;
+        }
+
+        char magic[4];
+        uint32_t version = 0;
+        int32_t width = 0;
+        int32_t height = 0;
+        uint32_t pattern = 0;
+        uint32_t pattern_seed = 0;
+        in.read(magic, sizeof(magic));
+        in.read(reinterpret_cast<char*>(&version), sizeof(version));
+        in.read(reinterpret_cast<char*>(&width), sizeof(width));
+        in.read(reinterpret_cast<char*>(&height), sizeof(height));
+        in.read(reinterpret_cast<char*>(&pattern), sizeof(pattern));
+        in.read(reinterpret_cast<char*>(&pattern_seed), sizeof(pattern_seed));
+        if (!in || std::string_view(magic, 4) != "RTCK" || version != 1)
+        {
+            std::println(std::cerr, "ERROR: {} is not a checkpoint file", filename.string());
+            return false;
+        }
+        if (width != image_width || height != image_height || pattern != uint32_t(sampling) || pattern_seed != seed)
+        {
+            std::println(std::cerr, "ERROR: Checkpoint {} was rendered with a different image size or sampler",
+                filename.string());
+            return false;
+        }
+
+        in.read(reinterpret_cast<char*>(sums.data()), sums.size() * sizeof(color));
+        in.read(reinterpret_cast<char*>(counts.data()), counts.size() * sizeof(uint32_t));
+        if (!in)
+        {
+            std::println(std::cerr, "ERROR: Truncated checkpoint {}", filename.string());
+            return false;
+        }
+
+        return true;
+    }
+
+    // Write the checkpoint next to filename and then rename it over filename, so a crash while
+    // saving leaves the previous checkpoint intact
+    bool save(const std::filesystem::path& filename) const
+    {
+        auto partial = filename;
+        partial += ".partial";
+        {
+            std::ofstream out(partial, std::ios::binary | std::ios::trunc);
+            if (!out)
+            {
+                std::println(std::cerr, "ERROR: Could not write checkpoint {}", partial.string());
+                return false;
+            }
+
+            const uint32_t version = 1;
+            const int32_t width = image_width;
+            const int32_t height = image_height;
+            const auto pattern = uint32_t(sampling);
+            out.write("RTCK", 4);
+            out.write(reinterpret_cast<const char*>(&version), sizeof(version));
+            out.write(reinterpret_cast<const char*>(&width), sizeof(width));
+            out.write(reinterpret_cast<const char*>(&height), sizeof(height));
+            out.write(reinterpret_cast<const char*>(&pattern), sizeof(pattern));
+            out.write(reinterpret_cast<const char*>(&seed), sizeof(seed));
+            out.write(reinterpret_cast<const char*>(sums.data()), sums.size() * sizeof(color));
+            out.write(reinterpret_cast<const char*>(counts.data()), counts.size() * sizeof(uint32_t));
+            out.flush();
+            if (!out)
+            {
+                std::println(std::cerr, "ERROR: Could not write checkpoint {}", partial.string());
+                return false;
+            }
+        }
+
+        std::error_code error;
+        std::filesystem::rename(partial, filename, error);
+        if (error)
+        {
+            std::println(std::cerr, "ERROR: Could not replace checkpoint {}: {}", filename.string(), error.message());
+            return false;
+        }
+        return true;
+    }
+
+private:
+    int image_width;
+    int image_height;
+    sampler_type sampling;
+    uint32_t seed;
+    std::vector<color> sums;
+    std::vector<uint32_t> counts;
+};
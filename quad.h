@@ -1,5 +1,7 @@
 #pragma once
 
+#include <array>
+
 #include "hittable.h"
 #include "hittable_list.h"
 
@@ -7,10 +9,10 @@
 // 1. Q, the starting corner.
 // 2. u, a vector representing the first side. Q+u gives one of the corners adjacent to Q.
 // 3. v, a vector representing the second side. Q+v gives the other corner adjacent to Q.
-class quad : public hittable
+class quad final : public hittable
 {
 public:
-    quad(const point3& Q, const vec3& u, const vec3& v, std::shared_ptr<material> mat)
+    quad(const point3& Q, const vec3& u, const vec3& v, const material* mat)
         : Q(Q)
         , u(u)
         , v(v)
@@ -36,6 +38,9 @@ public:
 
     aabb bounding_box() const override { return bbox; }
 
+    // The four corners in order around the quad, for builders that clip it against planes
+    std::array<point3, 4> corners() const { return {Q, Q + u, Q + u + v, Q + v}; }
+
     bool hit(const ray& r, interval ray_t, hit_record& rec) const override
     {
         auto denom = dot(normal, r.direction());
@@ -111,32 +116,9 @@ private:
     vec3 u;
     vec3 v;
     vec3 w;
-    std::shared_ptr<material> mat;
+    const material* mat;
     aabb bbox;
     vec3 normal; // A unit vecotr perpendicular to the quad plane
     double D; // Implicit equation of a plane n*(x, y, z) = Ax+By+Cz=D
     double area;
 };
-
-// Returns the 3D box (six sides) that contains the two opposite vertices a & b.
-std::shared_ptr<hittable_list> box(const point3& a, const point3& b, std::shared_ptr<material> mat)
-{
-    auto sides = std::make_shared<hittable_list>();
-
-    // Construct the two opposite vertices with the minimum and maximum coordinates.
-    auto min = point3(std::fmin(a.x(),b.x()), std::fmin(a.y(),b.y()), std::fmin(a.z(),b.z()));
-    auto max = point3(std::fmax(a.x(),b.x()), std::fmax(a.y(),b.y()), std::fmax(a.z(),b.z()));
-
-    auto dx = vec3(max.x() - min.x(), 0, 0);
-    auto dy = vec3(0, max.y() - min.y(), 0);
-    auto dz = vec3(0, 0, max.z() - min.z());
-
-    sides->add(std::make_shared<quad>(point3(min.x(), min.y(), max.z()),  dx,  dy, mat)); // front
-    sides->add(std::make_shared<quad>(point3(max.x(), min.y(), max.z()), -dz,  dy, mat)); // right
-    sides->add(std::make_shared<quad>(point3(max.x(), min.y(), min.z()), -dx,  dy, mat)); // back
-    sides->add(std::make_shared<quad>(point3(min.x(), min.y(), min.z()),  dz,  dy, mat)); // left
-    sides->add(std::make_shared<quad>(point3(min.x(), max.y(), max.z()),  dx, -dz, mat)); // top
-    sides->add(std::make_shared<quad>(point3(min.x(), min.y(), min.z()),  dx,  dz, mat)); // bottom
-
-    return sides;
-}
\ No newline at end of file
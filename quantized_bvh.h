@@ -0,0 +1,279 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "hittable.h"
+#include "hittable_list.h"
+
+// A flat bounding volume hierarchy with compressed nodes, for scenes where the hierarchy itself
+// is what fills memory. A node is 16 bytes: the boxes of both children as 8-bit offsets inside
+// the node's own box, and one link. Nothing else is stored per node; traversal decodes every
+// box from its parent's on the way down and keeps the decoded boxes on its stack, so only the
+// root box is held at full precision.
+//
+// Encoding rounds outwards against the decoded parent box, with the same decode the traversal
+// uses, so a decoded box always encloses its subtree and no hit is lost. Boxes only get looser,
+// by at most 1/255 of the parent's extent per side and level.
+//
+// Objects are split at the median of their box minimums along the longest axis, like bvh_node,
+// into leaves of at most max_leaf_size objects. Bounds are taken once at build time, so like
+// bvh_node it is meant for static objects.
+class quantized_bvh : public hittable
+{
+public:
+    static constexpr uint32_t max_leaf_size = 4;
+
+    explicit quantized_bvh(const hittable_list& list)
+        : objects(list.objects)
+    {
+        if (objects.empty())
+        {
+            bbox = aabb::empty;
+            return;
+        }
+
+        bbox = aabb::empty;
+        for (const auto& object : objects)
+        {
+            bbox = aabb(bbox, object->bounding_box());
+        }
+        nodes.reserve(2 * objects.size() / max_leaf_size + 1);
+        nodes.emplace_back();
+        build(0, 0, objects.size(), box::of(bbox));
+        nodes.shrink_to_fit();
+    }
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override
+    {
+        if (nodes.empty())
+        {
+            return false;
+        }
+
+        const auto& o = r.origin();
+        const auto& d = r.direction();
+        const double origin[3] = {o.x(), o.y(), o.z()};
+        const double inverse[3] = {1.0 / d.x(), 1.0 / d.y(), 1.0 / d.z()};
+
+        // Boxes are tested before they are pushed, so the stack only holds nodes the ray enters
+        struct entry
+        {
+            uint32_t index;
+            double distance;
+            box bounds;
+        };
+        entry stack[64];
+        int stack_size = 0;
+        count_node_visit();
+        double root_distance;
+        if (!box::of(bbox).hit(origin, inverse, ray_t, root_distance))
+        {
+            return false;
+        }
+        stack[stack_size++] = {0, root_distance, box::of(bbox)};
+        bool hit_anything = false;
+
+        while (stack_size > 0)
+        {
+            const auto current = stack[--stack_size];
+            if (current.distance >= ray_t.max)
+            {
+                continue;
+            }
+            const auto& n = nodes[current.index];
+
+            if (n.link & leaf_bit)
+            {
+                const auto first = (n.link & ~leaf_bit) >> count_bits;
+                const auto count = (n.link & count_mask) + 1;
+                for (auto i = first; i < first + count; ++i)
+                {
+                    if (objects[i]->hit(r, ray_t, rec))
+                    {
+                        hit_anything = true;
+                        ray_t.max = rec.t;
+                    }
+                }
+                continue;
+            }
+
+            // The nearer child on top, so it is visited first
+            entry children[2];
+            bool entered[2];
+            for (int child = 0; child < 2; ++child)
+            {
+                count_node_visit();
+                children[child] = {n.link + child, 0, current.bounds.decode(n, child)};
+                entered[child] = children[child].bounds.hit(origin, inverse, ray_t, children[child].distance);
+            }
+            const int nearer = entered[1] && (!entered[0] || children[1].distance < children[0].distance) ? 1 : 0;
+            if (entered[1 - nearer]) stack[stack_size++] = children[1 - nearer];
+            if (entered[nearer]) stack[stack_size++] = children[nearer];
+        }
+
+        return hit_anything;
+    }
+
+    aabb bounding_box() const override { return bbox; }
+
+    size_t node_count() const { return nodes.size(); }
+
+    // Memory of the hierarchy: the nodes and the objects in leaf order
+    size_t hierarchy_bytes() const
+    {
+        return nodes.size() * sizeof(node) + objects.size() * sizeof(objects[0]);
+    }
+
+private:
+    // Inner nodes link to the first of their two children, which are always adjacent. Leaves
+    // set leaf_bit and pack their first object above count_bits and their count minus one below.
+    static constexpr uint32_t leaf_bit = 0x80000000u;
+    static constexpr uint32_t count_bits = 3;
+    static constexpr uint32_t count_mask = (1u << count_bits) - 1;
+    static_assert(max_leaf_size <= count_mask + 1);
+
+    struct node
+    {
+        uint8_t low[2][3] = {};  // Child box minimums, in 255ths of the node's box from its minimum
+        uint8_t high[2][3] = {}; // Child box maximums
+        uint32_t link = 0;
+    };
+    static_assert(sizeof(node) == 16);
+
+    // q / 255 for every step
+    static constexpr auto steps = []
+    {
+        std::array<double, 256> fractions{};
+        for (int q = 0; q < 256; ++q)
+        {
+            fractions[q] = q / 255.0;
+        }
+        return fractions;
+    }();
+
+    // Decoded box of a node, kept by value on the traversal stack
+    struct box
+    {
+        double min[3];
+        double max[3];
+
+        static box of(const aabb& b)
+        {
+            return {{b.x.min, b.y.min, b.z.min}, {b.x.max, b.y.max, b.z.max}};
+        }
+
+        // Interpolated so the ends decode exactly, and a child can always reach its parent's bounds
+        double at(int axis, uint8_t q) const
+        {
+            return min[axis] * steps[255 - q] + max[axis] * steps[q];
+        }
+
+        box decode(const node& n, int child) const
+        {
+            box decoded;
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                decoded.min[axis] = at(axis, n.low[child][axis]);
+                decoded.max[axis] = at(axis, n.high[child][axis]);
+            }
+            return decoded;
+        }
+
+        // Same slab test as aabb::hit, also giving the entry distance
+        bool hit(const double (&origin)[3], const double (&inverse)[3], interval ray_t, double& entry) const
+        {
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                const auto t0 = (min[axis] - origin[axis]) * inverse[axis];
+                const auto t1 = (max[axis] - origin[axis]) * inverse[axis];
+                ray_t.min = std::max(ray_t.min, std::min(t0, t1));
+                ray_t.max = std::min(ray_t.max, std::max(t0, t1));
+                if (ray_t.max <= ray_t.min)
+                {
+                    return false;
+                }
+            }
+            entry = ray_t.min;
+            return true;
+        }
+    };
+
+    // Fill node index for objects [start, end) whose decoded box is bounds
+    void build(uint32_t index, size_t start, size_t end, const box& bounds)
+    {
+        const auto count = end - start;
+        if (count <= max_leaf_size)
+        {
+            nodes[index].link = leaf_bit | uint32_t(start) << count_bits | uint32_t(count - 1);
+            return;
+        }
+
+        aabb span = aabb::empty;
+        for (auto i = start; i < end; ++i)
+        {
+            span = aabb(span, objects[i]->bounding_box());
+        }
+        const auto axis = span.longest_axis();
+        std::sort(objects.begin() + long(start), objects.begin() + long(end), [axis](const auto& a, const auto& b)
+        {
+            return a->bounding_box().axis_interval(axis).min < b->bounding_box().axis_interval(axis).min;
+        });
+        const auto mid = start + count / 2;
+
+        const auto children = uint32_t(nodes.size());
+        nodes.emplace_back();
+        nodes.emplace_back();
+        nodes[index].link = children;
+
+        box decoded[2];
+        const size_t ranges[3] = {start, mid, end};
+        for (int child = 0; child < 2; ++child)
+        {
+            aabb child_box = aabb::empty;
+            for (auto i = ranges[child]; i < ranges[child + 1]; ++i)
+            {
+                child_box = aabb(child_box, objects[i]->bounding_box());
+            }
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                const auto& range = child_box.axis_interval(axis);
+                auto& low = nodes[index].low[child][axis];
+                auto& high = nodes[index].high[child][axis];
+                low = quantize(bounds, axis, range.min, false);
+                high = quantize(bounds, axis, range.max, true);
+                decoded[child].min[axis] = bounds.at(axis, low);
+                decoded[child].max[axis] = bounds.at(axis, high);
+            }
+        }
+
+        build(children, start, mid, decoded[0]);
+        build(children + 1, mid, end, decoded[1]);
+    }
+
+    // Step whose decoded value is at or below value, or at or above it when rounding up
+    static uint8_t quantize(const box& bounds, int axis, double value, bool up)
+    {
+        const auto extent = bounds.max[axis] - bounds.min[axis];
+        const auto estimate = extent > 0 ? (value - bounds.min[axis]) / extent * 255.0 : 0.0;
+        int q = std::clamp(int(up ? std::ceil(estimate) : std::floor(estimate)), 0, 255);
+        // The estimate can be off by one step after rounding, the decode decides
+        if (up)
+        {
+            while (q < 255 && bounds.at(axis, uint8_t(q)) < value) ++q;
+        }
+        else
+        {
+            while (q > 0 && bounds.at(axis, uint8_t(q)) > value) --q;
+        }
+        return uint8_t(q);
+    }
+
+    std::vector<std::shared_ptr<hittable>> objects;
+    std::vector<node> nodes;
+    aabb bbox;
+};
@@ -0,0 +1,267 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <format>
+#include <iostream>
+#include <optional>
+#include <print>
+#include <string>
+#include <vector>
+
+#include <cerrno>
+#include <csignal>
+#include <poll.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "color.h"
+#include "distributed.h"
+
+// Worker processes of a distributed render, forked with the scene already built and fed
+// render_jobs over a Unix socket. The coordinator hands out the jobs with a job_scheduler,
+// so a worker that dies or stalls only costs the jobs it was running.
+class render_farm
+{
+public:
+    render_farm() = default;
+
+    render_farm(const render_farm&) = delete;
+    render_farm& operator=(const render_farm&) = delete;
+
+    ~render_farm() { stop(); }
+
+    // Fork worker_count workers and wait for them to connect. Each worker calls serve(fd) to
+    // answer the jobs arriving on fd, and exits with whether it succeeded. Return whether any
+    // worker connected.
+    template<typename Serve>
+    bool start(int worker_count, const Serve& serve)
+    {
+        const auto socket_path = (std::filesystem::temp_directory_path()
+            / std::format("ray_tracer_{}.sock", ::getpid())).string();
+        const int listener = distributed::listen_socket(socket_path, worker_count);
+        if (listener < 0)
+        {
+            return false;
+        }
+
+        // Nothing buffered may be written twice by the workers
+        std::cout.flush();
+        std::clog.flush();
+        for (int w = 0; w < worker_count; ++w)
+        {
+            const auto pid = ::fork();
+            if (pid == 0)
+            {
+                ::close(listener);
+                ::_exit(run_worker(socket_path, serve) ? 0 : 1);
+            }
+            if (pid < 0)
+            {
+                std::println(std::cerr, "ERROR: Could not start worker process: {}", std::strerror(errno));
+                break;
+            }
+            pids.push_back(pid);
+        }
+
+        for (size_t w = 0; w < pids.size(); ++w)
+        {
+            worker_connection worker;
+            worker.fd = distributed::accept_connection(listener, 10000);
+            if (worker.fd < 0 || !distributed::receive_all(worker.fd, &worker.pid, sizeof(worker.pid)))
+            {
+                std::println(std::cerr, "ERROR: Worker process did not connect");
+                if (worker.fd >= 0) ::close(worker.fd);
+                continue;
+            }
+            workers.push_back(worker);
+        }
+        ::close(listener);
+        ::unlink(socket_path.c_str());
+
+        if (workers.empty())
+        {
+            std::println(std::cerr, "ERROR: No worker process connected");
+            stop();
+            return false;
+        }
+        return true;
+    }
+
+    // Render the jobs on the workers until every job is done once. The first result of each job
+    // is handed to accept(job, sums) with the radiance sums of its rows, width colors per row.
+    // Return false when all workers failed.
+    template<typename Accept>
+    bool run(const std::vector<render_job>& jobs, int width, const Accept& accept)
+    {
+        const auto start = std::chrono::steady_clock::now();
+        job_scheduler scheduler(jobs.size());
+        std::vector<color> sums;
+        std::vector<pollfd> waiting;
+        std::vector<worker_connection*> waiting_workers;
+        while (!scheduler.finished())
+        {
+            // Keep every worker busy
+            for (auto& worker : workers)
+            {
+                if (worker.fd < 0 || worker.job)
+                {
+                    continue;
+                }
+                const auto job = scheduler.next();
+                if (!job)
+                {
+                    break;
+                }
+                if (distributed::send_all(worker.fd, &jobs[*job], sizeof(render_job)))
+                {
+                    worker.job = job;
+                }
+                else
+                {
+                    scheduler.abandon(*job);
+                    drop(worker);
+                }
+            }
+
+            waiting.clear();
+            waiting_workers.clear();
+            bool idle = false;
+            for (auto& worker : workers)
+            {
+                if (worker.fd >= 0 && worker.job)
+                {
+                    waiting.push_back({worker.fd, POLLIN, 0});
+                    waiting_workers.push_back(&worker);
+                }
+                idle = idle || (worker.fd >= 0 && !worker.job);
+            }
+            if (waiting.empty())
+            {
+                std::println(std::cerr, "ERROR: All worker processes failed");
+                return false;
+            }
+            // Idle workers check for late jobs to back up every 100 ms
+            if (::poll(waiting.data(), waiting.size(), idle ? 100 : -1) <= 0)
+            {
+                continue;
+            }
+
+            for (size_t w = 0; w < waiting.size(); ++w)
+            {
+                if (waiting[w].revents == 0)
+                {
+                    continue;
+                }
+
+                auto& worker = *waiting_workers[w];
+                const auto& job = jobs[*worker.job];
+                job_result result;
+                sums.resize(size_t(job.row_count) * width);
+                if (!distributed::receive_all(worker.fd, &result, sizeof(result)) || result.id != job.id
+                    || !distributed::receive_all(worker.fd, sums.data(), sums.size() * sizeof(color)))
+                {
+                    std::println(std::cerr, "ERROR: Worker process {} failed, rescheduling its job", worker.pid);
+                    scheduler.abandon(*worker.job);
+                    drop(worker);
+                    continue;
+                }
+                worker.job.reset();
+                ++worker.jobs_done;
+                if (!scheduler.complete(job.id))
+                {
+                    continue;
+                }
+                cpu_seconds += result.cpu_seconds;
+                accept(job, std::move(sums));
+                sums = {};
+            }
+
+            std::print(std::clog, "\rJobs remaining {} ", scheduler.remaining());
+            std::clog.flush();
+        }
+
+        seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        job_count = jobs.size();
+        backup_count = scheduler.backup_count();
+        return true;
+    }
+
+    // Stop the workers, those still busy with a backup copy nobody waits for forcibly
+    void stop()
+    {
+        for (auto& worker : workers)
+        {
+            if (worker.fd < 0)
+            {
+                continue;
+            }
+            if (worker.job)
+            {
+                drop(worker);
+                continue;
+            }
+            const render_job quit;
+            distributed::send_all(worker.fd, &quit, sizeof(quit));
+            ::close(worker.fd);
+            worker.fd = -1;
+        }
+        for (const auto pid : pids)
+        {
+            ::waitpid(pid, nullptr, 0);
+        }
+        pids.clear();
+    }
+
+    // Report the last run. Processor time of the accepted jobs over the wall time is the speedup
+    // over one thread.
+    void print_stats(int threads_per_worker) const
+    {
+        const auto threads = int(workers.size()) * threads_per_worker;
+        const auto speedup = cpu_seconds / seconds;
+        std::println(std::clog, "Rendered {} jobs on {} workers in {:.2f} s with {} backup jobs: speedup {:.2f} "
+            "on {} threads, scaling efficiency {:.0f}%", job_count, workers.size(), seconds,
+            backup_count, speedup, threads, 100 * speedup / threads);
+        for (const auto& worker : workers)
+        {
+            std::println(std::clog, "Worker {}: {} jobs", worker.pid, worker.jobs_done);
+        }
+    }
+
+private:
+    struct worker_connection
+    {
+        int fd = -1;
+        pid_t pid = 0;
+        std::optional<size_t> job; // Job being rendered
+        int jobs_done = 0;
+    };
+
+    // Worker side: connect, introduce ourselves with the process id and serve the jobs
+    template<typename Serve>
+    static bool run_worker(const std::string& socket_path, const Serve& serve)
+    {
+        // The progress lines of every worker would garble the coordinator's
+        std::clog.setstate(std::ios::badbit);
+
+        const int fd = distributed::connect_socket(socket_path);
+        const pid_t pid = ::getpid();
+        return fd >= 0 && distributed::send_all(fd, &pid, sizeof(pid)) && serve(fd);
+    }
+
+    static void drop(worker_connection& worker)
+    {
+        ::kill(worker.pid, SIGKILL);
+        ::close(worker.fd);
+        worker.fd = -1;
+    }
+
+    std::vector<pid_t> pids;
+    std::vector<worker_connection> workers;
+    size_t job_count = 0;
+    size_t backup_count = 0;
+    double seconds = 0;
+    double cpu_seconds = 0;
+};
@@ -0,0 +1,369 @@
+#pragma once
+
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <condition_variable>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <print>
+#include <queue>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#include "camera.h"
+#include "distributed.h"
+#include "scene.h"
+#include "scene_file.h"
+#include "worker_pool.h"
+
+// One render job of the service. A client connects, sends a single line
+//   render <scene> out=<file> [width=N] [spp=N] [depth=N] [seed=N] [vfov=X]
+//          [lookfrom=X,Y,Z] [lookat=X,Y,Z] [priority=N]
+// and once the image is written gets back
+//   done <id> wait <ms> render <ms>
+// or "error <message>". Unset values keep those of the scene's camera. The file is a relative
+// path inside the output directory of the service.
+struct render_request
+{
+    uint64_t id = 0;
+    std::string scene;
+    std::string out; // Relative to the output directory
+    int priority = 0; // Higher runs first, equal priorities in arrival order
+    std::optional<int> width;
+    std::optional<int> samples_per_pixel;
+    std::optional<int> max_depth;
+    std::optional<uint32_t> seed;
+    std::optional<double> vfov;
+    std::optional<point3> lookfrom;
+    std::optional<point3> lookat;
+
+    int client = -1; // Connection the reply goes to
+    std::chrono::steady_clock::time_point queued;
+};
+
+// Whether out names a file inside the output directory: relative, and not climbing out of it
+inline bool inside_output_directory(const std::string& out)
+{
+    const std::filesystem::path path(out);
+    if (path.has_root_path())
+    {
+        return false;
+    }
+    const auto normal = path.lexically_normal();
+    return normal.has_filename() && *normal.begin() != "..";
+}
+
+// Parse the arguments of a render line, describing the first problem in error
+inline bool parse_render_request(const std::string& line, render_request& request, std::string& error)
+{
+    const auto parse_number = [](const std::string& text, auto& value)
+    {
+        const auto [end, ec] = std::from_chars(text.data(), text.data() + text.size(), value);
+        return ec == std::errc() && end == text.data() + text.size();
+    };
+    const auto parse_point = [&](const std::string& text, point3& p)
+    {
+        std::istringstream parts(text);
+        std::string part;
+        double xyz[3];
+        for (auto& coordinate : xyz)
+        {
+            if (!std::getline(parts, part, ',') || !parse_number(part, coordinate)) return false;
+        }
+        p = point3(xyz[0], xyz[1], xyz[2]);
+        return !std::getline(parts, part, ',');
+    };
+
+    std::istringstream words(line);
+    std::string command;
+    words >> command >> request.scene;
+    if (command != "render" || request.scene.empty())
+    {
+        error = "expected render <scene> out=<file> [options]";
+        return false;
+    }
+
+    std::string word;
+    while (words >> word)
+    {
+        const auto equals = word.find('=');
+        const auto key = word.substr(0, equals);
+        const auto value = equals == std::string::npos ? std::string() : word.substr(equals + 1);
+        bool ok = true;
+        if (value.empty()) ok = false;
+        else if (key == "out") ok = inside_output_directory(request.out = value);
+        else if (key == "width") ok = parse_number(value, request.width.emplace()) && *request.width > 0;
+        else if (key == "spp") ok = parse_number(value, request.samples_per_pixel.emplace()) && *request.samples_per_pixel > 0;
+        else if (key == "depth") ok = parse_number(value, request.max_depth.emplace()) && *request.max_depth > 0;
+        else if (key == "seed") ok = parse_number(value, request.seed.emplace());
+        else if (key == "vfov") ok = parse_number(value, request.vfov.emplace());
+        else if (key == "lookfrom") ok = parse_point(value, request.lookfrom.emplace());
+        else if (key == "lookat") ok = parse_point(value, request.lookat.emplace());
+        else if (key == "priority") ok = parse_number(value, request.priority);
+        else ok = false;
+        if (!ok)
+        {
+            error = std::format("bad option {}", word);
+            return false;
+        }
+    }
+    if (request.out.empty())
+    {
+        error = "missing out=<file>";
+        return false;
+    }
+    return true;
+}
+
+// Long running render server. Scenes are built once when added and stay in memory with their
+// acceleration structures, so a request only pays for its render. Requests arrive on a Unix
+// socket, wait in a priority queue and run one after another with the wavefront integrator on
+// one thread pool shared by all of them. Besides render, a client can send "stats" for the
+// latency and throughput so far, or "stop" to finish the queued jobs and exit.
+class render_service
+{
+public:
+    // Images are written below output_directory, which requests cannot leave
+    explicit render_service(const std::filesystem::path& output_directory = ".", int thread_count = 0)
+        : pool(thread_count)
+        , output_directory(std::filesystem::absolute(output_directory))
+    {}
+
+    // Build the scene now and keep it for every request that names it
+    void add_scene(const std::string& name, const std::function<void(scene&)>& build)
+    {
+        auto built = std::make_unique<scene>();
+        build(*built);
+        scenes[name] = std::move(built);
+    }
+
+    // Load a scene file now and keep it under the file name without extension
+    bool add_scene_file(const std::filesystem::path& filename)
+    {
+        auto loaded = std::make_unique<scene>();
+        if (!load_scene_file(filename, *loaded))
+        {
+            return false;
+        }
+        scenes[filename.stem().string()] = std::move(loaded);
+        return true;
+    }
+
+    // Serve requests on the socket at path until a client sends stop
+    bool serve(const std::string& path)
+    {
+        const int listener = distributed::listen_socket(path, 64);
+        if (listener < 0)
+        {
+            return false;
+        }
+        std::println(std::clog, "Serving {} scenes on {} with {} threads", scenes.size(), path, pool.size());
+
+        started = std::chrono::steady_clock::now();
+        std::thread acceptor([this, listener] { accept_requests(listener); });
+        while (true)
+        {
+            render_request request;
+            {
+                std::unique_lock lock(mutex);
+                ready.wait(lock, [this] { return stopping || !queue.empty(); });
+                if (queue.empty())
+                {
+                    break;
+                }
+                request = queue.top();
+                queue.pop();
+            }
+            run(request);
+        }
+
+        acceptor.join();
+        ::close(listener);
+        ::unlink(path.c_str());
+        std::println(std::clog, "{}", statistics());
+        return true;
+    }
+
+private:
+    // Queue order: higher priority first, then lower id
+    struct later_request
+    {
+        bool operator()(const render_request& a, const render_request& b) const
+        {
+            return a.priority != b.priority ? a.priority < b.priority : a.id > b.id;
+        }
+    };
+
+    void accept_requests(int listener)
+    {
+        while (true)
+        {
+            const int client = distributed::accept_connection(listener, -1);
+            if (client < 0)
+            {
+                continue;
+            }
+
+            // A client that connects and sends nothing must not stall the service
+            timeval timeout{1, 0};
+            ::setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+            std::string line;
+            if (!distributed::receive_line(client, line))
+            {
+                ::close(client);
+                continue;
+            }
+
+            if (line == "stats")
+            {
+                distributed::send_text(client, statistics() + "\n");
+                ::close(client);
+            }
+            else if (line == "stop")
+            {
+                distributed::send_text(client, "stopping\n");
+                ::close(client);
+                {
+                    std::lock_guard lock(mutex);
+                    stopping = true;
+                }
+                ready.notify_one();
+                return;
+            }
+            else
+            {
+                enqueue(client, line);
+            }
+        }
+    }
+
+    void enqueue(int client, const std::string& line)
+    {
+        render_request request;
+        std::string error;
+        if (!parse_render_request(line, request, error) || !scenes.contains(request.scene))
+        {
+            distributed::send_text(client, std::format("error {}\n", error.empty() ? "unknown scene " + request.scene : error));
+            ::close(client);
+            return;
+        }
+
+        request.client = client;
+        request.queued = std::chrono::steady_clock::now();
+        {
+            std::lock_guard lock(mutex);
+            request.id = next_id++;
+            queue.push(request);
+        }
+        ready.notify_one();
+    }
+
+    void run(const render_request& request)
+    {
+        const auto& built = *scenes.at(request.scene);
+        auto cam = built.cam;
+        if (request.width) cam.image_width = *request.width;
+        if (request.samples_per_pixel) cam.samples_per_pixel = *request.samples_per_pixel;
+        if (request.max_depth) cam.max_depth = *request.max_depth;
+        if (request.seed) cam.sampler_seed = *request.seed;
+        if (request.vfov) cam.vfov = *request.vfov;
+        if (request.lookfrom) cam.lookfrom = *request.lookfrom;
+        if (request.lookat) cam.lookat = *request.lookat;
+        cam.integrator = integrator_type::wavefront;
+        cam.shared_pool = &pool;
+
+        const auto start = std::chrono::steady_clock::now();
+        bool written = false;
+        {
+            std::ofstream out(output_directory / request.out, std::ios::binary);
+            if (out)
+            {
+                written = cam.render(built.world, built.lights, out) && out.flush();
+            }
+        }
+        const auto end = std::chrono::steady_clock::now();
+        const auto wait_ms = std::chrono::duration<double, std::milli>(start - request.queued).count();
+        const auto render_ms = std::chrono::duration<double, std::milli>(end - start).count();
+
+        if (!written)
+        {
+            std::println(std::cerr, "ERROR: Could not write {}", request.out);
+            distributed::send_text(request.client, std::format("error could not write {}\n", request.out));
+        }
+        else
+        {
+            std::println(std::clog, "Job {} {} {} spp: waited {:.1f} ms, rendered in {:.1f} ms", request.id,
+                request.scene, cam.samples_per_pixel, wait_ms, render_ms);
+            distributed::send_text(request.client, std::format("done {} wait {:.1f} render {:.1f}\n", request.id,
+                wait_ms, render_ms));
+        }
+        ::close(request.client);
+
+        std::lock_guard lock(mutex);
+        if (written)
+        {
+            latencies_ms.push_back(wait_ms + render_ms);
+            render_total_ms += render_ms;
+            const auto width = cam.image_width;
+            const auto height = std::max(1, int(width / cam.aspect_ratio));
+            samples_traced += double(width) * height * cam.samples_per_pixel;
+        }
+        else
+        {
+            ++failed;
+        }
+    }
+
+    // Jobs done so far, their throughput and latency from arrival to reply
+    std::string statistics()
+    {
+        std::lock_guard lock(mutex);
+        const auto uptime = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+        const auto done = latencies_ms.size();
+        auto sorted = latencies_ms;
+        std::sort(sorted.begin(), sorted.end());
+        const auto percentile = [&](double p) { return sorted.empty() ? 0.0 : sorted[size_t(p * (sorted.size() - 1) + 0.5)]; };
+        double total_ms = 0;
+        for (const auto ms : sorted)
+        {
+            total_ms += ms;
+        }
+
+        return std::format("jobs {} failed {} queued {} uptime {:.1f} s\n"
+            "throughput {:.2f} jobs/s {:.0f} samples/s\n"
+            "latency mean {:.1f} p50 {:.1f} p95 {:.1f} max {:.1f} ms, render mean {:.1f} ms",
+            done, failed, queue.size(), uptime,
+            done / uptime, samples_traced / uptime,
+            done ? total_ms / done : 0.0, percentile(0.5), percentile(0.95), sorted.empty() ? 0.0 : sorted.back(),
+            done ? render_total_ms / done : 0.0);
+    }
+
+    worker_pool pool;
+    std::filesystem::path output_directory;
+    std::map<std::string, std::unique_ptr<scene>> scenes;
+
+    std::mutex mutex;
+    std::condition_variable ready;
+    std::priority_queue<render_request, std::vector<render_request>, later_request> queue;
+    uint64_t next_id = 1;
+    bool stopping = false;
+
+    std::chrono::steady_clock::time_point started;
+    std::vector<double> latencies_ms;
+    double render_total_ms = 0;
+    double samples_traced = 0;
+    size_t failed = 0;
+};
@@ -69,6 +69,18 @@ public:
         return bdata.data() + y * bytes_per_scanline + x * bytes_per_pixel;
     }
 
+    // Return the address of the three linear RGB floats of the pixel at x,y, unclamped like an
+    // HDR file holds them. If there is no image data, returns magenta.
+    const float* linear_pixel_data(int x, int y) const
+    {
+        static float magenta[] = { 1, 0, 1 };
+        if (fdata == nullptr) return magenta;
+
+        x = clamp(x, 0, image_width);
+        y = clamp(y, 0, image_height);
+        return fdata + y * bytes_per_scanline + x * bytes_per_pixel;
+    }
+
 private:
     // Return the value clamped to the range [low, high).
     static int clamp(int x, int low, int high)
@@ -100,7 +112,7 @@ private:
     }
 
     const int bytes_per_pixel = 3;
-    float* fdata; // Linear floating point pixel data
+    float* fdata = nullptr; // Linear floating point pixel data
     std::vector<uint8_t> bdata; // Linear 8-bit pixel data
     int image_width = 0;
     int image_height = 0;
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <atomic>
 #include <cmath>
 #include <iostream>
 #include <limits>
@@ -17,11 +18,31 @@ constexpr double degrees_to_radians(double degrees)
     return degrees * pi / 180.0;
 }
 
+// Source of the values returned by random_double. While the camera traces a pixel sample it
+// installs a sampler here, so every draw along the path takes the next dimension of that
+// sample's low discrepancy point. Without one, draws are independent.
+class sample_stream
+{
+public:
+    virtual ~sample_stream() = default;
+    virtual double next() = 0;
+};
+
+inline thread_local sample_stream* active_sample_stream = nullptr;
+
 // Return a random real in [0, 1)
 constexpr double random_double() 
 {
-    static std::uniform_real_distribution<double> distribution(0.0, 1.0);
-    static std::mt19937 generator;
+    if (active_sample_stream)
+    {
+        return active_sample_stream->next();
+    }
+
+    // One generator per thread. The first thread to draw gets the default seed, so single
+    // threaded renders are unchanged, and every later thread gets a stream of its own.
+    static std::atomic<std::mt19937::result_type> next_seed = std::mt19937::default_seed;
+    thread_local std::uniform_real_distribution<double> distribution(0.0, 1.0);
+    thread_local std::mt19937 generator(next_seed++);
     return distribution(generator);
 }
 
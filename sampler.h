@@ -0,0 +1,375 @@
+#pragma once
+
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "rtweekend.h"
+
+enum class sampler_type
+{
+    independent, // Independent uniform draws from the global generator
+    random, // Independent uniform values hashed from pixel, sample index and dimension
+    sobol, // Owen scrambled and shuffled Sobol points, padded in pairs of dimensions
+    halton, // Halton points with a per pixel random rotation of every dimension
+    blue_noise // Shared Sobol points dithered per pixel with a blue noise mask
+};
+
+// Bit and hash helpers for the samplers
+namespace sampling
+{
+    inline uint32_t reverse_bits(uint32_t v)
+    {
+        v = ((v >> 1) & 0x55555555u) | ((v & 0x55555555u) << 1);
+        v = ((v >> 2) & 0x33333333u) | ((v & 0x33333333u) << 2);
+        v = ((v >> 4) & 0x0f0f0f0fu) | ((v & 0x0f0f0f0fu) << 4);
+        v = ((v >> 8) & 0x00ff00ffu) | ((v & 0x00ff00ffu) << 8);
+        return (v >> 16) | (v << 16);
+    }
+
+    inline uint32_t mix_bits(uint32_t v)
+    {
+        v ^= v >> 16;
+        v *= 0x7feb352du;
+        v ^= v >> 15;
+        v *= 0x846ca68bu;
+        v ^= v >> 16;
+        return v;
+    }
+
+    inline uint32_t hash(uint32_t a, uint32_t b)
+    {
+        return mix_bits(a ^ (mix_bits(b) + 0x9e3779b9u + (a << 6) + (a >> 2)));
+    }
+
+    inline uint32_t hash(uint32_t a, uint32_t b, uint32_t c)
+    {
+        return hash(hash(a, b), c);
+    }
+
+    // Fixed point fraction to a real in [0, 1)
+    inline double to_unit(uint32_t v)
+    {
+        return v * (1.0 / 4294967296.0);
+    }
+
+    // Hash based nested uniform (Owen) scramble of a 32 bit fixed point fraction
+    inline uint32_t owen_scramble(uint32_t v, uint32_t seed)
+    {
+        v = reverse_bits(v);
+        v ^= v * 0x3d20adeau;
+        v += seed;
+        v *= (seed >> 16) | 1;
+        v ^= v * 0x05526c56u;
+        v ^= v * 0x53a22864u;
+        return reverse_bits(v);
+    }
+
+    // First two dimensions of the Sobol sequence, a (0, 2)-sequence in base 2
+    inline void sobol_2d(uint32_t index, uint32_t& x, uint32_t& y)
+    {
+        x = reverse_bits(index);
+        y = 0;
+        for (uint32_t v = 1u << 31; index; index >>= 1, v ^= v >> 1)
+        {
+            if (index & 1)
+            {
+                y ^= v;
+            }
+        }
+    }
+
+    // Sample index of a pair of dimensions, shuffled so that different pairs are decorrelated
+    // while every power of two prefix of the samples keeps its stratification
+    inline double padded_sobol(uint32_t index, uint32_t dimension, uint32_t seed)
+    {
+        const auto pair_seed = hash(seed, dimension / 2);
+        uint32_t x;
+        uint32_t y;
+        sobol_2d(owen_scramble(index, pair_seed), x, y);
+        return dimension % 2 == 0
+            ? to_unit(owen_scramble(x, hash(pair_seed, 1)))
+            : to_unit(owen_scramble(y, hash(pair_seed, 2)));
+    }
+}
+
+// Produces the dimensions of one pixel sample at a time. The camera starts a sample, installs
+// the sampler as the active sample stream and every random_double along the path then reads
+// the next dimension.
+class sampler : public sample_stream
+{
+public:
+    void start_sample(int x, int y, uint32_t index)
+    {
+        pixel_x = uint32_t(x);
+        pixel_y = uint32_t(y);
+        sample_index = index;
+        dimension = 0;
+    }
+
+    // Continue a sample at a given dimension, for integrators that interleave many paths
+    void resume_sample(int x, int y, uint32_t index, uint32_t next_dimension)
+    {
+        start_sample(x, y, index);
+        dimension = next_dimension;
+    }
+
+    // Dimension the next draw will read
+    uint32_t current_dimension() const { return dimension; }
+
+    double next() override { return sample(dimension++); }
+
+protected:
+    // Value of one dimension of the current sample
+    virtual double sample(uint32_t dimension) const = 0;
+
+    uint32_t pixel_x = 0;
+    uint32_t pixel_y = 0;
+    uint32_t sample_index = 0;
+    uint32_t dimension = 0;
+};
+
+// Uniform random values hashed from the pixel, sample index and dimension. As noisy as the
+// independent draws of the global generator, but any sample of any pixel can be reproduced.
+class random_sampler final : public sampler
+{
+public:
+    explicit random_sampler(uint32_t seed = 0) : seed(seed) {}
+
+protected:
+    double sample(uint32_t dimension) const override
+    {
+        return sampling::to_unit(sampling::hash(sampling::hash(pixel_x, pixel_y, seed), sample_index, dimension));
+    }
+
+private:
+    uint32_t seed;
+};
+
+// Scrambled Sobol points. Dimensions are taken in pairs from the first two Sobol dimensions,
+// each pair Owen scrambled and index shuffled with its own per pixel seed. The points stay
+// well stratified for any sample count, best at powers of two.
+class sobol_sampler final : public sampler
+{
+public:
+    explicit sobol_sampler(uint32_t seed = 0) : seed(seed) {}
+
+protected:
+    double sample(uint32_t dimension) const override
+    {
+        return sampling::padded_sobol(sample_index, dimension, sampling::hash(pixel_x, pixel_y, seed));
+    }
+
+private:
+    uint32_t seed;
+};
+
+// Halton points, the radical inverse of the sample index in the n-th prime base for dimension
+// n. Every pixel rotates every dimension by its own random offset. Dimensions past the prime
+// table, where Halton points correlate badly, fall back to hashed uniform values.
+class halton_sampler final : public sampler
+{
+public:
+    explicit halton_sampler(uint32_t seed = 0) : seed(seed) {}
+
+protected:
+    double sample(uint32_t dimension) const override
+    {
+        const auto pixel_seed = sampling::hash(pixel_x, pixel_y, seed);
+        if (dimension >= primes.size())
+        {
+            return sampling::to_unit(sampling::hash(pixel_seed, sample_index, dimension));
+        }
+
+        auto value = radical_inverse(sample_index, primes[dimension])
+            + sampling::to_unit(sampling::hash(pixel_seed, dimension));
+        return value >= 1 ? value - 1 : value;
+    }
+
+private:
+    static double radical_inverse(uint32_t index, uint32_t base)
+    {
+        const double inv_base = 1.0 / base;
+        double inv_base_n = 1;
+        uint64_t reversed = 0;
+        while (index)
+        {
+            const auto next = index / base;
+            reversed = reversed * base + (index - next * base);
+            inv_base_n *= inv_base;
+            index = next;
+        }
+        return std::fmin(reversed * inv_base_n, 0x1.fffffffffffffp-1);
+    }
+
+    static constexpr std::array<uint32_t, 32> primes = {
+        2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37, 41, 43, 47, 53,
+        59, 61, 67, 71, 73, 79, 83, 89, 97, 101, 103, 107, 109, 113, 127, 131
+    };
+
+    uint32_t seed;
+};
+
+// Blue noise dithered sampling. All pixels share the same scrambled Sobol points and every
+// pixel rotates each dimension by a value from a blue noise mask, shifted per dimension. The
+// remaining error of neighbouring pixels is then anticorrelated, which at low sample counts
+// looks like fine grained noise that a viewer or a filter averages away.
+class blue_noise_sampler final : public sampler
+{
+public:
+    static constexpr int mask_size = 64;
+
+    explicit blue_noise_sampler(uint32_t seed = 0) : seed(seed) {}
+
+protected:
+    double sample(uint32_t dimension) const override
+    {
+        // Toroidal shift of the mask per dimension, so dimensions use decorrelated dithers
+        const auto shift = sampling::hash(dimension, seed);
+        const auto x = (pixel_x + (shift & 0xffff)) % mask_size;
+        const auto y = (pixel_y + (shift >> 16)) % mask_size;
+
+        auto value = sampling::padded_sobol(sample_index, dimension, seed) + mask()[y * mask_size + x];
+        return value >= 1 ? value - 1 : value;
+    }
+
+private:
+    // Blue noise threshold mask in [0, 1), made once with the void and cluster method
+    static const std::vector<double>& mask()
+    {
+        static const std::vector<double> values = void_and_cluster();
+        return values;
+    }
+
+    static std::vector<double> void_and_cluster()
+    {
+        constexpr int n = mask_size * mask_size;
+        constexpr double sigma = 1.9;
+
+        // Toroidal Gaussian energy kernel
+        std::vector<double> kernel(n);
+        for (int y = 0; y < mask_size; ++y)
+        {
+            for (int x = 0; x < mask_size; ++x)
+            {
+                const auto dx = std::min(x, mask_size - x);
+                const auto dy = std::min(y, mask_size - y);
+                kernel[y * mask_size + x] = std::exp(-(dx * dx + dy * dy) / (2 * sigma * sigma));
+            }
+        }
+
+        std::vector<char> on(n, 0);
+        std::vector<double> energy(n, 0.0);
+        const auto splat = [&](int p, double sign)
+        {
+            const auto px = p % mask_size;
+            const auto py = p / mask_size;
+            for (int y = 0; y < mask_size; ++y)
+            {
+                for (int x = 0; x < mask_size; ++x)
+                {
+                    const auto kx = (x - px + mask_size) % mask_size;
+                    const auto ky = (y - py + mask_size) % mask_size;
+                    energy[y * mask_size + x] += sign * kernel[ky * mask_size + kx];
+                }
+            }
+        };
+        // Tightest cluster is the set pixel with the highest energy, largest void the empty
+        // pixel with the lowest
+        const auto tightest_cluster = [&]
+        {
+            int best = -1;
+            for (int p = 0; p < n; ++p)
+            {
+                if (on[p] && (best < 0 || energy[p] > energy[best])) best = p;
+            }
+            return best;
+        };
+        const auto largest_void = [&]
+        {
+            int best = -1;
+            for (int p = 0; p < n; ++p)
+            {
+                if (!on[p] && (best < 0 || energy[p] < energy[best])) best = p;
+            }
+            return best;
+        };
+
+        // Initial binary pattern of a tenth of the pixels, relaxed until moving the tightest
+        // cluster lands it back in the same place
+        const int initial = n / 10;
+        uint32_t draw = 0;
+        for (int i = 0; i < initial; ++i)
+        {
+            int p;
+            do
+            {
+                p = int(sampling::hash(draw++, 0x5eed) % n);
+            } while (on[p]);
+            on[p] = 1;
+            splat(p, 1);
+        }
+        for (int iteration = 0; iteration < n; ++iteration)
+        {
+            const auto cluster = tightest_cluster();
+            on[cluster] = 0;
+            splat(cluster, -1);
+            const auto empty = largest_void();
+            on[empty] = 1;
+            splat(empty, 1);
+            if (empty == cluster)
+            {
+                break;
+            }
+        }
+
+        std::vector<int> rank(n, 0);
+        const auto prototype = on;
+        const auto prototype_energy = energy;
+
+        // Rank the initial points by removing tightest clusters
+        for (int r = initial - 1; r >= 0; --r)
+        {
+            const auto cluster = tightest_cluster();
+            on[cluster] = 0;
+            splat(cluster, -1);
+            rank[cluster] = r;
+        }
+
+        // Rank the rest by filling the largest voids
+        on = prototype;
+        energy = prototype_energy;
+        for (int r = initial; r < n; ++r)
+        {
+            const auto empty = largest_void();
+            on[empty] = 1;
+            splat(empty, 1);
+            rank[empty] = r;
+        }
+
+        std::vector<double> values(n);
+        for (int p = 0; p < n; ++p)
+        {
+            values[p] = (rank[p] + 0.5) / n;
+        }
+        return values;
+    }
+
+    uint32_t seed;
+};
+
+// Sampler for a camera, nullptr for independent sampling through the global generator
+inline std::unique_ptr<sampler> make_sampler(sampler_type type, uint32_t seed = 0)
+{
+    switch (type)
+    {
+        case sampler_type::random: return std::make_unique<random_sampler>(seed);
+        case sampler_type::sobol: return std::make_unique<sobol_sampler>(seed);
+        case sampler_type::halton: return std::make_unique<halton_sampler>(seed);
+        case sampler_type::blue_noise: return std::make_unique<blue_noise_sampler>(seed);
+        case sampler_type::independent: break;
+    }
+    return nullptr;
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include "camera.h"
+#include "hittable_list.h"
+#include "mapped_mesh.h"
+#include "material_table.h"
+#include "scene_arena.h"
+
+// Everything a scene function builds: the objects, the lights to sample and a camera set up to
+// view them. The arena and the material table own the objects, so a scene can stay in memory
+// and be rendered any number of times.
+struct scene
+{
+    scene_arena arena;
+    material_table materials{&arena};
+    hittable_list world;
+    hittable_list lights;
+    camera cam;
+    std::vector<const mapped_mesh*> meshes; // Out-of-core meshes among the objects, for their paging statistics
+
+    // Drop every object and reset the camera, as after a failed load. The arena keeps their
+    // memory until the scene goes away.
+    void clear()
+    {
+        world.clear();
+        lights.clear();
+        meshes.clear();
+        materials.clear();
+        cam = camera();
+    }
+};
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+#include <utility>
+
+// Monotonic arena for scene construction. Primitives, materials, textures and BVH nodes are
+// carved out of large contiguous blocks in build order, which keeps related objects close
+// together for traversal, and all blocks are released in one step when the arena goes away.
+//
+// Objects are still handed out as shared_ptr (allocated with std::allocate_shared), so the
+// existing hittable interfaces are unchanged. Their destructors run as usual, only the memory
+// itself is never returned piecemeal. The arena must outlive every object allocated from it,
+// so declare it first in a scene function.
+class scene_arena : public std::pmr::memory_resource
+{
+public:
+    explicit scene_arena(size_t initial_block_size = 64 * 1024)
+        : blocks(initial_block_size, &upstream)
+    {}
+
+    scene_arena(const scene_arena&) = delete;
+    scene_arena& operator=(const scene_arena&) = delete;
+
+    template<typename T, typename... Args>
+    std::shared_ptr<T> make(Args&&... args)
+    {
+        ++object_count;
+        return std::allocate_shared<T>(std::pmr::polymorphic_allocator<T>(this), std::forward<Args>(args)...);
+    }
+
+    // Bytes requested by objects allocated from the arena, including shared_ptr control blocks
+    size_t bytes_used() const { return used; }
+    // Bytes reserved from the system heap in large blocks
+    size_t bytes_reserved() const { return upstream.reserved; }
+    size_t objects() const { return object_count; }
+
+private:
+    // Upstream of the monotonic resource that counts the large blocks it hands out
+    class counting_resource : public std::pmr::memory_resource
+    {
+    public:
+        size_t reserved = 0;
+
+    private:
+        void* do_allocate(size_t bytes, size_t alignment) override
+        {
+            reserved += bytes;
+            return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+        }
+
+        void do_deallocate(void* p, size_t bytes, size_t alignment) override
+        {
+            std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+        }
+
+        bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override
+        {
+            return this == &other;
+        }
+    };
+
+    void* do_allocate(size_t bytes, size_t alignment) override
+    {
+        used += bytes;
+        return blocks.allocate(bytes, alignment);
+    }
+
+    void do_deallocate(void*, size_t, size_t) override
+    {
+        // Monotonic: memory is only released when the whole arena is destroyed
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override
+    {
+        return this == &other;
+    }
+
+    counting_resource upstream;
+    std::pmr::monotonic_buffer_resource blocks;
+    size_t used = 0;
+    size_t object_count = 0;
+};
+
+// Allocate a scene object from the arena when one is given, otherwise from the general heap
+template<typename T, typename... Args>
+std::shared_ptr<T> make_scene_object(scene_arena* arena, Args&&... args)
+{
+    if (arena)
+    {
+        return arena->make<T>(std::forward<Args>(args)...);
+    }
+
+    return std::make_shared<T>(std::forward<Args>(args)...);
+}
@@ -0,0 +1,1131 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <print>
+#include <span>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "box.h"
+#include "constant_medium.h"
+#include "mapped_file.h"
+#include "mapped_mesh.h"
+#include "primitive_groups.h"
+#include "quad.h"
+#include "scene.h"
+#include "sphere.h"
+#include "triangle.h"
+#include "uniform_grid.h"
+
+// Text scene files. One statement per line, '#' starts a comment. C is a color, P a point and
+// V a vector, each three numbers. TEX is the name of a texture or a color for a solid one.
+//
+//   camera [width N] [aspect X] [spp N] [depth N] [vfov X] [lookfrom P] [lookat P] [vup V]
+//          [defocus X] [focus X] [background C]
+//   texture NAME solid C | checker SCALE TEX TEX | image FILE | noise SCALE
+//   material NAME lambertian TEX | metal C FUZZ | dielectric IOR | light TEX | isotropic TEX
+//               | glossy C EXPONENT
+//   transform [rotate DEGREES] [translate V]   rotate about Y and then move every later shape,
+//                                              a bare transform resets it
+//   sphere P RADIUS MATERIAL
+//   moving_sphere P P RADIUS MATERIAL
+//   quad P V V MATERIAL
+//   triangle P V V MATERIAL
+//   box P P MATERIAL
+//   mesh FILE MATERIAL [budget MIB]   packed mesh rendered from its mapping, see mapped_mesh
+//   group grid [density X]      later shapes go into a new uniform_grid with X cells per
+//                               shape, for many similar shapes filling a volume
+//   group bvh                   later shapes go back into the hierarchies, the default
+//   environment FILE [scale X]  equirectangular HDR image lighting the scene from every
+//                               direction, seen by missing rays and sampled as a light
+//   medium DENSITY TEX SHAPE    constant density volume inside the boundary SHAPE
+//   light SHAPE                 shape the renderer aims its light samples at
+//
+// SHAPE is a shape statement without the material. A light shape only guides sampling, the
+// emitter needs its own shape with a light material. Light samples only gather emitted light,
+// so a light shape around anything but an emitter wastes them.
+//
+// The first load compiles the file into FILE.cache: flat records of the textures, materials
+// and shapes, with every shape type's records in the order of its built hierarchy followed by
+// the hierarchy nodes. Grids are not saved, they are built again in one pass over their
+// shapes. Later loads map the cache, create the objects from the records in order and take
+// over the nodes, so nothing else is parsed, sorted or built again.
+namespace scene_file
+{
+    constexpr uint32_t none = UINT32_MAX;
+
+    enum class shape_type : uint32_t
+    {
+        sphere,
+        moving_sphere,
+        quad,
+        triangle,
+        box,
+        oriented_box
+    };
+
+    // One shape without pointers. Spheres use a, b for a moving one, and size as the radius.
+    // Quads and triangles use a, b, c as Q, u, v. Boxes use a and b as corners, oriented boxes
+    // also c as the offset and size as the angle.
+    struct shape_record
+    {
+        shape_type type = shape_type::sphere;
+        uint32_t material = none;
+        vec3 a;
+        vec3 b;
+        vec3 c;
+        double size = 0;
+    };
+
+    // A packed mesh file, not transformed
+    struct mesh_record
+    {
+        uint32_t name = none; // Offset of the file name in the string table
+        uint32_t material = none;
+        uint64_t resident_budget = 0; // Bytes, 0 for none
+    };
+
+    // A group of shapes traversed with a uniform_grid, the next count grid shapes
+    struct grid_record
+    {
+        uint64_t count = 0;
+        double density = uniform_grid::default_density;
+    };
+
+    struct medium_record
+    {
+        shape_record boundary;
+        double density = 0;
+        uint32_t texture = none;
+    };
+
+    enum class texture_type : uint32_t
+    {
+        solid,
+        checker,
+        image,
+        noise
+    };
+
+    struct texture_record
+    {
+        texture_type type = texture_type::solid;
+        uint32_t even = none; // Textures of a checker, defined before it
+        uint32_t odd = none;
+        uint32_t name = none; // Offset of the image file name in the string table
+        double scale = 1;
+        color albedo;
+    };
+
+    enum class material_type : uint32_t
+    {
+        lambertian,
+        metal,
+        dielectric,
+        light,
+        isotropic,
+        glossy
+    };
+
+    struct material_record
+    {
+        material_type type = material_type::lambertian;
+        uint32_t texture = none;
+        color albedo;
+        double parameter = 0; // Fuzz, refraction index or exponent
+    };
+
+    // Camera settings, with the defaults of camera
+    struct camera_record
+    {
+        int32_t image_width = 100;
+        int32_t samples_per_pixel = 10;
+        int32_t max_depth = 10;
+        double aspect_ratio = 1.0;
+        double vfov = 90;
+        point3 lookfrom = point3(0, 0, 0);
+        point3 lookat = point3(0, 0, -1);
+        vec3 vup = vec3(0, 1, 0);
+        double defocus_angle = 0;
+        double focus_distance = 10;
+        color background;
+        uint32_t environment = none; // Offset of the environment image name in the string table
+        double environment_scale = 1;
+    };
+
+    // Hierarchies of primitive_groups: spheres, quads, triangles, boxes and oriented boxes over
+    // shape records, and media over medium records
+    constexpr int shape_groups = 5;
+    constexpr int group_count = shape_groups + 1;
+
+    inline int shape_group(shape_type type)
+    {
+        switch (type)
+        {
+            case shape_type::sphere:
+            case shape_type::moving_sphere: return 0;
+            case shape_type::quad: return 1;
+            case shape_type::triangle: return 2;
+            case shape_type::box: return 3;
+            case shape_type::oriented_box: return 4;
+        }
+        return -1;
+    }
+
+    // A parsed scene file
+    struct description
+    {
+        camera_record camera;
+        std::vector<texture_record> textures;
+        std::vector<material_record> materials;
+        std::string strings;
+        std::array<std::vector<shape_record>, shape_groups> shapes;
+        std::vector<medium_record> media;
+        std::vector<mesh_record> meshes;
+        std::vector<shape_record> lights;
+        std::vector<grid_record> grids;
+        std::vector<shape_record> grid_shapes;
+    };
+
+    // The records of a scene, from a description or from a mapped cache
+    struct view
+    {
+        camera_record camera;
+        std::span<const texture_record> textures;
+        std::span<const material_record> materials;
+        std::string_view strings;
+        std::array<std::span<const shape_record>, shape_groups> shapes;
+        std::span<const medium_record> media;
+        std::span<const mesh_record> meshes;
+        std::span<const shape_record> lights;
+        std::span<const grid_record> grids;
+        std::span<const shape_record> grid_shapes;
+        std::array<std::span<const std::byte>, group_count> nodes; // Saved hierarchies, empty to build
+    };
+
+    inline view view_of(const description& d)
+    {
+        view v;
+        v.camera = d.camera;
+        v.textures = d.textures;
+        v.materials = d.materials;
+        v.strings = d.strings;
+        for (int g = 0; g < shape_groups; ++g)
+        {
+            v.shapes[g] = d.shapes[g];
+        }
+        v.media = d.media;
+        v.meshes = d.meshes;
+        v.lights = d.lights;
+        v.grids = d.grids;
+        v.grid_shapes = d.grid_shapes;
+        return v;
+    }
+
+    // Whitespace separated words of one statement
+    class tokens
+    {
+    public:
+        explicit tokens(const std::string& line)
+        {
+            std::istringstream in(line.substr(0, line.find('#')));
+            std::string word;
+            while (in >> word)
+            {
+                words.push_back(word);
+            }
+        }
+
+        bool empty() const { return next == words.size(); }
+
+        bool peek_number() const
+        {
+            double value;
+            return !empty() && parse(words[next], value);
+        }
+
+        bool word(std::string& value)
+        {
+            if (empty()) return false;
+            value = words[next++];
+            return true;
+        }
+
+        template<typename T>
+        bool number(T& value)
+        {
+            return !empty() && parse(words[next++], value);
+        }
+
+        bool vector(vec3& value)
+        {
+            double xyz[3];
+            if (!number(xyz[0]) || !number(xyz[1]) || !number(xyz[2])) return false;
+            value = vec3(xyz[0], xyz[1], xyz[2]);
+            return true;
+        }
+
+    private:
+        template<typename T>
+        static bool parse(const std::string& text, T& value)
+        {
+            const auto [end, ec] = std::from_chars(text.data(), text.data() + text.size(), value);
+            return ec == std::errc() && end == text.data() + text.size();
+        }
+
+        std::vector<std::string> words;
+        size_t next = 0;
+    };
+
+    // Rotation about Y followed by a move, applied to the shapes as they are read
+    struct transform
+    {
+        double angle = 0;
+        vec3 offset;
+
+        vec3 rotate(const vec3& v) const
+        {
+            if (angle == 0) return v;
+            const auto radians = degrees_to_radians(angle);
+            const auto s = std::sin(radians);
+            const auto c = std::cos(radians);
+            return vec3(c * v.x() + s * v.z(), v.y(), -s * v.x() + c * v.z());
+        }
+
+        void apply(shape_record& shape) const
+        {
+            switch (shape.type)
+            {
+                case shape_type::moving_sphere:
+                    shape.b = rotate(shape.b) + offset;
+                    [[fallthrough]];
+                case shape_type::sphere:
+                    shape.a = rotate(shape.a) + offset;
+                    break;
+                case shape_type::quad:
+                case shape_type::triangle:
+                    shape.a = rotate(shape.a) + offset;
+                    shape.b = rotate(shape.b);
+                    shape.c = rotate(shape.c);
+                    break;
+                case shape_type::box:
+                    if (angle != 0)
+                    {
+                        shape.type = shape_type::oriented_box;
+                        shape.c = offset;
+                        shape.size = angle;
+                    }
+                    else
+                    {
+                        shape.a += offset;
+                        shape.b += offset;
+                    }
+                    break;
+                case shape_type::oriented_box:
+                    break;
+            }
+        }
+    };
+
+    class parser
+    {
+    public:
+        explicit parser(const std::string& source) : source(source) {}
+
+        bool parse(const std::string& text, description& out)
+        {
+            std::istringstream lines(text);
+            std::string line;
+            while (std::getline(lines, line))
+            {
+                ++line_number;
+                tokens words(line);
+                if (!words.empty() && !statement(words, out))
+                {
+                    return false;
+                }
+            }
+
+            if (out.lights.empty() && out.camera.environment == none)
+            {
+                std::println(std::cerr, "ERROR: {}: No light shapes or environment to sample", source);
+                return false;
+            }
+            return true;
+        }
+
+    private:
+        bool fail(const std::string& message) const
+        {
+            std::println(std::cerr, "ERROR: {}:{}: {}", source, line_number, message);
+            return false;
+        }
+
+        bool statement(tokens& words, description& out)
+        {
+            std::string keyword;
+            words.word(keyword);
+
+            if (keyword == "camera") return camera(words, out.camera);
+            if (keyword == "texture") return texture(words, out);
+            if (keyword == "material") return material(words, out);
+            if (keyword == "transform") return set_transform(words);
+            if (keyword == "group") return group(words, out);
+            if (keyword == "environment") return environment(words, out);
+
+            if (keyword == "medium")
+            {
+                medium_record medium;
+                if (!words.number(medium.density) || medium.density <= 0) return fail("Expected a positive density");
+                if (!texture_reference(words, out, medium.texture)) return false;
+                std::string kind;
+                if (!words.word(kind) || !shape(kind, words, medium.boundary)) return fail("Expected a boundary shape");
+                out.media.push_back(medium);
+                return words.empty() || fail("Unexpected words after the medium");
+            }
+
+            if (keyword == "mesh")
+            {
+                mesh_record mesh;
+                std::string file;
+                std::string name;
+                if (!words.word(file) || !words.word(name) || !materials.contains(name))
+                {
+                    return fail("Expected mesh FILE MATERIAL");
+                }
+                if (current.angle != 0 || current.offset.length_squared() != 0)
+                {
+                    return fail("Meshes cannot be transformed, pack them in place");
+                }
+                std::string key;
+                double mib = 0;
+                if (words.word(key) && (key != "budget" || !words.number(mib) || mib <= 0))
+                {
+                    return fail("Expected budget MIB");
+                }
+                mesh.name = uint32_t(out.strings.size());
+                out.strings += file;
+                out.strings += '\0';
+                mesh.material = materials[name];
+                mesh.resident_budget = uint64_t(mib * 1024 * 1024);
+                out.meshes.push_back(mesh);
+                return words.empty() || fail("Unexpected words after the mesh");
+            }
+
+            if (keyword == "light")
+            {
+                shape_record light;
+                std::string kind;
+                if (!words.word(kind) || !shape(kind, words, light)) return fail("Expected a light shape");
+                out.lights.push_back(light);
+                return words.empty() || fail("Unexpected words after the light");
+            }
+
+            shape_record record;
+            if (!shape(keyword, words, record))
+            {
+                return fail(std::format("Unknown statement or bad {}", keyword));
+            }
+            std::string name;
+            if (!words.word(name) || !materials.contains(name)) return fail("Expected a defined material");
+            record.material = materials[name];
+            if (gridded)
+            {
+                out.grid_shapes.push_back(record);
+                ++out.grids.back().count;
+            }
+            else
+            {
+                out.shapes[shape_group(record.type)].push_back(record);
+            }
+            return words.empty() || fail("Unexpected words after the shape");
+        }
+
+        bool camera(tokens& words, camera_record& cam)
+        {
+            std::string key;
+            while (words.word(key))
+            {
+                bool ok = true;
+                if (key == "width") ok = words.number(cam.image_width) && cam.image_width > 0;
+                else if (key == "aspect") ok = words.number(cam.aspect_ratio) && cam.aspect_ratio > 0;
+                else if (key == "spp") ok = words.number(cam.samples_per_pixel) && cam.samples_per_pixel > 0;
+                else if (key == "depth") ok = words.number(cam.max_depth) && cam.max_depth > 0;
+                else if (key == "vfov") ok = words.number(cam.vfov);
+                else if (key == "lookfrom") ok = words.vector(cam.lookfrom);
+                else if (key == "lookat") ok = words.vector(cam.lookat);
+                else if (key == "vup") ok = words.vector(cam.vup);
+                else if (key == "defocus") ok = words.number(cam.defocus_angle);
+                else if (key == "focus") ok = words.number(cam.focus_distance);
+                else if (key == "background") ok = words.vector(cam.background);
+                else ok = false;
+                if (!ok) return fail(std::format("Bad camera setting {}", key));
+            }
+            return true;
+        }
+
+        bool texture(tokens& words, description& out)
+        {
+            std::string name;
+            std::string kind;
+            if (!words.word(name) || !words.word(kind)) return fail("Expected texture NAME KIND");
+            if (textures.contains(name)) return fail(std::format("Texture {} is already defined", name));
+
+            texture_record record;
+            bool ok = true;
+            if (kind == "solid")
+            {
+                record.type = texture_type::solid;
+                ok = words.vector(record.albedo);
+            }
+            else if (kind == "checker")
+            {
+                record.type = texture_type::checker;
+                ok = words.number(record.scale) && record.scale > 0;
+                if (!ok || !texture_reference(words, out, record.even) || !texture_reference(words, out, record.odd))
+                {
+                    return fail("Expected checker SCALE TEX TEX");
+                }
+            }
+            else if (kind == "image")
+            {
+                record.type = texture_type::image;
+                std::string file;
+                ok = words.word(file);
+                record.name = uint32_t(out.strings.size());
+                out.strings += file;
+                out.strings += '\0';
+            }
+            else if (kind == "noise")
+            {
+                record.type = texture_type::noise;
+                ok = words.number(record.scale);
+            }
+            else
+            {
+                return fail(std::format("Unknown texture type {}", kind));
+            }
+            if (!ok || !words.empty()) return fail(std::format("Bad {} texture", kind));
+
+            textures[name] = uint32_t(out.textures.size());
+            out.textures.push_back(record);
+            return true;
+        }
+
+        // A texture name, or a color that becomes a new solid texture
+        bool texture_reference(tokens& words, description& out, uint32_t& index)
+        {
+            if (words.peek_number())
+            {
+                texture_record solid;
+                if (!words.vector(solid.albedo)) return fail("Expected a color");
+                index = uint32_t(out.textures.size());
+                out.textures.push_back(solid);
+                return true;
+            }
+
+            std::string name;
+            if (!words.word(name) || !textures.contains(name)) return fail("Expected a color or a defined texture");
+            index = textures[name];
+            return true;
+        }
+
+        bool material(tokens& words, description& out)
+        {
+            std::string name;
+            std::string kind;
+            if (!words.word(name) || !words.word(kind)) return fail("Expected material NAME KIND");
+            if (materials.contains(name)) return fail(std::format("Material {} is already defined", name));
+
+            material_record record;
+            bool ok = true;
+            if (kind == "lambertian" || kind == "light" || kind == "isotropic")
+            {
+                record.type = kind == "lambertian" ? material_type::lambertian
+                    : kind == "light" ? material_type::light : material_type::isotropic;
+                if (!texture_reference(words, out, record.texture)) return false;
+            }
+            else if (kind == "metal")
+            {
+                record.type = material_type::metal;
+                ok = words.vector(record.albedo) && words.number(record.parameter);
+            }
+            else if (kind == "dielectric")
+            {
+                record.type = material_type::dielectric;
+                ok = words.number(record.parameter);
+            }
+            else if (kind == "glossy")
+            {
+                record.type = material_type::glossy;
+                ok = words.vector(record.albedo) && words.number(record.parameter);
+            }
+            else
+            {
+                return fail(std::format("Unknown material type {}", kind));
+            }
+            if (!ok || !words.empty()) return fail(std::format("Bad {} material", kind));
+
+            materials[name] = uint32_t(out.materials.size());
+            out.materials.push_back(record);
+            return true;
+        }
+
+        bool set_transform(tokens& words)
+        {
+            current = transform{};
+            std::string key;
+            while (words.word(key))
+            {
+                const bool ok = key == "rotate" ? words.number(current.angle)
+                    : key == "translate" ? words.vector(current.offset) : false;
+                if (!ok) return fail(std::format("Bad transform {}", key));
+            }
+            return true;
+        }
+
+        bool environment(tokens& words, description& out)
+        {
+            std::string file;
+            if (!words.word(file)) return fail("Expected environment FILE");
+            std::string key;
+            if (words.word(key) && (key != "scale" || !words.number(out.camera.environment_scale)
+                || out.camera.environment_scale <= 0))
+            {
+                return fail("Expected scale X");
+            }
+            out.camera.environment = uint32_t(out.strings.size());
+            out.strings += file;
+            out.strings += '\0';
+            return words.empty() || fail("Unexpected words after the environment");
+        }
+
+        bool group(tokens& words, description& out)
+        {
+            std::string kind;
+            if (!words.word(kind) || (kind != "grid" && kind != "bvh")) return fail("Expected group grid or group bvh");
+            gridded = kind == "grid";
+            if (gridded)
+            {
+                grid_record grid;
+                std::string key;
+                if (words.word(key) && (key != "density" || !words.number(grid.density) || grid.density <= 0))
+                {
+                    return fail("Expected density X");
+                }
+                out.grids.push_back(grid);
+            }
+            return words.empty() || fail("Unexpected words after the group");
+        }
+
+        // The numbers of a shape statement, transformed
+        bool shape(const std::string& kind, tokens& words, shape_record& record)
+        {
+            bool ok = false;
+            if (kind == "sphere")
+            {
+                record.type = shape_type::sphere;
+                ok = words.vector(record.a) && words.number(record.size);
+            }
+            else if (kind == "moving_sphere")
+            {
+                record.type = shape_type::moving_sphere;
+                ok = words.vector(record.a) && words.vector(record.b) && words.number(record.size);
+            }
+            else if (kind == "quad" || kind == "triangle")
+            {
+                record.type = kind == "quad" ? shape_type::quad : shape_type::triangle;
+                ok = words.vector(record.a) && words.vector(record.b) && words.vector(record.c);
+            }
+            else if (kind == "box")
+            {
+                record.type = shape_type::box;
+                ok = words.vector(record.a) && words.vector(record.b);
+            }
+            if (ok)
+            {
+                current.apply(record);
+            }
+            return ok;
+        }
+
+        std::string source;
+        int line_number = 0;
+        std::map<std::string, uint32_t> textures;
+        std::map<std::string, uint32_t> materials;
+        transform current;
+        bool gridded = false; // Shapes go into the last grid
+    };
+
+    // Call f with the concrete shape of a record, false for an unknown type
+    template<typename F>
+    bool visit_shape(const shape_record& r, const material* mat, F&& f)
+    {
+        switch (r.type)
+        {
+            case shape_type::sphere: f(sphere(r.a, r.size, mat)); return true;
+            case shape_type::moving_sphere: f(sphere(r.a, r.b, r.size, mat)); return true;
+            case shape_type::quad: f(quad(r.a, r.b, r.c, mat)); return true;
+            case shape_type::triangle: f(triangle(r.a, r.b, r.c, mat)); return true;
+            case shape_type::box: f(aligned_box(r.a, r.b, mat)); return true;
+            case shape_type::oriented_box: f(oriented_box(r.a, r.b, r.size, r.c, mat)); return true;
+        }
+        return false;
+    }
+
+    // Restore group g from the saved nodes of the view, or build it and report the order its
+    // records must be saved in
+    template<typename T>
+    bool finish_group(primitive_groups& world, const view& v, int g, std::vector<uint32_t>* order)
+    {
+        using node = typename typed_bvh<T>::node;
+        auto& group = world.group<T>();
+        if (!order)
+        {
+            const auto& bytes = v.nodes[g];
+            return group.restore(reinterpret_cast<const node*>(bytes.data()), bytes.size() / sizeof(node));
+        }
+        group.build(order);
+        return true;
+    }
+
+    // Create the objects of a scene in s. Without orders the hierarchies are taken from the
+    // view, otherwise they are built and orders receives the order of every group's records.
+    inline bool create(const view& v, scene& s, std::array<std::vector<uint32_t>, group_count>* orders,
+        primitive_groups*& world)
+    {
+        const auto corrupt = [](const char* what)
+        {
+            std::println(std::cerr, "ERROR: Invalid {} in compiled scene", what);
+            return false;
+        };
+
+        std::vector<const ::texture*> textures;
+        for (const auto& t : v.textures)
+        {
+            switch (t.type)
+            {
+                case texture_type::solid:
+                    textures.push_back(s.materials.make_texture<solid_color>(t.albedo));
+                    break;
+                case texture_type::checker:
+                    if (t.even >= textures.size() || t.odd >= textures.size()) return corrupt("checker");
+                    textures.push_back(s.materials.make_texture<checker_texture>(t.scale, textures[t.even], textures[t.odd]));
+                    break;
+                case texture_type::image:
+                {
+                    if (t.name >= v.strings.size()) return corrupt("image name");
+                    const auto end = v.strings.find('\0', t.name);
+                    textures.push_back(s.materials.make_texture<image_texture>(v.strings.substr(t.name, end - t.name)));
+                    break;
+                }
+                case texture_type::noise:
+                    textures.push_back(s.materials.make_texture<noise_texture>(t.scale));
+                    break;
+                default:
+                    return corrupt("texture");
+            }
+        }
+
+        std::vector<const ::material*> materials;
+        for (const auto& m : v.materials)
+        {
+            const bool textured = m.type == material_type::lambertian || m.type == material_type::light
+                || m.type == material_type::isotropic;
+            if (textured && m.texture >= textures.size()) return corrupt("material texture");
+            switch (m.type)
+            {
+                case material_type::lambertian: materials.push_back(s.materials.make_material<lambertian>(textures[m.texture])); break;
+                case material_type::metal: materials.push_back(s.materials.make_material<metal>(m.albedo, m.parameter)); break;
+                case material_type::dielectric: materials.push_back(s.materials.make_material<dielectric>(m.parameter)); break;
+                case material_type::light: materials.push_back(s.materials.make_material<diffuse_light>(textures[m.texture])); break;
+                case material_type::isotropic: materials.push_back(s.materials.make_material<isotropic>(textures[m.texture])); break;
+                case material_type::glossy: materials.push_back(s.materials.make_material<glossy>(m.albedo, m.parameter)); break;
+                default: return corrupt("material");
+            }
+        }
+
+        auto groups = s.arena.make<primitive_groups>(&s.arena);
+        world = groups.get();
+        groups->group<sphere>().reserve(v.shapes[0].size());
+        groups->group<quad>().reserve(v.shapes[1].size());
+        groups->group<triangle>().reserve(v.shapes[2].size());
+        groups->group<aligned_box>().reserve(v.shapes[3].size());
+        groups->group<oriented_box>().reserve(v.shapes[4].size());
+        groups->group<constant_medium>().reserve(v.media.size());
+        const auto add = [&](auto&& shape) { groups->add(std::move(shape)); };
+        for (int g = 0; g < shape_groups; ++g)
+        {
+            for (const auto& shape : v.shapes[g])
+            {
+                if (shape.material >= materials.size() || shape_group(shape.type) != g
+                    || !visit_shape(shape, materials[shape.material], add))
+                {
+                    return corrupt("shape");
+                }
+            }
+        }
+
+        const auto make = [&](auto&& shape) -> std::shared_ptr<hittable>
+        {
+            return s.arena.make<std::decay_t<decltype(shape)>>(std::move(shape));
+        };
+        for (const auto& medium : v.media)
+        {
+            if (medium.texture >= textures.size()) return corrupt("medium");
+            std::shared_ptr<hittable> boundary;
+            if (!visit_shape(medium.boundary, nullptr, [&](auto&& shape) { boundary = make(std::move(shape)); }))
+            {
+                return corrupt("medium boundary");
+            }
+            groups->add(constant_medium(boundary, medium.density, textures[medium.texture]));
+        }
+        for (const auto& m : v.meshes)
+        {
+            if (m.name >= v.strings.size() || m.material >= materials.size()) return corrupt("mesh");
+            const auto end = v.strings.find('\0', m.name);
+            auto mesh = s.arena.make<mapped_mesh>(materials[m.material], size_t(m.resident_budget));
+            if (!mesh->open(std::string(v.strings.substr(m.name, end - m.name))))
+            {
+                return false;
+            }
+            groups->add(mesh);
+            s.meshes.push_back(mesh.get());
+        }
+        size_t grid_shape = 0;
+        for (const auto& g : v.grids)
+        {
+            if (g.count > v.grid_shapes.size() - grid_shape || !(g.density > 0)) return corrupt("grid");
+            hittable_list members;
+            for (const auto& shape : v.grid_shapes.subspan(grid_shape, size_t(g.count)))
+            {
+                if (shape.material >= materials.size()
+                    || !visit_shape(shape, materials[shape.material], [&](auto&& shape) { members.add(make(std::move(shape))); }))
+                {
+                    return corrupt("grid shape");
+                }
+            }
+            grid_shape += size_t(g.count);
+            if (!members.objects.empty())
+            {
+                groups->add(s.arena.make<uniform_grid>(members, g.density, &s.arena));
+            }
+        }
+        for (const auto& light : v.lights)
+        {
+            if (!visit_shape(light, nullptr, [&](auto&& shape) { s.lights.add(make(std::move(shape))); }))
+            {
+                return corrupt("light");
+            }
+        }
+
+        auto order = [&](int g) { return orders ? &(*orders)[g] : nullptr; };
+        if (!finish_group<sphere>(*groups, v, 0, order(0)) || !finish_group<quad>(*groups, v, 1, order(1))
+            || !finish_group<triangle>(*groups, v, 2, order(2)) || !finish_group<aligned_box>(*groups, v, 3, order(3))
+            || !finish_group<oriented_box>(*groups, v, 4, order(4)) || !finish_group<constant_medium>(*groups, v, 5, order(5)))
+        {
+            return corrupt("hierarchy");
+        }
+        groups->finish();
+        s.world.add(groups);
+
+        const auto& c = v.camera;
+        if (c.environment != none)
+        {
+            if (c.environment >= v.strings.size() || !(c.environment_scale > 0)) return corrupt("environment");
+            const auto end = v.strings.find('\0', c.environment);
+            auto environment = s.arena.make<environment_light>(v.strings.substr(c.environment, end - c.environment),
+                c.environment_scale);
+            if (!environment->valid())
+            {
+                return false;
+            }
+            s.cam.environment = environment.get();
+            s.lights.add(environment);
+        }
+        s.cam.image_width = c.image_width;
+        s.cam.samples_per_pixel = c.samples_per_pixel;
+        s.cam.max_depth = c.max_depth;
+        s.cam.aspect_ratio = c.aspect_ratio;
+        s.cam.vfov = c.vfov;
+        s.cam.lookfrom = c.lookfrom;
+        s.cam.lookat = c.lookat;
+        s.cam.vup = c.vup;
+        s.cam.defocus_angle = c.defocus_angle;
+        s.cam.focus_distance = c.focus_distance;
+        s.cam.background = c.background;
+        return true;
+    }
+
+    // Cache layout: the header, then every section 16 byte aligned
+    enum section : int
+    {
+        textures_section,
+        materials_section,
+        strings_section,
+        shapes_section, // One per shape group
+        media_section = shapes_section + shape_groups,
+        meshes_section,
+        lights_section,
+        grids_section,
+        grid_shapes_section,
+        nodes_section, // One per group
+        section_count = nodes_section + group_count
+    };
+
+    // Size and modification time of the text a cache was compiled from. A later load compares
+    // them instead of reading the text, like make does.
+    struct source_stamp
+    {
+        uint64_t size = 0;
+        int64_t modified = 0;
+
+        bool operator==(const source_stamp&) const = default;
+    };
+
+    inline bool stamp(const std::filesystem::path& filename, source_stamp& out)
+    {
+        std::error_code error;
+        out.size = std::filesystem::file_size(filename, error);
+        if (!error)
+        {
+            out.modified = std::filesystem::last_write_time(filename, error).time_since_epoch().count();
+        }
+        return !error;
+    }
+
+    // Raised with every change to the records or the header, so caches written with another
+    // layout are compiled again
+    constexpr uint32_t cache_version = 4;
+
+    struct cache_header
+    {
+        char magic[4] = {'R', 'T', 'S', 'C'};
+        uint32_t version = cache_version;
+        source_stamp source;
+        camera_record camera;
+        uint64_t offsets[section_count] = {};
+        uint64_t sizes[section_count] = {}; // Bytes
+    };
+
+    inline bool write_cache(const std::filesystem::path& filename, const source_stamp& source, const description& d,
+        const std::array<std::vector<std::byte>, group_count>& nodes)
+    {
+        std::array<std::span<const std::byte>, section_count> sections;
+        sections[textures_section] = std::as_bytes(std::span(d.textures));
+        sections[materials_section] = std::as_bytes(std::span(d.materials));
+        sections[strings_section] = std::as_bytes(std::span(d.strings));
+        for (int g = 0; g < shape_groups; ++g)
+        {
+            sections[shapes_section + g] = std::as_bytes(std::span(d.shapes[g]));
+        }
+        sections[media_section] = std::as_bytes(std::span(d.media));
+        sections[meshes_section] = std::as_bytes(std::span(d.meshes));
+        sections[lights_section] = std::as_bytes(std::span(d.lights));
+        sections[grids_section] = std::as_bytes(std::span(d.grids));
+        sections[grid_shapes_section] = std::as_bytes(std::span(d.grid_shapes));
+        for (int g = 0; g < group_count; ++g)
+        {
+            sections[nodes_section + g] = nodes[g];
+        }
+
+        cache_header header;
+        header.source = source;
+        header.camera = d.camera;
+        uint64_t offset = sizeof(cache_header);
+        for (int i = 0; i < section_count; ++i)
+        {
+            offset = (offset + 15) & ~uint64_t(15);
+            header.offsets[i] = offset;
+            header.sizes[i] = sections[i].size();
+            offset += sections[i].size();
+        }
+
+        auto partial = filename;
+        partial += ".partial";
+        {
+            std::ofstream out(partial, std::ios::binary | std::ios::trunc);
+            out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+            uint64_t written = sizeof(header);
+            for (int i = 0; i < section_count; ++i)
+            {
+                static const char padding[16] = {};
+                out.write(padding, std::streamsize(header.offsets[i] - written));
+                out.write(reinterpret_cast<const char*>(sections[i].data()), std::streamsize(sections[i].size()));
+                written = header.offsets[i] + sections[i].size();
+            }
+            if (!out.flush())
+            {
+                std::println(std::cerr, "ERROR: Could not write scene cache {}", partial.string());
+                return false;
+            }
+        }
+
+        std::error_code error;
+        std::filesystem::rename(partial, filename, error);
+        if (error)
+        {
+            std::println(std::cerr, "ERROR: Could not replace scene cache {}: {}", filename.string(), error.message());
+            return false;
+        }
+        return true;
+    }
+
+    // View of a mapped cache, false if it is not a cache of this source
+    inline bool read_cache(const mapped_file& file, const source_stamp& source, view& v)
+    {
+        if (file.size() < sizeof(cache_header))
+        {
+            return false;
+        }
+        const auto& header = *reinterpret_cast<const cache_header*>(file.data());
+        if (std::string_view(header.magic, 4) != "RTSC" || header.version != cache_version || !(header.source == source))
+        {
+            return false;
+        }
+
+        std::array<std::span<const std::byte>, section_count> sections;
+        for (int i = 0; i < section_count; ++i)
+        {
+            if (header.offsets[i] % 16 != 0 || header.offsets[i] > file.size()
+                || header.sizes[i] > file.size() - header.offsets[i])
+            {
+                return false;
+            }
+            sections[i] = std::span(file.data() + header.offsets[i], header.sizes[i]);
+        }
+
+        // Records are read in place from the mapping, which is page aligned
+        const auto records = [&]<typename T>(int i, std::span<const T>& out)
+        {
+            out = std::span(reinterpret_cast<const T*>(sections[i].data()), sections[i].size() / sizeof(T));
+            return sections[i].size() % sizeof(T) == 0;
+        };
+        v.camera = header.camera;
+        bool ok = records(textures_section, v.textures) && records(materials_section, v.materials)
+            && records(media_section, v.media) && records(meshes_section, v.meshes) && records(lights_section, v.lights)
+            && records(grids_section, v.grids) && records(grid_shapes_section, v.grid_shapes);
+        for (int g = 0; g < shape_groups; ++g)
+        {
+            ok = ok && records(shapes_section + g, v.shapes[g]);
+        }
+        for (int g = 0; g < group_count; ++g)
+        {
+            v.nodes[g] = sections[nodes_section + g];
+        }
+        v.strings = std::string_view(reinterpret_cast<const char*>(sections[strings_section].data()),
+            sections[strings_section].size());
+        return ok;
+    }
+
+    // Parse the text, create the scene and write the cache
+    inline bool compile(const std::string& text, const std::filesystem::path& filename, const source_stamp& source,
+        const std::filesystem::path& cache, scene& s)
+    {
+        description d;
+        parser p(filename.string());
+        if (!p.parse(text, d))
+        {
+            return false;
+        }
+
+        std::array<std::vector<uint32_t>, group_count> orders;
+        primitive_groups* world = nullptr;
+        if (!create(view_of(d), s, &orders, world))
+        {
+            return false;
+        }
+
+        // Save the records in the order the hierarchies left the primitives
+        const auto reorder = [](auto& records, const std::vector<uint32_t>& order)
+        {
+            auto sorted = records;
+            for (size_t i = 0; i < order.size(); ++i)
+            {
+                sorted[i] = records[order[i]];
+            }
+            records = std::move(sorted);
+        };
+        for (int g = 0; g < shape_groups; ++g)
+        {
+            reorder(d.shapes[g], orders[g]);
+        }
+        reorder(d.media, orders[shape_groups]);
+
+        std::array<std::vector<std::byte>, group_count> nodes;
+        const auto save = [&]<typename T>(int g)
+        {
+            const auto bytes = std::as_bytes(std::span(world->group<T>().hierarchy()));
+            nodes[g].assign(bytes.begin(), bytes.end());
+        };
+        save.template operator()<sphere>(0);
+        save.template operator()<quad>(1);
+        save.template operator()<triangle>(2);
+        save.template operator()<aligned_box>(3);
+        save.template operator()<oriented_box>(4);
+        save.template operator()<constant_medium>(5);
+
+        // The scene is usable without a cache
+        write_cache(cache, source, d, nodes);
+        return true;
+    }
+}
+
+// Load a text scene file into s, through its compiled cache FILE.cache while the text is
+// unchanged. The cache is written on the first load, after every change and when it cannot
+// be read.
+inline bool load_scene_file(const std::filesystem::path& filename, scene& s)
+{
+    const auto start = std::chrono::steady_clock::now();
+    const auto milliseconds = [&] { return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count(); };
+    scene_file::source_stamp source;
+    if (!scene_file::stamp(filename, source))
+    {
+        std::println(std::cerr, "ERROR: Could not open scene file {}", filename.string());
+        return false;
+    }
+
+    auto cache = filename;
+    cache += ".cache";
+    mapped_file mapping;
+    scene_file::view cached;
+    if (std::filesystem::exists(cache) && mapping.open(cache) && scene_file::read_cache(mapping, source, cached))
+    {
+        primitive_groups* world = nullptr;
+        if (scene_file::create(cached, s, nullptr, world))
+        {
+            std::println(std::clog, "Loaded {} from {} in {:.1f} ms", filename.string(), cache.string(), milliseconds());
+            return true;
+        }
+        // A damaged cache is replaced like a stale one
+        std::println(std::cerr, "ERROR: Could not load {} from {}, compiling it again", filename.string(), cache.string());
+        s.clear();
+    }
+    mapping.close();
+
+    std::ifstream in(filename, std::ios::binary);
+    if (!in)
+    {
+        std::println(std::cerr, "ERROR: Could not open scene file {}", filename.string());
+        return false;
+    }
+    std::ostringstream text;
+    text << in.rdbuf();
+    if (!scene_file::compile(text.str(), filename, source, cache, s))
+    {
+        return false;
+    }
+    std::println(std::clog, "Compiled {} in {:.1f} ms", filename.string(), milliseconds());
+    return true;
+}
@@ -0,0 +1,397 @@
+#pragma once
+
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <print>
+#include <unordered_map>
+#include <vector>
+
+#include "hittable.h"
+#include "material.h"
+#include "volume.h"
+
+// Sparse block-based voxel grid. Voxels live in 8^3 leaf bricks that are allocated only where
+// data exists, and a hash table maps brick coordinates to bricks. Memory use and traversal cost
+// follow the occupied bricks, not the bounding volume.
+//
+// The binary file format is a header followed by the active voxels:
+//     char[4] magic "RTVX", uint32 version (1), double origin[3], double voxel_size,
+//     uint64 count, count x { int32 i, int32 j, int32 k, float density }
+class sparse_voxel_grid
+{
+public:
+    static constexpr int brick_size = 8;
+    static constexpr int brick_voxels = brick_size * brick_size * brick_size;
+
+    struct brick
+    {
+        std::array<float, brick_voxels> values{};
+        float max_density = 0; // Majorant for delta tracking inside the brick
+    };
+
+    sparse_voxel_grid() = default;
+    sparse_voxel_grid(const point3& origin, double voxel_size)
+        : origin(origin)
+        , voxel_size(voxel_size)
+    {}
+
+    // Set the density of voxel i, j, k. Zero densities never allocate a brick.
+    void set(int i, int j, int k, float density)
+    {
+        const int voxel[3] = {i, j, k};
+        int coord[3];
+        int local[3];
+        split(voxel, coord, local);
+
+        auto found = brick_index.find(key(coord));
+        if (found == brick_index.end())
+        {
+            if (density <= 0)
+            {
+                return;
+            }
+            found = brick_index.emplace(key(coord), uint32_t(bricks.size())).first;
+            bricks.emplace_back();
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                brick_min[axis] = std::min(brick_min[axis], coord[axis]);
+                brick_max[axis] = std::max(brick_max[axis], coord[axis]);
+            }
+        }
+
+        auto& b = bricks[found->second];
+        b.values[local_index(local)] = density;
+        b.max_density = std::fmax(b.max_density, density);
+    }
+
+    double density(const point3& p) const
+    {
+        int voxel[3];
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            voxel[axis] = int(std::floor((p[axis] - origin[axis]) / voxel_size));
+        }
+
+        int coord[3];
+        int local[3];
+        split(voxel, coord, local);
+        const auto* b = find(coord);
+        return b ? b->values[local_index(local)] : 0.0;
+    }
+
+    const brick* find(const int (&coord)[3]) const
+    {
+        const auto found = brick_index.find(key(coord));
+        return found == brick_index.end() ? nullptr : &bricks[found->second];
+    }
+
+    // Bounds of the occupied bricks
+    aabb bounds() const
+    {
+        if (bricks.empty())
+        {
+            return aabb::empty;
+        }
+
+        const auto brick_extent = brick_size * voxel_size;
+        return aabb(origin + brick_extent * vec3(brick_min[0], brick_min[1], brick_min[2]),
+                    origin + brick_extent * vec3(brick_max[0] + 1, brick_max[1] + 1, brick_max[2] + 1));
+    }
+
+    size_t brick_count() const { return bricks.size(); }
+
+    size_t memory_bytes() const
+    {
+        return bricks.capacity() * sizeof(brick)
+            + brick_index.size() * (sizeof(uint64_t) + sizeof(uint32_t) + 2 * sizeof(void*));
+    }
+
+    // Walk the brick lattice cells crossed by the ray over [t_min, t_max] with a 3D-DDA.
+    // visit(b, t0, t1) gets nullptr for empty cells and returns true to stop.
+    template<typename F>
+    void traverse(const ray& r, double t_min, double t_max, F&& visit) const
+    {
+        if (bricks.empty())
+        {
+            return;
+        }
+
+        const auto brick_extent = brick_size * voxel_size;
+        const point3 lattice_origin = origin + brick_extent * vec3(brick_min[0], brick_min[1], brick_min[2]);
+        const double cell_size[3] = {brick_extent, brick_extent, brick_extent};
+        const int res[3] = {
+            brick_max[0] - brick_min[0] + 1,
+            brick_max[1] - brick_min[1] + 1,
+            brick_max[2] - brick_min[2] + 1
+        };
+
+        traverse_grid(r, t_min, t_max, lattice_origin, cell_size, res, [&](const int (&cell)[3], double t0, double t1)
+        {
+            const int coord[3] = {cell[0] + brick_min[0], cell[1] + brick_min[1], cell[2] + brick_min[2]};
+            return visit(find(coord), t0, t1);
+        });
+    }
+
+    // Replace the grid with the one in filename. On failure the grid is left as it was.
+    bool load(const std::filesystem::path& filename)
+    {
+        std::ifstream in(filename, std::ios::binary);
+        if (!in)
+        {
+            std::println(std::cerr, "ERROR: Could not open voxel file {}", filename.string());
+            return false;
+        }
+
+        char magic[4];
+        uint32_t version = 0;
+        point3 file_origin;
+        double file_voxel_size = 0;
+        uint64_t count = 0;
+        in.read(magic, sizeof(magic));
+        in.read(reinterpret_cast<char*>(&version), sizeof(version));
+        in.read(reinterpret_cast<char*>(file_origin.e), sizeof(file_origin.e));
+        in.read(reinterpret_cast<char*>(&file_voxel_size), sizeof(file_voxel_size));
+        in.read(reinterpret_cast<char*>(&count), sizeof(count));
+        if (!in || std::string_view(magic, 4) != "RTVX" || version != 1 || !std::isfinite(file_voxel_size)
+            || file_voxel_size <= 0)
+        {
+            std::println(std::cerr, "ERROR: {} is not a voxel file", filename.string());
+            return false;
+        }
+
+        sparse_voxel_grid loaded(file_origin, file_voxel_size);
+        for (uint64_t n = 0; n < count; ++n)
+        {
+            int32_t ijk[3];
+            float density;
+            in.read(reinterpret_cast<char*>(ijk), sizeof(ijk));
+            in.read(reinterpret_cast<char*>(&density), sizeof(density));
+            if (!in)
+            {
+                std::println(std::cerr, "ERROR: Truncated voxel file {}", filename.string());
+                return false;
+            }
+            if (!in_lattice(ijk))
+            {
+                std::println(std::cerr, "ERROR: {} is not a voxel file", filename.string());
+                return false;
+            }
+            loaded.set(ijk[0], ijk[1], ijk[2], density);
+        }
+
+        *this = std::move(loaded);
+        return true;
+    }
+
+    bool save(const std::filesystem::path& filename) const
+    {
+        std::ofstream out(filename, std::ios::binary);
+        if (!out)
+        {
+            std::println(std::cerr, "ERROR: Could not write voxel file {}", filename.string());
+            return false;
+        }
+
+        uint64_t count = 0;
+        for (const auto& b : bricks)
+        {
+            for (auto value : b.values)
+            {
+                count += value > 0;
+            }
+        }
+
+        const uint32_t version = 1;
+        out.write("RTVX", 4);
+        out.write(reinterpret_cast<const char*>(&version), sizeof(version));
+        out.write(reinterpret_cast<const char*>(origin.e), sizeof(origin.e));
+        out.write(reinterpret_cast<const char*>(&voxel_size), sizeof(voxel_size));
+        out.write(reinterpret_cast<const char*>(&count), sizeof(count));
+
+        for (const auto& [brick_key, index] : brick_index)
+        {
+            int coord[3];
+            unkey(brick_key, coord);
+            const auto& b = bricks[index];
+            for (int n = 0; n < brick_voxels; ++n)
+            {
+                if (b.values[n] <= 0)
+                {
+                    continue;
+                }
+
+                const int32_t ijk[3] = {
+                    coord[0] * brick_size + n % brick_size,
+                    coord[1] * brick_size + (n / brick_size) % brick_size,
+                    coord[2] * brick_size + n / (brick_size * brick_size)
+                };
+                out.write(reinterpret_cast<const char*>(ijk), sizeof(ijk));
+                out.write(reinterpret_cast<const char*>(&b.values[n]), sizeof(float));
+            }
+        }
+
+        return bool(out);
+    }
+
+    // Load a dense raw file of nx * ny * nz float32 densities, x varying fastest, keeping only
+    // the non-zero voxels. On failure the grid is left as it was.
+    bool load_raw(const std::filesystem::path& filename, int nx, int ny, int nz)
+    {
+        std::ifstream in(filename, std::ios::binary);
+        if (!in)
+        {
+            std::println(std::cerr, "ERROR: Could not open raw voxel file {}", filename.string());
+            return false;
+        }
+
+        sparse_voxel_grid loaded(origin, voxel_size);
+        std::vector<float> row(nx);
+        for (int k = 0; k < nz; ++k)
+        {
+            for (int j = 0; j < ny; ++j)
+            {
+                in.read(reinterpret_cast<char*>(row.data()), nx * sizeof(float));
+                if (!in)
+                {
+                    std::println(std::cerr, "ERROR: Truncated raw voxel file {}", filename.string());
+                    return false;
+                }
+                for (int i = 0; i < nx; ++i)
+                {
+                    loaded.set(i, j, k, row[i]);
+                }
+            }
+        }
+
+        *this = std::move(loaded);
+        return true;
+    }
+
+private:
+    // Split voxel coordinates into brick coordinates and the voxel offset inside the brick
+    static void split(const int (&voxel)[3], int (&coord)[3], int (&local)[3])
+    {
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            coord[axis] = voxel[axis] >= 0 ? voxel[axis] / brick_size : -((-voxel[axis] - 1) / brick_size) - 1;
+            local[axis] = voxel[axis] - coord[axis] * brick_size;
+        }
+    }
+
+    // Whether the brick of the voxel has a key, which packs each brick coordinate in 21 bits
+    static bool in_lattice(const int32_t (&voxel)[3])
+    {
+        constexpr int voxel_limit = lattice_limit * brick_size;
+        for (const auto v : voxel)
+        {
+            if (v <= -voxel_limit || v >= voxel_limit)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    static int local_index(const int (&local)[3])
+    {
+        return (local[2] * brick_size + local[1]) * brick_size + local[0];
+    }
+
+    // Brick coordinates packed into 21 bits each
+    static uint64_t key(const int (&coord)[3])
+    {
+        return (uint64_t(coord[0] + lattice_limit) << 42)
+             | (uint64_t(coord[1] + lattice_limit) << 21)
+             | uint64_t(coord[2] + lattice_limit);
+    }
+
+    static void unkey(uint64_t k, int (&coord)[3])
+    {
+        constexpr uint64_t mask = (uint64_t(1) << 21) - 1;
+        coord[0] = int((k >> 42) & mask) - lattice_limit;
+        coord[1] = int((k >> 21) & mask) - lattice_limit;
+        coord[2] = int(k & mask) - lattice_limit;
+    }
+
+    static constexpr int lattice_limit = 1 << 20;
+
+    point3 origin;
+    double voxel_size = 1;
+    std::vector<brick> bricks;
+    std::unordered_map<uint64_t, uint32_t> brick_index;
+    std::array<int, 3> brick_min = {lattice_limit, lattice_limit, lattice_limit};
+    std::array<int, 3> brick_max = {-lattice_limit, -lattice_limit, -lattice_limit};
+};
+
+// A participating medium backed by a sparse voxel grid. Rays walk the brick lattice with a
+// 3D-DDA, skip empty bricks in one step and delta track inside occupied ones against the brick
+// majorant. Collisions scatter through the isotropic phase function.
+class sparse_medium final : public hittable
+{
+public:
+    sparse_medium(std::shared_ptr<sparse_voxel_grid> grid, const texture* tex)
+        : grid(grid)
+        , phase_function(tex)
+    {
+        bbox = grid->bounds();
+    }
+
+    sparse_medium(std::shared_ptr<sparse_voxel_grid> grid, const color& albedo)
+        : grid(grid)
+        , phase_function(albedo)
+    {
+        bbox = grid->bounds();
+    }
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override
+    {
+        double t_min;
+        double t_max;
+        if (grid->brick_count() == 0 || !clip_to_box(r, bbox, ray_t, t_min, t_max))
+        {
+            return false;
+        }
+
+        const auto ray_length = r.direction().length();
+        const auto density = [&](const point3& p) { return grid->density(p); };
+        bool collided = false;
+        double t_hit = 0;
+
+        grid->traverse(r, t_min, t_max, [&](const sparse_voxel_grid::brick* b, double t0, double t1)
+        {
+            if (!b)
+            {
+                return false;
+            }
+            collided = delta_track(r, t0, t1, b->max_density, ray_length, density, t_hit);
+            return collided;
+        });
+
+        if (!collided)
+        {
+            return false;
+        }
+
+        rec.t = t_hit;
+        rec.p = r.at(rec.t);
+        rec.normal = vec3(1, 0, 0); // arbitrary
+        rec.front_face = true; // also arbitrary
+        rec.u = 0;
+        rec.v = 0;
+        rec.mat = &phase_function;
+
+        return true;
+    }
+
+    aabb bounding_box() const override { return bbox; }
+
+private:
+    std::shared_ptr<sparse_voxel_grid> grid;
+    isotropic phase_function; // Owned by the medium, handed out as a raw handle
+    aabb bbox;
+};
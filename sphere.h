@@ -4,11 +4,13 @@
 #include "vec3.h"
 #include "onb.h"
 
-class sphere : public hittable
+template<typename T> struct leaf_batch;
+
+class sphere final : public hittable
 {
 public:
     // Static Sphere
-    sphere(const point3& static_center, double radius, std::shared_ptr<material> mat)
+    sphere(const point3& static_center, double radius, const material* mat)
         : center(static_center, vec3(0, 0, 0))
         , radius(std::fmax(0, radius))
         , mat(mat)
@@ -18,7 +20,7 @@ public:
     }
 
     // Moving Sphere
-    sphere(const point3& center1, const point3& center2, double radius, std::shared_ptr<material> mat)
+    sphere(const point3& center1, const point3& center2, double radius, const material* mat)
         : center(center1, center2 - center1)
         , radius(std::fmax(0, radius))
         , mat(mat)
@@ -32,6 +34,14 @@ public:
 
     aabb bounding_box() const override { return bbox; }
 
+    int motion_segments() const override { return center.direction().near_zero() ? 0 : 1; }
+
+    aabb bounding_box_at(double time) const override
+    {
+        const auto rvec = vec3(radius, radius, radius);
+        return aabb(center.at(time) - rvec, center.at(time) + rvec);
+    }
+
     bool hit(const ray& r, interval ray_t, hit_record& rec) const override 
     {
         const auto current_center = center.at(r.time());
@@ -57,12 +67,7 @@ public:
                 return false;
             }
         }
-        rec.t = root;
-        rec.p = r.at(rec.t);
-        const auto outward_normal = (rec.p - current_center) / radius;
-        rec.set_face_normal(r, outward_normal);
-        get_sphere_uv(outward_normal, rec.u, rec.v);
-        rec.mat = mat;
+        set_hit_record(r, root, current_center, rec);
         return true;
     }
 
@@ -90,6 +95,19 @@ public:
     }
 
 private:
+    friend struct leaf_batch<sphere>;
+
+    // Fill the hit record for a ray that hits the sphere at parameter t
+    void set_hit_record(const ray& r, double t, const point3& current_center, hit_record& rec) const
+    {
+        rec.t = t;
+        rec.p = r.at(rec.t);
+        const auto outward_normal = (rec.p - current_center) / radius;
+        rec.set_face_normal(r, outward_normal);
+        get_sphere_uv(outward_normal, rec.u, rec.v);
+        rec.mat = mat;
+    }
+
     // p: a given point on the sphere of radius one, centered at the origin.
     // u: returned value [0,1] of angle around the Y axis from X=-1.
     // v: returned value [0,1] of angle from Y=-1 to Y=+1.
@@ -120,6 +138,6 @@ private:
 private:
     ray center;
     double radius;
-    std::shared_ptr<material> mat;
+    const material* mat;
     aabb bbox;
 };
\ No newline at end of file
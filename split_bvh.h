@@ -0,0 +1,629 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "hittable.h"
+#include "hittable_list.h"
+#include "quad.h"
+#include "triangle.h"
+
+// A flat bounding volume hierarchy built with the surface area heuristic and spatial splits
+// (SBVH), for scenes of large or long, thin triangles and quads. Their boxes overlap under any
+// partition of the objects, so a ray entering the overlap has to visit both children. Where the
+// best object split leaves such an overlap, the builder also tries splitting space: a plane
+// through the node, with every object crossing it referenced from both sides, each reference
+// bounded by the part of the shape on its side.
+//
+// An object can then sit in several leaves. The extra references are capped at max_duplication
+// times the object count; once the cap is used up, nodes only get object splits. Triangles and
+// quads are clipped exactly, any other object by its box.
+//
+// Bounds are taken once at build time, so like bvh_node it is meant for static objects.
+class split_bvh : public hittable
+{
+public:
+    static constexpr uint32_t max_leaf_size = 4;
+
+    struct settings
+    {
+        bool spatial_splits = true;
+        double max_duplication = 0.5;    // References added by spatial splits, per object
+        double overlap_threshold = 1e-5; // Child overlap, as a fraction of the root's area, above which spatial splits are tried
+    };
+
+    explicit split_bvh(const hittable_list& list)
+        : split_bvh(list, settings())
+    {}
+
+    split_bvh(const hittable_list& list, const settings& options)
+        : objects(list.objects)
+        , options(options)
+    {
+        bbox = aabb::empty;
+        if (objects.empty())
+        {
+            return;
+        }
+
+        std::vector<reference> references;
+        references.reserve(objects.size());
+        shapes.reserve(objects.size());
+        for (uint32_t i = 0; i < objects.size(); ++i)
+        {
+            shapes.push_back(shape::of(*objects[i]));
+            references.push_back({bounds::of(objects[i]->bounding_box()), i});
+        }
+
+        auto root = bounds::empty();
+        for (const auto& ref : references)
+        {
+            root.grow(ref.box);
+        }
+        root_area = root.area();
+        reference_limit = objects.size() + size_t(options.max_duplication * double(objects.size()));
+        reference_total = objects.size();
+
+        build(std::move(references), root, 0);
+        bbox = nodes[0].bbox;
+        shapes = {};
+        nodes.shrink_to_fit();
+        leaf_objects.shrink_to_fit();
+    }
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override
+    {
+        if (nodes.empty())
+        {
+            return false;
+        }
+
+        uint32_t stack[64];
+        int stack_size = 0;
+        stack[stack_size++] = 0;
+        bool hit_anything = false;
+
+        while (stack_size > 0)
+        {
+            const auto node_index = stack[--stack_size];
+            const auto& n = nodes[node_index];
+            count_node_visit();
+            if (!n.bbox.hit(r, ray_t))
+            {
+                continue;
+            }
+
+            if (n.count > 0)
+            {
+                for (uint32_t i = n.first; i < n.first + n.count; ++i)
+                {
+                    if (leaf_objects[i]->hit(r, ray_t, rec))
+                    {
+                        hit_anything = true;
+                        ray_t.max = rec.t;
+                    }
+                }
+            }
+            else if (r.direction()[n.axis] < 0)
+            {
+                // Right child on top when the ray runs towards the left one
+                stack[stack_size++] = node_index + 1;
+                stack[stack_size++] = n.first;
+            }
+            else
+            {
+                stack[stack_size++] = n.first;
+                stack[stack_size++] = node_index + 1;
+            }
+        }
+
+        return hit_anything;
+    }
+
+    aabb bounding_box() const override { return bbox; }
+
+    size_t node_count() const { return nodes.size(); }
+
+    // Object references held by the leaves, at least one per object
+    size_t reference_count() const { return leaf_objects.size(); }
+
+    size_t spatial_split_count() const { return spatial_splits; }
+
+    // Memory of the hierarchy: the nodes and the object references in leaf order
+    size_t hierarchy_bytes() const
+    {
+        return nodes.size() * sizeof(node) + leaf_objects.size() * sizeof(leaf_objects[0]);
+    }
+
+    // Expected cost of a ray through the hierarchy under the surface area heuristic, in box
+    // tests, with an object test costing as much as a box test
+    double sah_cost() const
+    {
+        const auto root = bounds::of(nodes[0].bbox).area();
+        double cost = 0;
+        for (const auto& n : nodes)
+        {
+            cost += bounds::of(n.bbox).area() / root * (n.count > 0 ? n.count * intersection_cost : traversal_cost);
+        }
+        return cost;
+    }
+
+private:
+    static constexpr double traversal_cost = 1;
+    static constexpr double intersection_cost = 1;
+    static constexpr int bin_count = 32;
+    static constexpr int max_depth = 60; // Keeps the traversal stack in bounds
+
+    // Inner nodes keep their left child right after them and the right one at first; leaves
+    // hold count references from first
+    struct node
+    {
+        aabb bbox;
+        uint32_t first = 0;
+        uint32_t count = 0;
+        uint32_t axis = 0; // Split axis of inner nodes, for visiting the nearer child first
+    };
+
+    // Unpadded build-time box, so clipped boxes stay tight
+    struct bounds
+    {
+        double min[3];
+        double max[3];
+
+        static bounds empty()
+        {
+            return {{infinity, infinity, infinity}, {-infinity, -infinity, -infinity}};
+        }
+
+        static bounds of(const aabb& b)
+        {
+            return {{b.x.min, b.y.min, b.z.min}, {b.x.max, b.y.max, b.z.max}};
+        }
+
+        bool is_empty() const { return min[0] > max[0] || min[1] > max[1] || min[2] > max[2]; }
+
+        void grow(const point3& p)
+        {
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                min[axis] = std::min(min[axis], p[axis]);
+                max[axis] = std::max(max[axis], p[axis]);
+            }
+        }
+
+        void grow(const bounds& b)
+        {
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                min[axis] = std::min(min[axis], b.min[axis]);
+                max[axis] = std::max(max[axis], b.max[axis]);
+            }
+        }
+
+        bounds intersection(const bounds& b) const
+        {
+            bounds both;
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                both.min[axis] = std::max(min[axis], b.min[axis]);
+                both.max[axis] = std::min(max[axis], b.max[axis]);
+            }
+            return both;
+        }
+
+        double area() const
+        {
+            if (is_empty())
+            {
+                return 0;
+            }
+            const auto x = max[0] - min[0];
+            const auto y = max[1] - min[1];
+            const auto z = max[2] - min[2];
+            return 2 * (x * y + y * z + z * x);
+        }
+
+        double centroid(int axis) const { return 0.5 * (min[axis] + max[axis]); }
+
+        // Padded the same way as every other box in the tree
+        aabb padded() const
+        {
+            return aabb(interval(min[0], max[0]), interval(min[1], max[1]), interval(min[2], max[2]));
+        }
+    };
+
+    // An object, or the part of one inside a spatial split
+    struct reference
+    {
+        bounds box;
+        uint32_t object;
+    };
+
+    // Outline of a flat object, in order around its edge, or no corners for anything else
+    struct shape
+    {
+        std::array<point3, 4> corners;
+        int corner_count = 0;
+
+        static shape of(const hittable& object)
+        {
+            shape s;
+            if (const auto t = dynamic_cast<const triangle*>(&object))
+            {
+                const auto c = t->corners();
+                std::copy(c.begin(), c.end(), s.corners.begin());
+                s.corner_count = 3;
+            }
+            else if (const auto q = dynamic_cast<const quad*>(&object))
+            {
+                s.corners = q->corners();
+                s.corner_count = 4;
+            }
+            return s;
+        }
+    };
+
+    struct split
+    {
+        double cost = infinity;
+        int axis = 0;
+        double position = 0; // Centroid bin boundary for object splits, plane for spatial ones
+        bool spatial = false;
+        bounds left = bounds::empty();
+        bounds right = bounds::empty();
+        size_t left_count = 0;
+        size_t right_count = 0;
+    };
+
+    // Box of the part of the reference between low and high on axis
+    bounds clip(const reference& ref, int axis, double low, double high) const
+    {
+        const auto& s = shapes[ref.object];
+        auto clipped = bounds::empty();
+        if (s.corner_count == 0)
+        {
+            clipped = ref.box;
+            clipped.min[axis] = std::max(clipped.min[axis], low);
+            clipped.max[axis] = std::min(clipped.max[axis], high);
+            return clipped;
+        }
+
+        // The clipped polygon's corners are its own corners inside the slab and its edges'
+        // crossings of the two planes
+        for (int i = 0; i < s.corner_count; ++i)
+        {
+            const auto& a = s.corners[i];
+            const auto& b = s.corners[(i + 1) % s.corner_count];
+            if (a[axis] >= low && a[axis] <= high)
+            {
+                clipped.grow(a);
+            }
+            for (const auto plane : {low, high})
+            {
+                if ((a[axis] - plane) * (b[axis] - plane) < 0)
+                {
+                    auto crossing = a + (plane - a[axis]) / (b[axis] - a[axis]) * (b - a);
+                    crossing[axis] = plane;
+                    clipped.grow(crossing);
+                }
+            }
+        }
+        return clipped.intersection(ref.box);
+    }
+
+    // Binned surface area heuristic over the reference centroids
+    split object_split(const std::vector<reference>& references) const
+    {
+        auto centroids = bounds::empty();
+        for (const auto& ref : references)
+        {
+            centroids.grow(point3(ref.box.centroid(0), ref.box.centroid(1), ref.box.centroid(2)));
+        }
+
+        split best;
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            const auto extent = centroids.max[axis] - centroids.min[axis];
+            if (extent <= 0)
+            {
+                continue;
+            }
+
+            bounds boxes[bin_count];
+            size_t counts[bin_count] = {};
+            std::fill(std::begin(boxes), std::end(boxes), bounds::empty());
+            for (const auto& ref : references)
+            {
+                const auto bin = object_bin(ref, axis, centroids.min[axis], extent);
+                boxes[bin].grow(ref.box);
+                ++counts[bin];
+            }
+
+            consider_planes(best, axis, boxes, counts, counts, [&](int bin)
+            {
+                return centroids.min[axis] + extent * bin / bin_count;
+            });
+        }
+        return best;
+    }
+
+    // Binned surface area heuristic over planes through the node, clipping the references
+    // crossing them
+    split spatial_split(const std::vector<reference>& references, const bounds& node_box) const
+    {
+        split best;
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            const auto extent = node_box.max[axis] - node_box.min[axis];
+            if (extent <= 0)
+            {
+                continue;
+            }
+            const auto plane = [&](int bin) { return node_box.min[axis] + extent * bin / bin_count; };
+            const auto bin_of = [&](double value)
+            {
+                return std::clamp(int((value - node_box.min[axis]) / extent * bin_count), 0, bin_count - 1);
+            };
+
+            bounds boxes[bin_count];
+            size_t entries[bin_count] = {};
+            size_t exits[bin_count] = {};
+            std::fill(std::begin(boxes), std::end(boxes), bounds::empty());
+            for (const auto& ref : references)
+            {
+                const auto first = bin_of(ref.box.min[axis]);
+                const auto last = bin_of(ref.box.max[axis]);
+                if (first == last)
+                {
+                    boxes[first].grow(ref.box);
+                }
+                else
+                {
+                    for (int bin = first; bin <= last; ++bin)
+                    {
+                        const auto piece = clip(ref, axis, plane(bin), plane(bin + 1));
+                        if (!piece.is_empty())
+                        {
+                            boxes[bin].grow(piece);
+                        }
+                    }
+                }
+                ++entries[first];
+                ++exits[last];
+            }
+
+            consider_planes(best, axis, boxes, entries, exits, plane);
+        }
+        best.spatial = true;
+        return best;
+    }
+
+    // Sweep the planes between bins, keeping the cheapest in best. A reference counts on the
+    // left from the bin it enters and on the right from the bin it leaves.
+    template<typename plane_at>
+    static void consider_planes(split& best, int axis, const bounds (&boxes)[bin_count],
+        const size_t (&entries)[bin_count], const size_t (&exits)[bin_count], plane_at plane)
+    {
+        bounds right_boxes[bin_count];
+        size_t right_counts[bin_count];
+        auto right = bounds::empty();
+        size_t right_count = 0;
+        for (int bin = bin_count - 1; bin > 0; --bin)
+        {
+            right.grow(boxes[bin]);
+            right_count += exits[bin];
+            right_boxes[bin] = right;
+            right_counts[bin] = right_count;
+        }
+
+        auto left = bounds::empty();
+        size_t left_count = 0;
+        for (int bin = 1; bin < bin_count; ++bin)
+        {
+            left.grow(boxes[bin - 1]);
+            left_count += entries[bin - 1];
+            if (left_count == 0 || right_counts[bin] == 0)
+            {
+                continue;
+            }
+            const auto cost = left.area() * double(left_count) + right_boxes[bin].area() * double(right_counts[bin]);
+            if (cost < best.cost)
+            {
+                best.cost = cost;
+                best.axis = axis;
+                best.position = plane(bin);
+                best.left = left;
+                best.right = right_boxes[bin];
+                best.left_count = left_count;
+                best.right_count = right_counts[bin];
+            }
+        }
+    }
+
+    static int object_bin(const reference& ref, int axis, double min, double extent)
+    {
+        return std::clamp(int((ref.box.centroid(axis) - min) / extent * bin_count), 0, bin_count - 1);
+    }
+
+    // Emit the subtree over references whose bounds are node_box, returning its node index
+    uint32_t build(std::vector<reference> references, const bounds& node_box, int depth)
+    {
+        const auto index = uint32_t(nodes.size());
+        nodes.push_back({node_box.padded()});
+        const auto count = references.size();
+
+        const auto by_objects = count > 1 && depth < max_depth ? object_split(references) : split{};
+        auto chosen = by_objects;
+        if (options.spatial_splits && by_objects.cost < infinity)
+        {
+            const auto overlap = by_objects.left.intersection(by_objects.right).area();
+            if (overlap > options.overlap_threshold * root_area)
+            {
+                auto candidate = spatial_split(references, node_box);
+                const auto added = candidate.left_count + candidate.right_count - count;
+                if (candidate.cost < chosen.cost && reference_total + added <= reference_limit)
+                {
+                    chosen = candidate;
+                }
+            }
+        }
+
+        // A leaf when it is no dearer than splitting, or when no split separates anything
+        const auto leaf_cost = intersection_cost * double(count) * node_box.area();
+        const auto split_cost = traversal_cost * node_box.area() + intersection_cost * chosen.cost;
+        const auto forced = count > max_leaf_size && depth < max_depth;
+        if (count <= 1 || (!forced && leaf_cost <= split_cost) || depth >= max_depth)
+        {
+            make_leaf(index, references);
+            return index;
+        }
+
+        std::vector<reference> left;
+        std::vector<reference> right;
+        auto axis = chosen.axis;
+        if (chosen.spatial)
+        {
+            const auto added = partition_spatial(references, chosen, left, right);
+            if (!left.empty() && !right.empty())
+            {
+                reference_total += added;
+                ++spatial_splits;
+            }
+            else
+            {
+                left.clear();
+                right.clear();
+            }
+        }
+        if (left.empty() && right.empty())
+        {
+            partition_objects(references, by_objects, left, right);
+            axis = by_objects.axis;
+        }
+        references = {};
+
+        auto left_box = bounds::empty();
+        auto right_box = bounds::empty();
+        for (const auto& ref : left) left_box.grow(ref.box);
+        for (const auto& ref : right) right_box.grow(ref.box);
+
+        nodes[index].axis = uint32_t(axis);
+        build(std::move(left), left_box, depth + 1);
+        const auto right_index = build(std::move(right), right_box, depth + 1);
+        nodes[index].first = right_index;
+        return index;
+    }
+
+    void make_leaf(uint32_t index, const std::vector<reference>& references)
+    {
+        nodes[index].first = uint32_t(leaf_objects.size());
+        nodes[index].count = uint32_t(references.size());
+        for (const auto& ref : references)
+        {
+            leaf_objects.push_back(objects[ref.object].get());
+        }
+    }
+
+    // Split at the chosen centroid plane, or in half when no plane separates the centroids
+    static void partition_objects(const std::vector<reference>& references, const split& chosen,
+        std::vector<reference>& left, std::vector<reference>& right)
+    {
+        if (chosen.cost < infinity)
+        {
+            for (const auto& ref : references)
+            {
+                (ref.box.centroid(chosen.axis) < chosen.position ? left : right).push_back(ref);
+            }
+        }
+        if (left.empty() || right.empty())
+        {
+            left.clear();
+            right.clear();
+            const auto mid = long(references.size() / 2);
+            left.assign(references.begin(), references.begin() + mid);
+            right.assign(references.begin() + mid, references.end());
+        }
+    }
+
+    // References crossing the plane are clipped into both sides, unless keeping one whole on a
+    // single side is cheaper than the duplicate (reference unsplitting). Returns the number of
+    // references added.
+    size_t partition_spatial(const std::vector<reference>& references, const split& chosen,
+        std::vector<reference>& left, std::vector<reference>& right) const
+    {
+        size_t added = 0;
+        const auto axis = chosen.axis;
+        const auto plane = chosen.position;
+        const auto left_area = chosen.left.area();
+        const auto right_area = chosen.right.area();
+        const auto left_count = double(chosen.left_count);
+        const auto right_count = double(chosen.right_count);
+        const auto split_cost = left_area * left_count + right_area * right_count;
+
+        for (const auto& ref : references)
+        {
+            if (ref.box.max[axis] <= plane)
+            {
+                left.push_back(ref);
+                continue;
+            }
+            if (ref.box.min[axis] >= plane)
+            {
+                right.push_back(ref);
+                continue;
+            }
+
+            auto whole_left = chosen.left;
+            whole_left.grow(ref.box);
+            auto whole_right = chosen.right;
+            whole_right.grow(ref.box);
+            const auto left_cost = whole_left.area() * left_count + right_area * (right_count - 1);
+            const auto right_cost = left_area * (left_count - 1) + whole_right.area() * right_count;
+            if (left_cost < split_cost && left_cost <= right_cost)
+            {
+                left.push_back(ref);
+                continue;
+            }
+            if (right_cost < split_cost)
+            {
+                right.push_back(ref);
+                continue;
+            }
+
+            const auto left_piece = clip(ref, axis, -infinity, plane);
+            const auto right_piece = clip(ref, axis, plane, infinity);
+            if (!left_piece.is_empty())
+            {
+                left.push_back({left_piece, ref.object});
+            }
+            if (!right_piece.is_empty())
+            {
+                right.push_back({right_piece, ref.object});
+            }
+            if (!left_piece.is_empty() && !right_piece.is_empty())
+            {
+                ++added;
+            }
+            else if (left_piece.is_empty() && right_piece.is_empty())
+            {
+                // Only possible through rounding; keep the object rather than lose it
+                left.push_back(ref);
+            }
+        }
+        return added;
+    }
+
+    std::vector<std::shared_ptr<hittable>> objects;
+    settings options;
+    std::vector<shape> shapes; // Per object, only while building
+    std::vector<node> nodes;
+    std::vector<const hittable*> leaf_objects;
+    double root_area = 0;
+    size_t reference_limit = 0;
+    size_t reference_total = 0;
+    size_t spatial_splits = 0;
+    aabb bbox;
+};
@@ -0,0 +1,86 @@
+#include "../rtweekend.h"
+
+#include "../hittable_list.h"
+#include "../motion_bvh.h"
+#include "../sphere.h"
+
+// A motion_bvh over badly clustered objects still finds the same hits as a plain list
+
+namespace
+{
+    int failures = 0;
+
+    void check(bool condition, const char* what)
+    {
+        if (!condition)
+        {
+            std::println(std::cerr, "FAILED: {}", what);
+            ++failures;
+        }
+    }
+
+    // Closest hits of the tree and of the list agree for rays at every object
+    void check_hits(const hittable& tree, const hittable_list& list, const char* what)
+    {
+        int mismatches = 0;
+        for (const auto& object : list.objects)
+        {
+            const auto target = object->bounding_box();
+            const point3 center(target.x.min + target.x.size() / 2, target.y.min + target.y.size() / 2,
+                target.z.min + target.z.size() / 2);
+            for (const auto& origin : {point3(0, 0, -50), point3(30, 20, 40), point3(-40, -10, 5)})
+            {
+                const ray r(origin, center - origin, 0.5);
+                hit_record expected;
+                hit_record actual;
+                const bool list_hit = list.hit(r, interval(0.001, infinity), expected);
+                const bool tree_hit = tree.hit(r, interval(0.001, infinity), actual);
+                if (list_hit != tree_hit || (list_hit && std::fabs(expected.t - actual.t) > 1e-9 * expected.t))
+                {
+                    ++mismatches;
+                }
+            }
+        }
+        check(mismatches == 0, what);
+    }
+}
+
+int main()
+{
+    const material* none = nullptr;
+    hittable_list list;
+
+    // Centroids growing geometrically leave only the farthest object out of the first bin of
+    // every split, which without a depth limit builds a chain one node per object deep
+    for (int i = 0; i < 80; ++i)
+    {
+        const auto distance = std::pow(16.0, i);
+        list.add(std::make_shared<sphere>(point3(distance, 0, 0), 0.1 * distance, none));
+    }
+    // Many objects sharing one centroid and a few far outliers
+    for (int i = 0; i < 300; ++i)
+    {
+        list.add(std::make_shared<sphere>(point3(5, 5, 5), 0.5 + 0.001 * i, none));
+    }
+    for (int i = 0; i < 4; ++i)
+    {
+        list.add(std::make_shared<sphere>(point3(-20, 3 * i, 10), 1, none));
+    }
+    // A moving one, so the tree keeps more than one time key
+    list.add(std::make_shared<sphere>(point3(0, -10, 0), point3(0, -12, 0), 1, none));
+
+    motion_bvh tree(list);
+    check_hits(tree, list, "a built tree finds the closest hits");
+
+    tree.refit(0.5);
+    check_hits(tree, list, "a refit tree finds the closest hits");
+
+    tree.rebuild();
+    check_hits(tree, list, "a rebuilt tree finds the closest hits");
+
+    if (failures == 0)
+    {
+        std::println("motion_bvh_test passed");
+    }
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,50 @@
+#include "../rtweekend.h"
+
+#include "../render_service.h"
+
+// Render requests only name output files inside the output directory of the service
+
+namespace
+{
+    int failures = 0;
+
+    void check(bool condition, const char* what)
+    {
+        if (!condition)
+        {
+            std::println(std::cerr, "FAILED: {}", what);
+            ++failures;
+        }
+    }
+
+    bool parses(const std::string& line)
+    {
+        render_request request;
+        std::string error;
+        return parse_render_request(line, request, error);
+    }
+}
+
+int main()
+{
+    render_request request;
+    std::string error;
+    check(parse_render_request("render cornell_box out=frames/a.ppm width=64", request, error)
+        && request.out == "frames/a.ppm" && request.width == 64, "a relative output path is accepted");
+    check(parses("render cornell_box out=a.ppm"), "a plain file name is accepted");
+    check(parses("render cornell_box out=frames/../a.ppm"), "a path climbing back inside is accepted");
+
+    check(!parses("render cornell_box out=/tmp/a.ppm"), "an absolute path is rejected");
+    check(!parses("render cornell_box out=//tmp/a.ppm"), "a path with a root name is rejected");
+    check(!parses("render cornell_box out=../a.ppm"), "a parent path is rejected");
+    check(!parses("render cornell_box out=frames/../../a.ppm"), "a path climbing out is rejected");
+    check(!parses("render cornell_box out=./.."), "the parent directory is rejected");
+    check(!parses("render cornell_box out=frames/"), "a directory is rejected");
+    check(!parses("render cornell_box width=64"), "a missing output path is rejected");
+
+    if (failures == 0)
+    {
+        std::println("render_service_test passed");
+    }
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,117 @@
+#include "../rtweekend.h"
+
+#include "../scene_file.h"
+
+// A cache whose hierarchy nests deeper than the traversal stack is rejected, and the scene is
+// compiled again from its text
+
+namespace
+{
+    int failures = 0;
+
+    void check(bool condition, const char* what)
+    {
+        if (!condition)
+        {
+            std::println(std::cerr, "FAILED: {}", what);
+            ++failures;
+        }
+    }
+
+    // Whether a ray at every sphere of the row hits it
+    bool hits_every_sphere(const hittable& world, int count)
+    {
+        for (int i = 0; i < count; ++i)
+        {
+            hit_record rec;
+            const ray r(point3(3 * i, 0, -10), vec3(0, 0, 1));
+            if (!world.hit(r, interval(0.001, infinity), rec) || std::fabs(rec.t - 9) > 1e-9)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+}
+
+int main()
+{
+    const auto directory = std::filesystem::temp_directory_path();
+    const auto filename = directory / "scene_file_test.scene";
+    auto cache = filename;
+    cache += ".cache";
+    std::filesystem::remove(cache);
+
+    // A row of spheres, more than the traversal stack has entries, under a small lamp
+    constexpr int sphere_count = 100;
+    std::string text = "material white lambertian 0.5 0.5 0.5\nmaterial lamp light 4 4 4\n"
+        "quad -1 20 -1  2 0 0  0 0 2  lamp\nlight quad -1 20 -1  2 0 0  0 0 2\n";
+    for (int i = 0; i < sphere_count; ++i)
+    {
+        text += std::format("sphere {} 0 0 1 white\n", 3 * i);
+    }
+    {
+        std::ofstream out(filename, std::ios::binary);
+        out << text;
+    }
+
+    {
+        scene s;
+        check(load_scene_file(filename, s), "the text compiles");
+        check(hits_every_sphere(s.world, sphere_count), "the compiled scene hits every sphere");
+    }
+
+    // Replace the cache with one holding the same records under a chain of inner nodes, one
+    // level per sphere. The chain runs through the left children, which traversal visits
+    // first, so the right leaves pile up on its stack.
+    scene_file::source_stamp source;
+    check(scene_file::stamp(filename, source), "the text has a stamp");
+    scene_file::description d;
+    scene_file::parser p(filename.string());
+    check(p.parse(text, d), "the text parses");
+
+    using node = typed_bvh<sphere>::node;
+    const aabb everything(point3(-10, -10, -10), point3(3 * sphere_count + 10, 10, 10));
+    constexpr uint32_t inner_count = sphere_count - 1;
+    std::vector<node> chain;
+    for (uint32_t i = 0; i < inner_count; ++i)
+    {
+        chain.push_back({everything, inner_count + 1 + i, 0, 0});
+    }
+    chain.push_back({everything, 0, 1, 0});
+    for (uint32_t i = 0; i < inner_count; ++i)
+    {
+        chain.push_back({everything, i + 1, 1, 0});
+    }
+
+    std::array<std::vector<std::byte>, scene_file::group_count> nodes;
+    const auto bytes = std::as_bytes(std::span(chain));
+    nodes[0].assign(bytes.begin(), bytes.end());
+    // The lamp keeps a valid single leaf
+    const typed_bvh<quad>::node lamp{everything, 0, 1, 0};
+    const auto lamp_bytes = std::as_bytes(std::span(&lamp, 1));
+    nodes[1].assign(lamp_bytes.begin(), lamp_bytes.end());
+    check(scene_file::write_cache(cache, source, d, nodes), "the deep cache is written");
+
+    {
+        scene s;
+        check(load_scene_file(filename, s), "a scene with a too deep cache still loads");
+        check(hits_every_sphere(s.world, sphere_count), "the recompiled scene hits every sphere");
+    }
+
+    // The rejected cache was replaced with a fresh one
+    mapped_file mapping;
+    scene_file::view cached;
+    check(mapping.open(cache) && scene_file::read_cache(mapping, source, cached), "the cache was written again");
+    check(cached.nodes[0].size() != bytes.size(), "the rewritten cache holds a built hierarchy");
+    mapping.close();
+
+    std::filesystem::remove(filename);
+    std::filesystem::remove(cache);
+
+    if (failures == 0)
+    {
+        std::println("scene_file_test passed");
+    }
+    return failures == 0 ? 0 : 1;
+}
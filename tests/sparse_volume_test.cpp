@@ -0,0 +1,163 @@
+#include "../rtweekend.h"
+
+#include "../sparse_volume.h"
+
+// Density lookups and brick traversal find the set voxels, and loading a truncated or invalid
+// voxel file fails and leaves the grid it was loaded into as it was
+
+namespace
+{
+    int failures = 0;
+
+    void check(bool condition, const char* what)
+    {
+        if (!condition)
+        {
+            std::println(std::cerr, "FAILED: {}", what);
+            ++failures;
+        }
+    }
+
+    // The first size bytes of from, written to to
+    void truncate_copy(const std::filesystem::path& from, const std::filesystem::path& to, size_t size)
+    {
+        std::ifstream in(from, std::ios::binary);
+        std::vector<char> bytes(size);
+        in.read(bytes.data(), std::streamsize(size));
+        std::ofstream out(to, std::ios::binary);
+        out.write(bytes.data(), std::streamsize(size));
+    }
+
+    // A voxel file holding a single voxel
+    void write_voxel_file(const std::filesystem::path& to, double voxel_size, const int32_t (&ijk)[3])
+    {
+        const uint32_t version = 1;
+        const double origin[3] = {0, 0, 0};
+        const uint64_t count = 1;
+        const float density = 1;
+        std::ofstream out(to, std::ios::binary);
+        out.write("RTVX", 4);
+        out.write(reinterpret_cast<const char*>(&version), sizeof(version));
+        out.write(reinterpret_cast<const char*>(origin), sizeof(origin));
+        out.write(reinterpret_cast<const char*>(&voxel_size), sizeof(voxel_size));
+        out.write(reinterpret_cast<const char*>(&count), sizeof(count));
+        out.write(reinterpret_cast<const char*>(ijk), sizeof(ijk));
+        out.write(reinterpret_cast<const char*>(&density), sizeof(density));
+    }
+
+    void check_lookup_and_traversal()
+    {
+        // One dense voxel, and a second brick far away so the lattice has empty bricks between
+        auto grid = std::make_shared<sparse_voxel_grid>(point3(0, 0, 0), 1.0);
+        grid->set(3, 4, 5, 1e6f);
+        grid->set(40, 40, 40, 1.0f);
+        grid->set(-1, -1, -1, 2.0f);
+        check(grid->brick_count() == 3, "set voxels allocate one brick each");
+        check(grid->density(point3(3.5, 4.5, 5.5)) == 1e6, "a set voxel has its density");
+        check(grid->density(point3(4.5, 4.5, 5.5)) == 0, "an unset voxel in an occupied brick is empty");
+        check(grid->density(point3(20.5, 20.5, 20.5)) == 0, "a voxel without a brick is empty");
+        check(grid->density(point3(-0.5, -0.5, -0.5)) == 2.0, "a negative voxel has its density");
+
+        // Through the dense voxel: the ray must collide inside it
+        const ray through(point3(-10, 4.5, 5.5), vec3(1, 0, 0));
+        int occupied = 0;
+        grid->traverse(through, 0, 100, [&](const sparse_voxel_grid::brick* b, double, double)
+        {
+            occupied += b != nullptr;
+            return false;
+        });
+        check(occupied == 1, "a ray through a set voxel visits its brick");
+
+        const sparse_medium medium(grid, color(1, 1, 1));
+        hit_record rec;
+        check(medium.hit(through, interval(0, infinity), rec) && rec.t >= 13 && rec.t <= 14,
+            "a ray through a dense voxel collides inside it");
+
+        // Inside the lattice bounds but only through empty bricks: the ray must miss
+        const ray past(point3(-10, 20.5, 5.5), vec3(1, 0, 0));
+        int visited = 0;
+        occupied = 0;
+        grid->traverse(past, 0, 100, [&](const sparse_voxel_grid::brick* b, double, double)
+        {
+            ++visited;
+            occupied += b != nullptr;
+            return false;
+        });
+        check(visited > 0 && occupied == 0, "a ray through empty bricks visits no brick");
+        check(!medium.hit(past, interval(0, infinity), rec), "a ray through empty bricks misses");
+    }
+}
+
+int main()
+{
+    check_lookup_and_traversal();
+
+    const auto directory = std::filesystem::temp_directory_path();
+    const auto full = directory / "sparse_volume_test.rtvx";
+    const auto truncated = directory / "sparse_volume_test_truncated.rtvx";
+
+    sparse_voxel_grid source(point3(1, 2, 3), 0.5);
+    for (int i = 0; i < 20; ++i)
+    {
+        source.set(i, i, i, 1.0f + i);
+    }
+    check(source.save(full), "save writes the file");
+
+    sparse_voxel_grid reloaded;
+    check(reloaded.load(full), "a whole file loads");
+    check(reloaded.brick_count() == source.brick_count(), "a whole file loads every brick");
+    check(reloaded.density(point3(1.25, 2.25, 3.25)) == 1.0, "a whole file keeps origin and voxel size");
+
+    // A grid with other contents, origin and voxel size, which failed loads must not touch
+    sparse_voxel_grid target(point3(-10, -10, -10), 2.0);
+    target.set(0, 0, 0, 7.0f);
+    const auto bounds = target.bounds();
+
+    const auto header_bytes = 4 + sizeof(uint32_t) + 3 * sizeof(double) + sizeof(double) + sizeof(uint64_t);
+    const auto file_size = size_t(std::filesystem::file_size(full));
+    for (const auto size : {size_t(0), size_t(10), header_bytes, header_bytes + 7, file_size - 1})
+    {
+        truncate_copy(full, truncated, size);
+        check(!target.load(truncated), "a truncated file does not load");
+        check(target.brick_count() == 1, "a failed load keeps the bricks");
+        check(target.density(point3(-9, -9, -9)) == 7.0, "a failed load keeps the densities");
+        check(target.bounds().x.min == bounds.x.min && target.bounds().x.max == bounds.x.max,
+            "a failed load keeps origin and voxel size");
+    }
+
+    // Headers without a usable voxel size, and voxels whose bricks have no key
+    const auto invalid = directory / "sparse_volume_test_invalid.rtvx";
+    constexpr int32_t limit = (1 << 20) * sparse_voxel_grid::brick_size;
+    const std::pair<double, std::array<int32_t, 3>> cases[] = {
+        {0.0, {0, 0, 0}},
+        {-1.0, {0, 0, 0}},
+        {std::numeric_limits<double>::quiet_NaN(), {0, 0, 0}},
+        {infinity, {0, 0, 0}},
+        {1.0, {limit, 0, 0}},
+        {1.0, {0, -limit, 0}},
+        {1.0, {0, 0, std::numeric_limits<int32_t>::min()}},
+    };
+    for (const auto& [voxel_size, voxel] : cases)
+    {
+        write_voxel_file(invalid, voxel_size, {voxel[0], voxel[1], voxel[2]});
+        check(!target.load(invalid), "an invalid file does not load");
+        check(target.brick_count() == 1 && target.density(point3(-9, -9, -9)) == 7.0,
+            "a rejected file leaves the grid as it was");
+    }
+
+    // The outermost voxels of the lattice still load
+    write_voxel_file(invalid, 1.0, {limit - 1, -(limit - 1), 0});
+    sparse_voxel_grid edge;
+    check(edge.load(invalid) && edge.density(point3(limit - 0.5, -(limit - 1) + 0.5, 0.5)) == 1.0,
+        "voxels at the lattice edge load");
+
+    std::filesystem::remove(full);
+    std::filesystem::remove(truncated);
+    std::filesystem::remove(invalid);
+
+    if (failures == 0)
+    {
+        std::println("sparse_volume_test passed");
+    }
+    return failures == 0 ? 0 : 1;
+}
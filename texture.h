@@ -7,18 +7,40 @@
 #include "perlin.h"
 #include "rtw_image.h"
 
+// Tags for the built-in textures, so hot paths can dispatch without virtual calls.
+// User-defined textures keep the default custom tag and go through the virtual interface.
+enum class texture_kind
+{
+    custom,
+    solid_color,
+    checker,
+    image,
+    noise
+};
+
 class texture
 {
 public:
     virtual ~texture() = default;
     virtual color value(double u, double v, const point3& p) const = 0;
 
+    texture_kind kind() const { return tag; }
+
+protected:
+    texture() = default;
+    explicit texture(texture_kind kind) : tag(kind) {}
+
+private:
+    texture_kind tag = texture_kind::custom;
 };
 
-class solid_color : public texture
+// Evaluate a texture through the closed-set dispatch, see visit_texture below
+inline color texture_value(const texture& tex, double u, double v, const point3& p);
+
+class solid_color final : public texture
 {
 public:
-    solid_color(const color& albedo) : albedo(albedo) {}
+    solid_color(const color& albedo) : texture(texture_kind::solid_color), albedo(albedo) {}
     solid_color(double red, double green, double blue) : solid_color(color(red, green, blue)) {}
 
     color value(double u, double v, const point3& p) const override
@@ -30,17 +52,21 @@ private:
     color albedo;
 };
 
-class checker_texture : public texture
+class checker_texture final : public texture
 {
 public:
-    checker_texture(double scale, std::shared_ptr<texture> even, std::shared_ptr<texture> odd)
-        : inv_scale(1.0 / scale)
+    checker_texture(double scale, const texture* even, const texture* odd)
+        : texture(texture_kind::checker)
+        , inv_scale(1.0 / scale)
         , even(even)
         , odd(odd)
     {}
 
     checker_texture(double scale, const color& c1, const color& c2)
-        : checker_texture(scale, std::make_shared<solid_color>(c1), std::make_shared<solid_color>(c2))
+        : texture(texture_kind::checker)
+        , inv_scale(1.0 / scale)
+        , even_color(c1)
+        , odd_color(c2)
     {}
 
     color value(double u, double v, const point3& p) const override
@@ -50,19 +76,26 @@ public:
         const auto zInteger = int(std::floor(inv_scale * p.z()));
 
         const bool isEven = (xInteger + yInteger + zInteger) % 2== 0;
-        return isEven ? even->value(u, v, p) : odd->value(u, v, p);
+        if (isEven)
+        {
+            return even ? texture_value(*even, u, v, p) : even_color;
+        }
+        return odd ? texture_value(*odd, u, v, p) : odd_color;
     }
 
 private:
     double inv_scale;
-    std::shared_ptr<texture> even;
-    std::shared_ptr<texture> odd;
+    // Used when constructed from plain colors, without textures
+    color even_color;
+    color odd_color;
+    const texture* even = nullptr;
+    const texture* odd = nullptr;
 };
 
-class image_texture : public texture
+class image_texture final : public texture
 {
 public:
-    image_texture(std::string_view filename) : image(filename) {}
+    image_texture(std::string_view filename) : texture(texture_kind::image), image(filename) {}
 
     color value(double u, double v, const point3& p) const override
     {
@@ -84,10 +117,10 @@ private:
     rwt_image image;
 };
 
-class noise_texture : public texture
+class noise_texture final : public texture
 {
 public:
-    noise_texture(double scale) : scale(scale) {}
+    noise_texture(double scale) : texture(texture_kind::noise), scale(scale) {}
 
     color value(double u, double v, const point3& p) const override
     {
@@ -99,3 +132,23 @@ private:
     perlin noise;
     double scale; // Scale the input point to vary noise more quickly
 };
+
+// Call f with the texture downcast to its concrete built-in type, or with the base class
+// for custom textures. The built-in types are final, so f can be inlined for each of them.
+template<typename F>
+decltype(auto) visit_texture(const texture& tex, F&& f)
+{
+    switch (tex.kind())
+    {
+        case texture_kind::solid_color: return f(static_cast<const solid_color&>(tex));
+        case texture_kind::checker: return f(static_cast<const checker_texture&>(tex));
+        case texture_kind::image: return f(static_cast<const image_texture&>(tex));
+        case texture_kind::noise: return f(static_cast<const noise_texture&>(tex));
+        default: return f(tex);
+    }
+}
+
+inline color texture_value(const texture& tex, double u, double v, const point3& p)
+{
+    return visit_texture(tex, [&](const auto& t) { return t.value(u, v, p); });
+}
@@ -1,17 +1,19 @@
 #pragma once
 
-#pragma once
+#include <array>
 
 #include "hittable.h"
 
+template<typename T> struct leaf_batch;
+
 // A primitive defining a triangle, where
 // 1. Q, the starting corner.
 // 2. u, a vector representing the first side. Q+u gives one of the corners adjacent to Q.
 // 3. v, a vector representing the second side. Q+v gives the other corner adjacent to Q.
-class triangle : public hittable
+class triangle final : public hittable
 {
 public:
-    triangle(const point3& Q, const vec3& u, const vec3& v, std::shared_ptr<material> mat)
+    triangle(const point3& Q, const vec3& u, const vec3& v, const material* mat)
         : Q(Q)
         , u(u)
         , v(v)
@@ -34,6 +36,9 @@ public:
 
     aabb bounding_box() const override { return bbox; }
 
+    // The three corners, for builders that clip the triangle against planes
+    std::array<point3, 3> corners() const { return {Q, Q + u, Q + v}; }
+
     bool hit(const ray& r, interval ray_t, hit_record& rec) const override
     {
         auto denom = dot(normal, r.direction());
@@ -62,10 +67,7 @@ public:
             return false;
         }
         // Ray hits the 2D shape; set the rest of the hit record and return true.
-        rec.t = t;
-        rec.p = intersection;
-        rec.mat = mat;
-        rec.set_face_normal(r, normal);
+        set_hit_record(r, t, intersection, rec);
 
         return true;
     }
@@ -83,12 +85,23 @@ public:
         return false;
     }
 
+private:
+    friend struct leaf_batch<triangle>;
+
+    void set_hit_record(const ray& r, double t, const point3& intersection, hit_record& rec) const
+    {
+        rec.t = t;
+        rec.p = intersection;
+        rec.mat = mat;
+        rec.set_face_normal(r, normal);
+    }
+
 private:
     point3 Q;
     vec3 u;
     vec3 v;
     vec3 w;
-    std::shared_ptr<material> mat;
+    const material* mat;
     aabb bbox;
     vec3 normal; // A unit vecotr perpendicular to the triangle plane
     double D; // Implicit equation of a plane n*(x, y, z) = Ax+By+Cz=D
@@ -0,0 +1,293 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "hittable.h"
+#include "hittable_list.h"
+#include "scene_arena.h"
+
+// A uniform grid over objects of similar size spread evenly through a volume, like a cluster of
+// equal spheres, where a hierarchy only adds levels to descend. Every cell lists the objects
+// whose boxes overlap it, and a ray walks the cells it crosses in order (3D-DDA), stopping at the
+// first cell that ends beyond the closest hit.
+//
+// The resolution follows the object density: about density cells per object, shaped like the
+// bounds. Cells still holding more than nested_threshold objects get a grid of their own, one
+// level deep, so a dense clump does not turn into long cell lists.
+//
+// An object overlapping several cells would be tested again in each of them. A small mailbox
+// kept on the stack of every ray remembers the objects it already tested, so most of those
+// repeats are skipped without any per-object state shared between threads.
+//
+// Bounds are taken once at build time, so like bvh_node it is meant for static objects.
+class uniform_grid : public hittable
+{
+public:
+    static constexpr double default_density = 3;    // Cells per object
+    static constexpr int max_resolution = 128;      // Cells along one axis
+    static constexpr size_t nested_threshold = 16;  // Objects in a cell that make it a grid of its own
+
+    // Nested grids are allocated from arena when one is given
+    explicit uniform_grid(const hittable_list& list, double density = default_density, scene_arena* arena = nullptr)
+        : uniform_grid(list.objects, list.bounding_box(), density, true, arena)
+    {}
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override
+    {
+        if (objects.empty())
+        {
+            return false;
+        }
+
+        // Clip the ray to the grid
+        const auto& o = r.origin();
+        const auto& d = r.direction();
+        auto inside = ray_t;
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            const auto& range = bbox.axis_interval(axis);
+            const auto inverse = 1.0 / d[axis];
+            auto t0 = (range.min - o[axis]) * inverse;
+            auto t1 = (range.max - o[axis]) * inverse;
+            if (t0 > t1) std::swap(t0, t1);
+            inside.min = std::max(inside.min, t0);
+            inside.max = std::min(inside.max, t1);
+            if (inside.max < inside.min)
+            {
+                return false;
+            }
+        }
+
+        // Cell of the entry point, and for every axis the distance to the next boundary and
+        // between boundaries
+        int cell[3];
+        int step[3];
+        int end[3];
+        double next[3];
+        double delta[3];
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            const auto min = bbox.axis_interval(axis).min;
+            const auto entry = o[axis] + inside.min * d[axis];
+            cell[axis] = std::clamp(int((entry - min) / cell_size[axis]), 0, resolution[axis] - 1);
+            if (d[axis] > 0)
+            {
+                step[axis] = 1;
+                end[axis] = resolution[axis];
+                next[axis] = (min + (cell[axis] + 1) * cell_size[axis] - o[axis]) / d[axis];
+                delta[axis] = cell_size[axis] / d[axis];
+            }
+            else if (d[axis] < 0)
+            {
+                step[axis] = -1;
+                end[axis] = -1;
+                next[axis] = (min + cell[axis] * cell_size[axis] - o[axis]) / d[axis];
+                delta[axis] = -cell_size[axis] / d[axis];
+            }
+            else
+            {
+                step[axis] = 0;
+                end[axis] = -1;
+                next[axis] = infinity;
+                delta[axis] = infinity;
+            }
+        }
+
+        std::array<uint32_t, mailbox_size> mailbox;
+        mailbox.fill(UINT32_MAX);
+        bool hit_anything = false;
+
+        while (true)
+        {
+            count_node_visit();
+            const auto index = (size_t(cell[2]) * resolution[1] + cell[1]) * resolution[0] + cell[0];
+            for (auto i = cell_start[index]; i < cell_start[index + 1]; ++i)
+            {
+                const auto id = cell_objects[i];
+                auto& slot = mailbox[id % mailbox_size];
+                if (slot == id)
+                {
+                    continue;
+                }
+                slot = id;
+                if (objects[id]->hit(r, ray_t, rec))
+                {
+                    hit_anything = true;
+                    ray_t.max = rec.t;
+                }
+            }
+
+            // Done once the cell ends beyond the closest hit or the part of the ray inside
+            const int axis = next[0] < next[1] ? (next[0] < next[2] ? 0 : 2) : (next[1] < next[2] ? 1 : 2);
+            if (next[axis] >= ray_t.max || next[axis] > inside.max)
+            {
+                break;
+            }
+            cell[axis] += step[axis];
+            if (cell[axis] == end[axis])
+            {
+                break;
+            }
+            next[axis] += delta[axis];
+        }
+
+        return hit_anything;
+    }
+
+    aabb bounding_box() const override { return bbox; }
+
+    size_t cell_count() const { return cell_start.empty() ? 0 : cell_start.size() - 1; }
+
+    size_t nested_grid_count() const { return nested.size(); }
+
+    // Object entries of all cells, nested grids included
+    size_t reference_count() const
+    {
+        auto count = cell_objects.size();
+        for (const auto& grid : nested)
+        {
+            count += grid->reference_count() - 1;
+        }
+        return count;
+    }
+
+    // Memory of the cell lists, nested grids included
+    size_t grid_bytes() const
+    {
+        auto bytes = cell_start.size() * sizeof(uint32_t) + cell_objects.size() * sizeof(uint32_t)
+            + objects.size() * sizeof(objects[0]);
+        for (const auto& grid : nested)
+        {
+            bytes += grid->grid_bytes();
+        }
+        return bytes;
+    }
+
+    // A grid over the objects in bounds, nesting grids in crowded cells when nest is set
+    uniform_grid(const std::vector<std::shared_ptr<hittable>>& list, const aabb& bounds, double density, bool nest,
+        scene_arena* arena = nullptr)
+        : objects(list)
+        , bbox(bounds)
+    {
+        if (objects.empty())
+        {
+            return;
+        }
+
+        // About density cells per object, as close to cubes as the bounds allow
+        const double extent[3] = {bbox.x.size(), bbox.y.size(), bbox.z.size()};
+        const auto side = std::cbrt(extent[0] * extent[1] * extent[2] / (density * double(objects.size())));
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            resolution[axis] = std::clamp(int(std::lround(extent[axis] / side)), 1, max_resolution);
+            cell_size[axis] = extent[axis] / resolution[axis];
+        }
+
+        // Cell lists in one array: count, offset, then fill
+        const auto cells = size_t(resolution[0]) * resolution[1] * resolution[2];
+        cell_start.assign(cells + 1, 0);
+        for_each_cell([&](size_t index, uint32_t) { ++cell_start[index + 1]; });
+        for (size_t i = 0; i < cells; ++i)
+        {
+            cell_start[i + 1] += cell_start[i];
+        }
+        cell_objects.resize(cell_start[cells]);
+        auto fill = cell_start;
+        for_each_cell([&](size_t index, uint32_t id) { cell_objects[fill[index]++] = id; });
+
+        if (nest)
+        {
+            nest_crowded_cells(cells, density, arena);
+        }
+    }
+
+private:
+    static constexpr size_t mailbox_size = 16;
+
+    // Call f with the index of every cell an object's box overlaps and the object's id
+    template<typename F>
+    void for_each_cell(F&& f) const
+    {
+        for (uint32_t id = 0; id < objects.size(); ++id)
+        {
+            const auto box = objects[id]->bounding_box();
+            int low[3];
+            int high[3];
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                const auto& range = box.axis_interval(axis);
+                const auto min = bbox.axis_interval(axis).min;
+                low[axis] = std::clamp(int((range.min - min) / cell_size[axis]), 0, resolution[axis] - 1);
+                high[axis] = std::clamp(int((range.max - min) / cell_size[axis]), 0, resolution[axis] - 1);
+            }
+            for (int z = low[2]; z <= high[2]; ++z)
+            {
+                for (int y = low[1]; y <= high[1]; ++y)
+                {
+                    for (int x = low[0]; x <= high[0]; ++x)
+                    {
+                        f((size_t(z) * resolution[1] + y) * resolution[0] + x, id);
+                    }
+                }
+            }
+        }
+    }
+
+    // Replace the list of every crowded cell by a grid over the cell, added as one more object
+    void nest_crowded_cells(size_t cells, double density, scene_arena* arena)
+    {
+        std::vector<uint32_t> start(cells + 1, 0);
+        std::vector<uint32_t> entries;
+        entries.reserve(cell_objects.size());
+        for (size_t index = 0; index < cells; ++index)
+        {
+            const auto first = cell_objects.begin() + cell_start[index];
+            const auto last = cell_objects.begin() + cell_start[index + 1];
+            if (size_t(last - first) > nested_threshold)
+            {
+                std::vector<std::shared_ptr<hittable>> crowd;
+                for (auto id = first; id != last; ++id)
+                {
+                    crowd.push_back(objects[*id]);
+                }
+                auto grid = make_scene_object<uniform_grid>(arena, crowd, cell_bounds(index), density, false);
+                entries.push_back(uint32_t(objects.size()));
+                objects.push_back(grid);
+                nested.push_back(std::move(grid));
+            }
+            else
+            {
+                entries.insert(entries.end(), first, last);
+            }
+            start[index + 1] = uint32_t(entries.size());
+        }
+        cell_start = std::move(start);
+        cell_objects = std::move(entries);
+    }
+
+    aabb cell_bounds(size_t index) const
+    {
+        const int cell[3] = {int(index % resolution[0]), int(index / resolution[0] % resolution[1]),
+            int(index / resolution[0] / resolution[1])};
+        interval ranges[3];
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            const auto min = bbox.axis_interval(axis).min;
+            ranges[axis] = interval(min + cell[axis] * cell_size[axis], min + (cell[axis] + 1) * cell_size[axis]);
+        }
+        return aabb(ranges[0], ranges[1], ranges[2]);
+    }
+
+    std::vector<std::shared_ptr<hittable>> objects; // Followed by the nested grids
+    std::vector<std::shared_ptr<uniform_grid>> nested;
+    std::vector<uint32_t> cell_start;   // Cell i lists cell_objects [cell_start[i], cell_start[i + 1])
+    std::vector<uint32_t> cell_objects; // Indices into objects
+    int resolution[3] = {1, 1, 1};
+    double cell_size[3] = {1, 1, 1};
+    aabb bbox;
+};
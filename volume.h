@@ -0,0 +1,316 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <vector>
+
+#include "hittable.h"
+#include "material.h"
+#include "scene_arena.h"
+#include "texture.h"
+
+// Walk the cells of a regular grid crossed by the ray over the parameter span [t_min, t_max]
+// with a 3D-DDA. The grid starts at origin and has res cells of cell_size along each axis.
+// visit(cell, t0, t1) is called for every cell in order and returns true to stop.
+template<typename F>
+void traverse_grid(const ray& r, double t_min, double t_max, const point3& origin,
+    const double (&cell_size)[3], const int (&res)[3], F&& visit)
+{
+    const auto entry = r.at(t_min);
+    int cell[3];
+    int step[3];
+    double t_next[3];
+    double t_delta[3];
+
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        const auto d = r.direction()[axis];
+        cell[axis] = std::clamp(int(std::floor((entry[axis] - origin[axis]) / cell_size[axis])), 0, res[axis] - 1);
+
+        if (d > 0)
+        {
+            step[axis] = 1;
+            t_next[axis] = (origin[axis] + (cell[axis] + 1) * cell_size[axis] - r.origin()[axis]) / d;
+            t_delta[axis] = cell_size[axis] / d;
+        }
+        else if (d < 0)
+        {
+            step[axis] = -1;
+            t_next[axis] = (origin[axis] + cell[axis] * cell_size[axis] - r.origin()[axis]) / d;
+            t_delta[axis] = -cell_size[axis] / d;
+        }
+        else
+        {
+            step[axis] = 0;
+            t_next[axis] = infinity;
+            t_delta[axis] = infinity;
+        }
+    }
+
+    auto t = t_min;
+    while (t < t_max)
+    {
+        const int axis = (t_next[0] < t_next[1])
+            ? (t_next[0] < t_next[2] ? 0 : 2)
+            : (t_next[1] < t_next[2] ? 1 : 2);
+        const auto t_exit = std::fmin(t_next[axis], t_max);
+
+        if (visit(cell, t, t_exit))
+        {
+            return;
+        }
+
+        t = t_exit;
+        cell[axis] += step[axis];
+        if (cell[axis] < 0 || cell[axis] >= res[axis])
+        {
+            return;
+        }
+        t_next[axis] += t_delta[axis];
+    }
+}
+
+// Delta tracking over one span [t0, t1] of constant majorant. Tentative collisions are drawn
+// with the majorant and accepted with probability density(p) / majorant. Returns true and the
+// collision parameter on a real collision, false if the ray leaves the span first.
+template<typename F>
+bool delta_track(const ray& r, double t0, double t1, double majorant, double ray_length, F&& density, double& t_hit)
+{
+    if (majorant <= 0)
+    {
+        return false; // Empty span, skip it in one step
+    }
+
+    auto t = t0;
+    while (true)
+    {
+        t -= std::log(1 - random_double()) / (majorant * ray_length);
+        if (t >= t1)
+        {
+            return false; // Free flight is memoryless, restart in the next span
+        }
+
+        if (random_double() * majorant < density(r.at(t)))
+        {
+            t_hit = t;
+            return true;
+        }
+    }
+}
+
+// Intersect the ray with a box domain and the ray interval, returning the clipped span
+inline bool clip_to_box(const ray& r, const aabb& bounds, const interval& ray_t, double& t_min, double& t_max)
+{
+    t_min = std::fmax(ray_t.min, 0.0);
+    t_max = ray_t.max;
+
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        const auto& ax = bounds.axis_interval(axis);
+        const double adinv = 1.0 / r.direction()[axis];
+        auto t0 = (ax.min - r.origin()[axis]) * adinv;
+        auto t1 = (ax.max - r.origin()[axis]) * adinv;
+        if (t0 > t1)
+        {
+            std::swap(t0, t1);
+        }
+
+        t_min = std::fmax(t_min, t0);
+        t_max = std::fmin(t_max, t1);
+        if (t_max <= t_min)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Piecewise-constant density over the voxels of a box domain.
+class density_grid
+{
+public:
+    // values holds nx * ny * nz densities, x varying fastest
+    density_grid(const aabb& bounds, int nx, int ny, int nz, std::vector<float> values)
+        : domain(bounds)
+        , res{nx, ny, nz}
+        , values(std::move(values))
+    {
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            voxel_size[axis] = domain.axis_interval(axis).size() / res[axis];
+        }
+    }
+
+    // A single voxel covering the whole domain, the grid form of a constant medium
+    static std::shared_ptr<density_grid> uniform(const aabb& bounds, double density, scene_arena* arena = nullptr)
+    {
+        return make_scene_object<density_grid>(arena, bounds, 1, 1, 1, std::vector<float>{float(density)});
+    }
+
+    // Sample density(p) at every voxel center of an nx * ny * nz grid
+    template<typename F>
+    static std::shared_ptr<density_grid> sample(const aabb& bounds, int nx, int ny, int nz, F&& density,
+        scene_arena* arena = nullptr)
+    {
+        std::vector<float> values(size_t(nx) * ny * nz);
+        for (int k = 0; k < nz; ++k)
+        {
+            for (int j = 0; j < ny; ++j)
+            {
+                for (int i = 0; i < nx; ++i)
+                {
+                    point3 p(bounds.x.min + (i + 0.5) * bounds.x.size() / nx,
+                             bounds.y.min + (j + 0.5) * bounds.y.size() / ny,
+                             bounds.z.min + (k + 0.5) * bounds.z.size() / nz);
+                    values[(size_t(k) * ny + j) * nx + i] = float(std::fmax(0.0, density(p)));
+                }
+            }
+        }
+        return make_scene_object<density_grid>(arena, bounds, nx, ny, nz, std::move(values));
+    }
+
+    const aabb& bounds() const { return domain; }
+    int resolution(int axis) const { return res[axis]; }
+
+    double voxel(int i, int j, int k) const
+    {
+        return values[(size_t(k) * res[1] + j) * res[0] + i];
+    }
+
+    double density(const point3& p) const
+    {
+        int index[3];
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            const auto offset = (p[axis] - domain.axis_interval(axis).min) / voxel_size[axis];
+            index[axis] = std::clamp(int(offset), 0, res[axis] - 1);
+        }
+        return voxel(index[0], index[1], index[2]);
+    }
+
+private:
+    aabb domain;
+    int res[3];
+    double voxel_size[3];
+    std::vector<float> values;
+};
+
+// Coarse grid of per-cell maximum densities over a density_grid. Delta tracking samples free
+// flight distances against the local majorant, so empty cells are skipped outright and thin
+// cells are crossed in large steps.
+class majorant_grid
+{
+public:
+    // Each cell covers up to cell_voxels^3 voxels of the density grid
+    majorant_grid(const density_grid& grid, int cell_voxels = 8)
+        : domain(grid.bounds())
+    {
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            // Cells are aligned to whole voxel blocks, the last one may reach past the domain
+            res[axis] = (grid.resolution(axis) + cell_voxels - 1) / cell_voxels;
+            cell_size[axis] = cell_voxels * domain.axis_interval(axis).size() / grid.resolution(axis);
+        }
+
+        cells.assign(size_t(res[0]) * res[1] * res[2], 0.0);
+        for (int k = 0; k < grid.resolution(2); ++k)
+        {
+            for (int j = 0; j < grid.resolution(1); ++j)
+            {
+                for (int i = 0; i < grid.resolution(0); ++i)
+                {
+                    auto& m = cells[index(i / cell_voxels, j / cell_voxels, k / cell_voxels)];
+                    m = std::fmax(m, grid.voxel(i, j, k));
+                }
+            }
+        }
+    }
+
+    // Walk the cells crossed by the ray over the parameter span [t_min, t_max].
+    // visit(t0, t1, majorant) is called for every cell in order and returns true to stop.
+    template<typename F>
+    void traverse(const ray& r, double t_min, double t_max, F&& visit) const
+    {
+        const point3 origin(domain.x.min, domain.y.min, domain.z.min);
+        traverse_grid(r, t_min, t_max, origin, cell_size, res, [&](const int (&cell)[3], double t0, double t1)
+        {
+            return visit(t0, t1, cells[index(cell[0], cell[1], cell[2])]);
+        });
+    }
+
+private:
+    size_t index(int i, int j, int k) const
+    {
+        return (size_t(k) * res[1] + j) * res[0] + i;
+    }
+
+    aabb domain;
+    int res[3];
+    double cell_size[3];
+    std::vector<double> cells;
+};
+
+// A participating medium with spatially varying density over the box domain of a density
+// grid. Collisions are found with delta tracking against the majorant grid: tentative
+// collisions are sampled with the cell majorant and accepted with probability density / majorant.
+// The domain is a box, so the medium bounds cost a single slab test per ray segment.
+class heterogeneous_medium final : public hittable
+{
+public:
+    heterogeneous_medium(std::shared_ptr<density_grid> grid, const texture* tex)
+        : grid(grid)
+        , majorants(*grid)
+        , phase_function(tex)
+    {}
+
+    heterogeneous_medium(std::shared_ptr<density_grid> grid, const color& albedo)
+        : grid(grid)
+        , majorants(*grid)
+        , phase_function(albedo)
+    {}
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override
+    {
+        double t_min;
+        double t_max;
+        if (!clip_to_box(r, grid->bounds(), ray_t, t_min, t_max))
+        {
+            return false;
+        }
+
+        const auto ray_length = r.direction().length();
+        const auto density = [&](const point3& p) { return grid->density(p); };
+        bool collided = false;
+        double t_hit = 0;
+
+        majorants.traverse(r, t_min, t_max, [&](double t0, double t1, double majorant)
+        {
+            collided = delta_track(r, t0, t1, majorant, ray_length, density, t_hit);
+            return collided;
+        });
+
+        if (!collided)
+        {
+            return false;
+        }
+
+        rec.t = t_hit;
+        rec.p = r.at(rec.t);
+        rec.normal = vec3(1, 0, 0); // arbitrary
+        rec.front_face = true; // also arbitrary
+        rec.u = 0;
+        rec.v = 0;
+        rec.mat = &phase_function;
+
+        return true;
+    }
+
+    aabb bounding_box() const override { return grid->bounds(); }
+
+private:
+    std::shared_ptr<density_grid> grid;
+    majorant_grid majorants;
+    isotropic phase_function; // Owned by the medium, handed out as a raw handle
+};
@@ -0,0 +1,536 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <format>
+#include <memory>
+#include <print>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "denoiser.h"
+#include "environment_light.h"
+#include "hittable.h"
+#include "material.h"
+#include "pdf.h"
+#include "sampler.h"
+#include "worker_pool.h"
+
+enum class integrator_type
+{
+    recursive, // One path at a time, depth first
+    wavefront // Batches of paths advanced stage by stage, shaded in material sorted queues
+};
+
+// Path tracer that advances a large batch of paths together, one stage at a time, instead of
+// following each path to its end before starting the next:
+//   reorder   sort the surviving secondary rays by direction and origin
+//   generate  fill the free slots of the batch with new camera paths
+//   extend    intersect the ray of every path with the scene
+//   sort      bin the hits by material type
+//   shade     add emission and scatter, one material type at a time
+//   connect   trace the light samples taken while shading and add the light they reach
+//   compact   retire finished paths into their pixels
+// Each stage is a tight loop over the batch split across the worker threads. The shading stage
+// runs a kernel compiled for one concrete material type over all hits of that type, so the
+// material code and data stay in cache instead of changing from one ray to the next. In the
+// same way, diffuse and glossy bounces scatter rays in all directions, and the reorder stage
+// groups them so that rays traversed one after another visit the same hierarchy nodes.
+//
+// Every path keeps its own sample dimension, so with a low discrepancy sampler each path draws
+// exactly the values it would draw in the recursive integrator.
+class wavefront_integrator
+{
+public:
+    int max_depth = 10; // Maximum number of ray bounces into scene
+    mis_heuristic heuristic = mis_heuristic::power; // How light found by both scattered rays and light samples is shared
+    color background; // Scene background color
+    const environment_light* environment = nullptr; // Seen by missing rays instead of background when set
+    sampler_type sampling = sampler_type::sobol;
+    uint32_t sampler_seed = 0;
+    size_t batch_size = size_t(1) << 16; // Paths in flight
+    size_t reorder_batch = 4096; // Secondary rays sorted together before traversal, 0 to not sort
+
+    // Traversal statistics summed over every render of the integrator
+    struct trace_stats
+    {
+        uint64_t rays = 0; // Rays traced by the extend stage
+        uint64_t node_visits = 0; // Hierarchy nodes they visited, with RAY_TRACER_TRAVERSAL_STATS
+        uint64_t light_rays = 0; // Light sample rays traced by the connect stage
+        double extend_seconds = 0; // Time in the extend stage
+        double reorder_seconds = 0; // Time in the reorder stage
+    };
+
+    explicit wavefront_integrator(int thread_count = 0)
+        : owned_pool(std::make_unique<worker_pool>(thread_count))
+        , pool(*owned_pool)
+    {
+    }
+
+    // Run the stages on threads shared with other renders
+    explicit wavefront_integrator(worker_pool& shared_pool) : pool(shared_pool) {}
+
+    // Trace samples [first_sample, first_sample + sample_count) of every pixel in the rows
+    // [first_row, first_row + row_count) of an image width pixels wide. camera_ray(i, j) returns
+    // a camera ray through pixel i, j. Every finished path is handed to
+    // retire(pixel, sample, radiance, first_hit) on the calling thread, in no particular order.
+    template<typename CameraRay, typename Retire>
+    void render(const hittable& world, const hittable& lights, int width, int first_row, int row_count,
+        int first_sample, int sample_count, const CameraRay& camera_ray, const Retire& retire)
+    {
+        image_width = width;
+        scene_bounds = world.bounding_box();
+        paths.resize(batch_size);
+        sorted_paths.resize(batch_size);
+        records.resize(batch_size);
+        order.resize(batch_size);
+        samplers.clear();
+        for (int worker = 0; worker < pool.size(); ++worker)
+        {
+            samplers.push_back(make_sampler(sampling, sampler_seed));
+        }
+
+        const auto first_pixel = size_t(first_row) * width;
+        const auto total = size_t(width) * row_count * sample_count;
+        size_t issued = 0;
+        size_t active = 0;
+        while (true)
+        {
+            reorder(active);
+
+            const auto fresh = std::min(batch_size - active, total - issued);
+            generate(active, issued, fresh, first_pixel, first_sample, sample_count, camera_ray);
+            active += fresh;
+            issued += fresh;
+            if (active == 0)
+            {
+                break;
+            }
+
+            extend(world, lights, active);
+            sort(active);
+            shade(lights);
+            connect(world, active);
+            active = compact(active, retire);
+
+            std::print(std::clog, "\rPaths remaining {} ", total - issued + active);
+            std::clog.flush();
+        }
+    }
+
+    const trace_stats& statistics() const { return stats; }
+
+    void print_stats() const
+    {
+        const auto rays = double(std::max<uint64_t>(stats.rays, 1));
+        const auto nodes = traversal_stats ? std::format("{:.1f} nodes per ray, ", stats.node_visits / rays) : std::string();
+        std::println(std::clog, "\rTraced {} rays: {}{:.0f} ns per ray, reorder {:.0f} ns per ray, {} light samples",
+            stats.rays, nodes, 1e9 * stats.extend_seconds / rays, 1e9 * stats.reorder_seconds / rays, stats.light_rays);
+    }
+
+private:
+    // Radiance of a ray that missed the world
+    color sky(const ray& r) const
+    {
+        return environment ? environment->radiance(r.direction()) : background;
+    }
+
+    struct path_state
+    {
+        ray r;
+        double scatter_pdf; // Density r was scattered with, 0 for camera rays and specular bounces
+        color throughput; // Product of the path weights so far
+        color radiance; // Light gathered so far
+        ray light_sample; // Taken at the last hit, traced by the connect stage
+        color light_sample_weight; // Radiance added per unit of light the sample reaches
+        bool light_sample_pending;
+        uint32_t pixel;
+        uint32_t sample;
+        uint32_t dimension; // Next sample dimension of the path
+        int depth; // Bounces left
+        bool alive;
+        aov_sample first_hit;
+    };
+
+    struct sort_key
+    {
+        uint32_t key;
+        uint32_t path;
+    };
+
+    static constexpr size_t grain = 256;
+    static constexpr size_t kind_count = size_t(material_kind::glossy) + 1;
+
+    // Install the worker's sampler at the path's next dimension
+    void resume(int worker, const path_state& path) const
+    {
+        if (auto* samples = samplers[worker].get())
+        {
+            samples->resume_sample(int(path.pixel % image_width), int(path.pixel / image_width), path.sample, path.dimension);
+            active_sample_stream = samples;
+        }
+    }
+
+    // Remember where the path's sample got to and uninstall the sampler
+    void suspend(int worker, path_state& path) const
+    {
+        if (auto* samples = samplers[worker].get())
+        {
+            path.dimension = samples->current_dimension();
+            active_sample_stream = nullptr;
+        }
+    }
+
+    // Spread the low 7 bits of v to every third bit
+    static uint32_t spread_bits(uint32_t v)
+    {
+        v &= 0x7f;
+        v = (v | (v << 8)) & 0x0000f00f;
+        v = (v | (v << 4)) & 0x000c30c3;
+        v = (v | (v << 2)) & 0x00249249;
+        return v;
+    }
+
+    // 24 bit sort key, the direction octant in the top bits and below it the Morton code of the
+    // origin on a 128^3 grid over the scene bounds
+    uint32_t ray_key(const ray& r) const
+    {
+        const auto& d = r.direction();
+        const uint32_t octant = (d.x() < 0 ? 1 : 0) | (d.y() < 0 ? 2 : 0) | (d.z() < 0 ? 4 : 0);
+
+        uint32_t code = 0;
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            const auto& extent = scene_bounds.axis_interval(axis);
+            const auto cell = extent.size() > 0 ? (r.origin()[axis] - extent.min) / extent.size() * 128 : 0.0;
+            code |= spread_bits(uint32_t(std::clamp(cell, 0.0, 127.0))) << axis;
+        }
+        return (octant << 21) | code;
+    }
+
+    // Stable radix sort of keys [first, last) by their 24 bit key, one byte per pass
+    void radix_sort(size_t first, size_t last)
+    {
+        auto* from = keys.data();
+        auto* to = sorted_keys.data();
+        for (int shift = 0; shift < 24; shift += 8)
+        {
+            std::array<uint32_t, 256> offsets{};
+            for (auto k = first; k < last; ++k)
+            {
+                ++offsets[(from[k].key >> shift) & 0xff];
+            }
+            uint32_t sum = 0;
+            for (auto& offset : offsets)
+            {
+                sum += std::exchange(offset, sum);
+            }
+            for (auto k = first; k < last; ++k)
+            {
+                to[first + offsets[(from[k].key >> shift) & 0xff]++] = from[k];
+            }
+            std::swap(from, to);
+        }
+        // An odd number of passes leaves the result in sorted_keys
+    }
+
+    // Sort the secondary paths [0, count) in windows of reorder_batch paths by ray key
+    void reorder(size_t count)
+    {
+        if (reorder_batch < 2 || count < 2)
+        {
+            return;
+        }
+
+        const auto start = std::chrono::steady_clock::now();
+        keys.resize(count);
+        sorted_keys.resize(count);
+        pool.parallel_for(count, grain, [&](size_t begin, size_t end, int)
+        {
+            for (auto k = begin; k < end; ++k)
+            {
+                keys[k] = sort_key{ray_key(paths[k].r), uint32_t(k)};
+            }
+        });
+
+        const auto windows = (count + reorder_batch - 1) / reorder_batch;
+        pool.parallel_for(windows, 1, [&](size_t begin, size_t end, int)
+        {
+            for (auto window = begin; window < end; ++window)
+            {
+                const auto first = window * reorder_batch;
+                const auto last = std::min(first + reorder_batch, count);
+                radix_sort(first, last);
+                for (auto k = first; k < last; ++k)
+                {
+                    sorted_paths[k] = paths[sorted_keys[k].path];
+                }
+            }
+        });
+        paths.swap(sorted_paths);
+        stats.reorder_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    template<typename CameraRay>
+    void generate(size_t first_slot, size_t first_path, size_t count, size_t first_pixel, int first_sample,
+        int sample_count, const CameraRay& camera_ray)
+    {
+        pool.parallel_for(count, grain, [&](size_t begin, size_t end, int worker)
+        {
+            for (auto k = begin; k < end; ++k)
+            {
+                const auto index = first_path + k;
+                auto& path = paths[first_slot + k];
+                path.pixel = uint32_t(first_pixel + index / sample_count);
+                path.sample = uint32_t(first_sample + index % sample_count);
+                path.dimension = 0;
+                resume(worker, path);
+                path.r = camera_ray(int(path.pixel % image_width), int(path.pixel / image_width));
+                suspend(worker, path);
+                path.scatter_pdf = 0;
+                path.throughput = color(1, 1, 1);
+                path.radiance = color(0, 0, 0);
+                path.light_sample_pending = false;
+                path.depth = max_depth;
+                path.alive = true;
+                path.first_hit = aov_sample{};
+            }
+        });
+    }
+
+    void extend(const hittable& world, const hittable& lights, size_t count)
+    {
+        const auto start = std::chrono::steady_clock::now();
+        std::atomic<uint64_t> rays = 0;
+        std::atomic<uint64_t> node_visits = 0;
+        pool.parallel_for(count, grain, [&](size_t begin, size_t end, int worker)
+        {
+            const auto visits_before = traversal_node_visits;
+            uint64_t traced = 0;
+            for (auto k = begin; k < end; ++k)
+            {
+                auto& path = paths[k];
+                if (path.depth <= 0)
+                {
+                    path.alive = false;
+                    continue;
+                }
+
+                resume(worker, path);
+                const bool hit = world.hit(path.r, interval(0.001, infinity), records[k]);
+                suspend(worker, path);
+                ++traced;
+                if (path.depth == max_depth)
+                {
+                    if (hit)
+                    {
+                        path.first_hit.normal = records[k].normal;
+                        path.first_hit.depth = records[k].t * path.r.direction().length();
+                    }
+                    else
+                    {
+                        path.first_hit.albedo = emission_albedo(sky(path.r));
+                    }
+                }
+                if (!hit)
+                {
+                    path.radiance += path.throughput * sky(path.r)
+                        * scattered_light_weight(heuristic, path.r, lights, path.scatter_pdf);
+                    path.alive = false;
+                }
+            }
+            rays += traced;
+            node_visits += traversal_node_visits - visits_before;
+        });
+        stats.rays += rays;
+        stats.node_visits += node_visits;
+        stats.extend_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    // Counting sort of the live paths by material kind into order, with bins[kind] the start
+    // of each kind's range
+    void sort(size_t count)
+    {
+        std::array<size_t, kind_count + 1> counts{};
+        for (size_t k = 0; k < count; ++k)
+        {
+            if (paths[k].alive)
+            {
+                ++counts[size_t(records[k].mat->kind()) + 1];
+            }
+        }
+        for (size_t kind = 0; kind < kind_count; ++kind)
+        {
+            counts[kind + 1] += counts[kind];
+        }
+        bins = counts;
+        for (size_t k = 0; k < count; ++k)
+        {
+            if (paths[k].alive)
+            {
+                order[counts[size_t(records[k].mat->kind())]++] = uint32_t(k);
+            }
+        }
+    }
+
+    void shade(const hittable& lights)
+    {
+        for (size_t kind = 0; kind < kind_count; ++kind)
+        {
+            const auto begin = bins[kind];
+            const auto end = bins[kind + 1];
+            if (begin == end)
+            {
+                continue;
+            }
+
+            visit_material(*records[order[begin]].mat, [&](const auto& mat)
+            {
+                shade_kind<std::decay_t<decltype(mat)>>(lights, begin, end);
+            });
+        }
+    }
+
+    // Shade the sorted hits order[begin, end), all with materials of type T
+    template<typename T>
+    void shade_kind(const hittable& lights, size_t begin, size_t end)
+    {
+        pool.parallel_for(end - begin, grain, [&](size_t first, size_t last, int worker)
+        {
+            for (auto k = begin + first; k < begin + last; ++k)
+            {
+                auto& path = paths[order[k]];
+                const auto& rec = records[order[k]];
+                const auto& mat = static_cast<const T&>(*rec.mat);
+                resume(worker, path);
+
+                const auto emission = mat.emitted(path.r, rec, rec.u, rec.v, rec.p);
+                if (!emission.near_zero())
+                {
+                    path.radiance += path.throughput * emission
+                        * scattered_light_weight(heuristic, path.r, lights, path.scatter_pdf);
+                }
+
+                scatter_record srec;
+                const bool scattered_ray = mat.scatter(path.r, rec, srec);
+                if (path.depth == max_depth)
+                {
+                    path.first_hit.albedo = scattered_ray ? srec.attenuation : emission_albedo(emission);
+                }
+
+                if (!scattered_ray)
+                {
+                    path.alive = false;
+                }
+                else if (srec.skip_pdf)
+                {
+                    path.throughput = path.throughput * srec.attenuation;
+                    path.r = srec.skip_pdf_ray;
+                    path.scatter_pdf = 0;
+                }
+                else
+                {
+                    // Like in camera::ray_color, only with a bounce left for the light it reaches
+                    if (path.depth > 1)
+                    {
+                        const hittable_pdf toward_lights(lights, rec.p);
+                        const ray light_ray(rec.p, toward_lights.generate(), path.r.time());
+                        const auto light_pdf = toward_lights.value(light_ray.direction());
+                        const auto light_scattering_pdf = mat.scattering_pdf(path.r, rec, light_ray);
+                        if (light_pdf > 0 && light_scattering_pdf > 0)
+                        {
+                            const auto weight = mis_weight(heuristic, light_pdf, srec.pdf_ptr->value(light_ray.direction()));
+                            path.light_sample = light_ray;
+                            path.light_sample_weight = path.throughput * srec.attenuation * light_scattering_pdf
+                                * weight / light_pdf;
+                            path.light_sample_pending = true;
+                        }
+                    }
+
+                    auto scattered = ray(rec.p, srec.pdf_ptr->generate(), path.r.time());
+                    auto pdf_value = srec.pdf_ptr->value(scattered.direction());
+                    double scattering_pdf = mat.scattering_pdf(path.r, rec, scattered);
+
+                    path.throughput = path.throughput * (srec.attenuation * scattering_pdf) / pdf_value;
+                    path.r = scattered;
+                    path.scatter_pdf = pdf_value;
+                }
+                --path.depth;
+
+                suspend(worker, path);
+            }
+        });
+    }
+
+    // Trace the pending light samples and add the light emitted by whatever they hit first
+    void connect(const hittable& world, size_t count)
+    {
+        std::atomic<uint64_t> rays = 0;
+        pool.parallel_for(count, grain, [&](size_t begin, size_t end, int worker)
+        {
+            uint64_t traced = 0;
+            for (auto k = begin; k < end; ++k)
+            {
+                auto& path = paths[k];
+                if (!path.light_sample_pending)
+                {
+                    continue;
+                }
+
+                resume(worker, path);
+                hit_record rec;
+                const auto& r = path.light_sample;
+                const auto emission = world.hit(r, interval(0.001, infinity), rec)
+                    ? visit_material(*rec.mat, [&](const auto& mat) { return mat.emitted(r, rec, rec.u, rec.v, rec.p); })
+                    : sky(r);
+                suspend(worker, path);
+                ++traced;
+
+                path.radiance += path.light_sample_weight * emission;
+                path.light_sample_pending = false;
+            }
+            rays += traced;
+        });
+        stats.light_rays += rays;
+    }
+
+    // Move the live paths to the front of the batch and retire the finished ones
+    template<typename Retire>
+    size_t compact(size_t count, const Retire& retire)
+    {
+        size_t kept = 0;
+        for (size_t k = 0; k < count; ++k)
+        {
+            if (paths[k].alive)
+            {
+                if (kept != k)
+                {
+                    paths[kept] = paths[k];
+                }
+                ++kept;
+            }
+            else
+            {
+                retire(paths[k].pixel, paths[k].sample, paths[k].radiance, paths[k].first_hit);
+            }
+        }
+        return kept;
+    }
+
+    std::unique_ptr<worker_pool> owned_pool;
+    worker_pool& pool;
+    int image_width = 0;
+    aabb scene_bounds;
+    trace_stats stats;
+    std::vector<path_state> paths;
+    std::vector<path_state> sorted_paths;
+    std::vector<sort_key> keys;
+    std::vector<sort_key> sorted_keys;
+    std::vector<hit_record> records;
+    std::vector<uint32_t> order;
+    std::array<size_t, kind_count + 1> bins{};
+    std::vector<std::unique_ptr<sampler>> samplers;
+};
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of threads that run parallel loops. The calling thread takes part in every loop
+// as worker 0, so a pool of one thread runs the loops inline.
+class worker_pool
+{
+public:
+    // thread_count 0 uses one thread per hardware thread
+    explicit worker_pool(int thread_count = 0)
+    {
+        const int count = thread_count > 0 ? thread_count : int(std::max(1u, std::thread::hardware_concurrency()));
+        for (int worker = 1; worker < count; ++worker)
+        {
+            threads.emplace_back([this, worker] { work(worker); });
+        }
+    }
+
+    worker_pool(const worker_pool&) = delete;
+    worker_pool& operator=(const worker_pool&) = delete;
+
+    ~worker_pool()
+    {
+        {
+            std::lock_guard lock(mutex);
+            stopping = true;
+        }
+        start.notify_all();
+        for (auto& thread : threads)
+        {
+            thread.join();
+        }
+    }
+
+    int size() const { return int(threads.size()) + 1; }
+
+    // Call body(begin, end, worker) on chunks of at most grain items until [0, count) is done
+    void parallel_for(size_t count, size_t grain, const std::function<void(size_t, size_t, int)>& body)
+    {
+        if (count == 0)
+        {
+            return;
+        }
+        if (threads.empty() || count <= grain)
+        {
+            body(0, count, 0);
+            return;
+        }
+
+        {
+            std::lock_guard lock(mutex);
+            job = &body;
+            job_count = count;
+            job_grain = grain;
+            next_item = 0;
+            busy = int(threads.size());
+            ++generation;
+        }
+        start.notify_all();
+        run_chunks(0);
+
+        std::unique_lock lock(mutex);
+        done.wait(lock, [this] { return busy == 0; });
+        job = nullptr;
+    }
+
+private:
+    void work(int worker)
+    {
+        uint64_t seen = 0;
+        while (true)
+        {
+            {
+                std::unique_lock lock(mutex);
+                start.wait(lock, [&] { return stopping || generation != seen; });
+                if (stopping)
+                {
+                    return;
+                }
+                seen = generation;
+            }
+
+            run_chunks(worker);
+
+            {
+                std::lock_guard lock(mutex);
+                --busy;
+            }
+            done.notify_one();
+        }
+    }
+
+    void run_chunks(int worker)
+    {
+        while (true)
+        {
+            const auto begin = next_item.fetch_add(job_grain);
+            if (begin >= job_count)
+            {
+                return;
+            }
+            (*job)(begin, std::min(begin + job_grain, job_count), worker);
+        }
+    }
+
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable start;
+    std::condition_variable done;
+    const std::function<void(size_t, size_t, int)>* job = nullptr;
+    size_t job_count = 0;
+    size_t job_grain = 1;
+    std::atomic<size_t> next_item = 0;
+    int busy = 0;
+    uint64_t generation = 0;
+    bool stopping = false;
+};